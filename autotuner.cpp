@@ -0,0 +1,399 @@
+// autotuner.cpp
+#include "autotuner.h"
+#include "content_hash.h"
+#include "convolution.h"
+#include "image_processor.h"
+#include "priority_gate.h"
+#include "thread_budget.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    // Bump when decisions change meaning so older profiles are re-tuned
+    const int ProfileVersion = 2;
+
+    // A candidate must beat the default by this much to replace it; smaller
+    // differences are measurement noise
+    const double Margin = 0.05;
+
+    // Taps stored when the FFT never won; larger than any kernel
+    const int NeverTaps = 256 * 256;
+
+    const int FourierTiles[] = {256, 512, 1024};
+    const int CrossoverSizes[] = {5, 7, 9, 11, 13, 15, 19, 23, 27, 31, 41, 51};
+
+    std::mutex profileMutex; // Guards the choices below
+    QHash<QString, int> choices;
+    std::atomic<quint64> choicesKey{0}; // Hash of the choices that change output bits
+
+    void install(const QHash<QString, int> &installed)
+    {
+        // Every decision but the thread count picks between kernels that round differently
+        QStringList decisions = installed.keys();
+        decisions.sort();
+        quint64 hash = 0;
+        for (const QString &decision : decisions)
+        {
+            if (decision != "threads")
+                hash = ContentHash::combine(ContentHash::string(decision, hash), static_cast<quint64>(installed.value(decision)));
+        }
+
+        std::lock_guard<std::mutex> lock(profileMutex);
+        choices = installed;
+        choicesKey = hash;
+    }
+
+    std::atomic<bool> cancelled{false};
+
+    const char *bucketName(Autotuner::Bucket bucket)
+    {
+        switch (bucket)
+        {
+        case Autotuner::Bucket::Small: return "small";
+        case Autotuner::Bucket::Medium: return "medium";
+        case Autotuner::Bucket::Large: return "large";
+        }
+        return "large";
+    }
+
+    QString key(const QString &decision, Autotuner::Bucket bucket)
+    {
+        return decision + "@" + bucketName(bucket);
+    }
+
+    int hardwareThreads()
+    {
+        return qMax(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    // Fastest of a few runs after a warm-up; the minimum is the least disturbed by
+    // other work on the machine
+    double seconds(const std::function<void()> &run)
+    {
+        run();
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < 3; ++i)
+        {
+            int64 start = cv::getTickCount();
+            run();
+            best = qMin(best, double(cv::getTickCount() - start) / cv::getTickFrequency());
+        }
+        return best;
+    }
+
+    // Between measurements: yield to interactive previews, and stop when the process exits
+    bool proceed()
+    {
+        PriorityGate::checkpoint();
+        return !cancelled.load();
+    }
+
+    QString timings(const QList<QPair<int, double>> &results)
+    {
+        QStringList parts;
+        for (const auto &result : results)
+            parts.append(QString("%1: %2 ms").arg(result.first).arg(result.second * 1000.0, 0, 'f', 1));
+        return parts.join(", ");
+    }
+
+    // Candidate with the shortest time, unless the first (the default) is within the margin
+    int winner(const QList<QPair<int, double>> &results)
+    {
+        auto best = results.first();
+        for (const auto &result : results)
+        {
+            if (result.second < best.second)
+                best = result;
+        }
+        return best.second < results.first().second * (1.0 - Margin) ? best.first : results.first().first;
+    }
+
+    struct Tuning
+    {
+        QHash<QString, int> choices;
+        QStringList report;
+
+        void record(const QString &name, int value, const QString &detail)
+        {
+            choices.insert(name, value);
+            report.append(QString("%1 = %2 (%3)").arg(name).arg(value).arg(detail));
+        }
+    };
+
+    bool tuneBucket(Autotuner::Bucket bucket, const cv::Size &size, Tuning &tuning)
+    {
+        cv::RNG rng(0x5EED);
+        cv::Mat image(size, CV_8UC3);
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+
+        // Dense kernels with no rank-1 shortcut, as the FFT path gets them
+        auto denseKernel = [&rng](int side)
+        {
+            cv::Mat weights(side, side, CV_32F);
+            rng.fill(weights, cv::RNG::UNIFORM, 0.0f, 1.0f);
+            weights /= cv::sum(weights)[0];
+            Convolution::Kernel kernel;
+            kernel.weights = weights;
+            return kernel;
+        };
+
+        // FFT tile size, on a kernel well past the crossover
+        QList<QPair<int, double>> tiles;
+        const Convolution::Kernel large = denseKernel(31);
+        for (int tile : FourierTiles)
+        {
+            if (!proceed())
+                return false;
+            tiles.append({tile, seconds([&]() { Convolution::apply(image, large, 0.0, Convolution::Strategy::Fourier, tile); })});
+        }
+        // 512, the built-in default, first
+        std::swap(tiles[0], tiles[1]);
+        const int tile = winner(tiles);
+        tuning.record(key("convolution.fourierTile", bucket), tile, timings(tiles));
+
+        // Smallest kernel for which the FFT wins, on a whole image (where filter2D switches
+        // to its own transform past 130 taps) and on a view into one (where it never does)
+        const QPair<const char *, cv::Mat> inputs[] = {
+            {"convolution.fourierTaps", image},
+            {"convolution.fourierTaps.view", image(cv::Rect(1, 1, image.cols - 2, image.rows - 2))}};
+        for (const auto &input : inputs)
+        {
+            int taps = NeverTaps;
+            QList<QPair<int, double>> crossover;
+            for (int side : CrossoverSizes)
+            {
+                if (!proceed())
+                    return false;
+                const Convolution::Kernel kernel = denseKernel(side);
+                double direct = seconds([&]() { Convolution::apply(input.second, kernel, 0.0, Convolution::Strategy::Direct); });
+                double fourier = seconds([&]() { Convolution::apply(input.second, kernel, 0.0, Convolution::Strategy::Fourier, tile); });
+                crossover.append({side, fourier / direct});
+                if (fourier < direct)
+                {
+                    taps = side * side;
+                    break;
+                }
+            }
+            QStringList ratios;
+            for (const auto &entry : crossover)
+                ratios.append(QString("%1x%1: FFT/direct %2").arg(entry.first).arg(entry.second, 0, 'f', 2));
+            tuning.record(key(input.first, bucket), taps, ratios.join(", "));
+        }
+
+        // Gaussian blur implementations, at a small and a large radius
+        const QPair<const char *, int> radii[] = {{"blur.gaussian.small", 3}, {"blur.gaussian.large", 24}};
+        for (const auto &radius : radii)
+        {
+            QList<QPair<int, double>> methods;
+            for (ImageProcessor::GaussianMethod method :
+                 {ImageProcessor::GaussianMethod::Library, ImageProcessor::GaussianMethod::Separable})
+            {
+                if (!proceed())
+                    return false;
+                methods.append({int(method), seconds([&]() { ImageProcessor::applyGaussian(image, radius.second, method); })});
+            }
+            tuning.record(key(radius.first, bucket), winner(methods), timings(methods));
+        }
+        return true;
+    }
+
+    // Fewest threads within the margin of the fastest; on a machine whose extra
+    // threads don't help, the spare cores are left to concurrent renders
+    bool tuneThreads(Tuning &tuning)
+    {
+        const int total = ThreadBudget::total();
+        if (total <= 1 || !ThreadBudget::routesOpenCv())
+            return true; // Thread counts can't be varied here
+
+        cv::RNG rng(0x5EED);
+        cv::Mat image(cv::Size(2560, 1600), CV_8UC3);
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+        Convolution::Kernel kernel;
+        kernel.weights = cv::Mat(9, 9, CV_32F);
+        rng.fill(kernel.weights, cv::RNG::UNIFORM, 0.0f, 1.0f / 81.0f);
+
+        QList<QPair<int, double>> counts;
+        for (int threads = 1; threads < total * 2; threads *= 2)
+        {
+            const int n = qMin(threads, total);
+            if (!proceed())
+                return false;
+
+            // Holding the other slots leaves OpenCV n threads: the caller and n - 1 helpers
+            int held = ThreadBudget::tryAcquire(total - n);
+            double time = seconds([&]()
+                                  {
+                Convolution::apply(image, kernel, 0.0, Convolution::Strategy::Direct);
+                ImageProcessor::applyGaussian(image, 8, ImageProcessor::GaussianMethod::Library); });
+            ThreadBudget::release(held);
+            counts.append({n, time});
+            if (n == total)
+                break;
+        }
+
+        double fastest = std::numeric_limits<double>::max();
+        for (const auto &count : counts)
+            fastest = qMin(fastest, count.second);
+        int threads = total;
+        for (const auto &count : counts)
+        {
+            if (count.second <= fastest * (1.0 + Margin))
+            {
+                threads = count.first;
+                break;
+            }
+        }
+        tuning.record("threads", threads, timings(counts));
+        return true;
+    }
+
+    // Owns the background tuning thread, so the process waits for it (cut short) at exit
+    struct BackgroundTuning
+    {
+        std::thread thread;
+
+        ~BackgroundTuning()
+        {
+            cancelled = true;
+            if (thread.joinable())
+                thread.join();
+        }
+    };
+}
+
+Autotuner::Bucket Autotuner::bucket(const cv::Size &imageSize)
+{
+    const double megapixels = double(imageSize.width) * imageSize.height / 1e6;
+    if (megapixels < 2.0)
+        return Bucket::Small;
+    if (megapixels < 8.0)
+        return Bucket::Medium;
+    return Bucket::Large;
+}
+
+int Autotuner::choice(const QString &decision, Bucket bucket, int fallback)
+{
+    return choice(key(decision, bucket), fallback);
+}
+
+int Autotuner::choice(const QString &decision, int fallback)
+{
+    std::lock_guard<std::mutex> lock(profileMutex);
+    return choices.value(decision, fallback);
+}
+
+QString Autotuner::cpuModel()
+{
+    // Linux names the model in /proc/cpuinfo; elsewhere the architecture has to do
+    QFile cpuinfo("/proc/cpuinfo");
+    if (cpuinfo.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        for (const QByteArray &line : cpuinfo.readAll().split('\n'))
+        {
+            if (line.startsWith("model name"))
+                return QString::fromUtf8(line.mid(line.indexOf(':') + 1)).simplified();
+        }
+    }
+    return QSysInfo::currentCpuArchitecture();
+}
+
+QString Autotuner::profilePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/kernel_profile.json";
+}
+
+bool Autotuner::load()
+{
+    QFile file(profilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonObject profile = QJsonDocument::fromJson(file.readAll()).object();
+    if (profile.value("version").toInt() != ProfileVersion || profile.value("cpu").toString() != cpuModel() ||
+        profile.value("hardwareThreads").toInt() != hardwareThreads())
+    {
+        qDebug() << "Kernel profile" << file.fileName() << "was tuned for another CPU; re-tuning";
+        return false;
+    }
+
+    QHash<QString, int> loaded;
+    QJsonObject saved = profile.value("choices").toObject();
+    for (auto it = saved.constBegin(); it != saved.constEnd(); ++it)
+        loaded.insert(it.key(), it.value().toInt());
+
+    install(loaded);
+    return true;
+}
+
+quint64 Autotuner::outputKey()
+{
+    return choicesKey;
+}
+
+bool Autotuner::tune(QStringList *report, bool threads)
+{
+    Tuning tuning;
+    const QPair<Bucket, cv::Size> buckets[] = {
+        {Bucket::Small, cv::Size(1280, 800)}, {Bucket::Medium, cv::Size(2560, 1600)}, {Bucket::Large, cv::Size(4096, 3072)}};
+    for (const auto &entry : buckets)
+    {
+        if (!tuneBucket(entry.first, entry.second, tuning))
+            return false;
+    }
+    if (threads && !tuneThreads(tuning))
+        return false;
+
+    install(tuning.choices);
+    if (report)
+        report->append(tuning.report);
+
+    QJsonObject saved;
+    for (auto it = tuning.choices.constBegin(); it != tuning.choices.constEnd(); ++it)
+        saved.insert(it.key(), it.value());
+    QJsonObject profile;
+    profile.insert("version", ProfileVersion);
+    profile.insert("cpu", cpuModel());
+    profile.insert("hardwareThreads", hardwareThreads());
+    profile.insert("tuned", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    profile.insert("choices", saved);
+
+    QSaveFile file(profilePath());
+    QDir().mkpath(QFileInfo(file.fileName()).absolutePath());
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Cannot write kernel profile" << file.fileName();
+        return false;
+    }
+    file.write(QJsonDocument(profile).toJson());
+    return file.commit();
+}
+
+void Autotuner::tuneInBackground()
+{
+    static BackgroundTuning background;
+    if (background.thread.joinable())
+        return;
+
+    background.thread = std::thread([]()
+                                    {
+        PriorityGate::Scope scope(PriorityGate::Background);
+        QStringList report;
+        if (tune(&report, false))
+            qDebug().noquote() << "Kernel profile tuned for" << cpuModel() << "\n " << report.join("\n  ");
+    });
+}
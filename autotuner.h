@@ -0,0 +1,61 @@
+// autotuner.h
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <QStringList>
+
+// Per-machine kernel profile. Where several implementations of an operation give the
+// same result up to rounding, which one is fastest depends on the CPU, so the tuner
+// times the candidates on synthetic images in three size buckets and saves the
+// winners, with the CPU model they were measured on, to a JSON profile. Kernels
+// consult the profile at run time and fall back to built-in defaults without one.
+// Decisions:
+//  - convolution.fourierTile: FFT tile size of the Convolution node
+//  - convolution.fourierTaps: kernel taps from which the FFT beats filter2D on whole
+//    images; .view: the same on views into larger images (region and tile renders)
+//  - blur.gaussian.small / .large: GaussianBlur (0) or separable float passes (1),
+//    for radii up to 8 and above
+//  - threads: size of the thread budget, when --threads isn't given
+namespace Autotuner
+{
+    enum class Bucket
+    {
+        Small,  // Under 2 MP
+        Medium, // Under 8 MP
+        Large
+    };
+    Bucket bucket(const cv::Size &imageSize);
+
+    // The profile's winner for a decision at a size bucket, or fallback if it has none
+    int choice(const QString &decision, Bucket bucket, int fallback);
+    // Bucket-independent decisions such as threads
+    int choice(const QString &decision, int fallback);
+
+    // Processor model name, e.g. "AMD EPYC 7763 64-Core Processor"
+    QString cpuModel();
+
+    // Profile in the application's local data folder
+    QString profilePath();
+
+    // Load the saved profile; false if there is none, or it was tuned on another CPU
+    bool load();
+
+    // Hash of the installed decisions that change output bits, which is every decision
+    // but threads; 0 without a profile. Part of every render cache key, so results
+    // computed under another profile are never reused.
+    quint64 outputKey();
+
+    // Time the candidates, then install and save the winners; one line per decision is
+    // added to report. The thread count is only measured if threads is set, since its
+    // measurements hold the thread budget. Returns false if cancelled (by the process
+    // exiting) or unsaved.
+    bool tune(QStringList *report = nullptr, bool threads = true);
+
+    // tune() without the thread count on a background thread, at background priority;
+    // kernel choices apply when it finishes
+    void tuneInBackground();
+}
+
+#endif // AUTOTUNER_H
@@ -1,14 +1,28 @@
 // canvaswidget.cpp
 #include "canvaswidget.h"
+#include "node_graph.h"
+#include "priority_gate.h"
+#include "renditions.h"
 #include <QPainter>
 #include <QMouseEvent>
 #include <QDebug>
 
+namespace
+{
+    // Size of the card drawn for nodes without an image of their own
+    const QSize CardSize(200, 150);
+
+    // Thumbnails kept before the cache is cleared; one per Output node is typical
+    const int MaxThumbnails = 64;
+}
+
 CanvasWidget::CanvasWidget(QWidget *parent)
     : QWidget(parent)
 {
     setStyleSheet("background-color: gray;");
     setMouseTracking(true); // Enable mouse tracking for the widget
+    m_exportPool.setMaxThreadCount(1); // Exports run one at a time, in the order requested
+    m_thumbnailPool.setMaxThreadCount(1);
 }
 void CanvasWidget::paintEvent(QPaintEvent *event)
 {
@@ -27,26 +41,38 @@ void CanvasWidget::paintEvent(QPaintEvent *event)
     // Draw each node
     for (const Node &node : m_nodes)
     {
+        const QRect rect = nodeRect(node);
+
         // First draw the selection highlight if needed
         if (node.isSelected())
         {
-            QRect rect(node.getPosition(), node.getImage().size());
             painter.setPen(QPen(Qt::yellow, 3));
             painter.drawRect(rect);
         }
 
-        // Draw the node image
-        painter.drawImage(node.getPosition(), node.getImage());
+        // Draw the node image, or its type's card with the last preview, if any, on top
+        if (!node.getImage().isNull())
+        {
+            painter.drawImage(node.getPosition(), node.getImage());
+        }
+        else
+        {
+            painter.drawImage(node.getPosition(), typeCard(node.getType()));
+            QImage thumbnail = previewThumbnail(node);
+            if (!thumbnail.isNull())
+            {
+                QRect target(QPoint(), thumbnail.size());
+                target.moveCenter(rect.center());
+                painter.drawImage(target, thumbnail);
+            }
+        }
 
         // Draw the node name
         painter.setPen(Qt::white);
         QFont font = painter.font();
         font.setBold(true);
         painter.setFont(font);
-        QRect textRect(node.getPosition().x(),
-                       node.getPosition().y() - 20,
-                       node.getImage().width(),
-                       20);
+        QRect textRect(rect.x(), rect.y() - 20, rect.width(), 20);
         painter.drawText(textRect, Qt::AlignCenter, node.getName());
 
         // Draw connections (if there are child nodes)
@@ -54,8 +80,8 @@ void CanvasWidget::paintEvent(QPaintEvent *event)
         {
             for (Node *childNode : node.getChildren())
             {
-                QPoint start = node.getPosition() + QPoint(node.getImage().width() / 2, node.getImage().height() / 2);
-                QPoint end = childNode->getPosition() + QPoint(childNode->getImage().width() / 2, childNode->getImage().height() / 2);
+                QPoint start = rect.center();
+                QPoint end = nodeRect(*childNode).center();
                 painter.setPen(QPen(Qt::black, 2));
                 painter.drawLine(start, end); // Draw line from parent to child
             }
@@ -77,8 +103,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event)
     for (int i = m_nodes.size() - 1; i >= 0; --i) // Check in reverse to handle overlapping nodes
     {
         Node &node = m_nodes[i];
-        QRect nodeRect(node.getPosition(), node.getImage().size());
-        if (nodeRect.contains(event->pos()))
+        if (nodeRect(node).contains(event->pos()))
         {
             // Select this node
             node.setSelected(true);
@@ -157,14 +182,6 @@ void CanvasWidget::loadImage(const QImage &image, const QString &filePath)
 }
 void CanvasWidget::createNode(const QString &nodeType, const QString &nodeName)
 {
-    // Create a placeholder image for the node
-    QImage nodeImage(200, 150, QImage::Format_ARGB32_Premultiplied);
-    nodeImage.fill(Qt::white);
-    QPainter painter(&nodeImage);
-    painter.setPen(Qt::black);
-    painter.setFont(QFont("Arial", 24));
-    painter.drawText(nodeImage.rect(), Qt::AlignCenter, nodeType);
-
     // Generate a unique name if none provided
     QString uniqueName = nodeName;
     if (uniqueName.isEmpty())
@@ -175,8 +192,8 @@ void CanvasWidget::createNode(const QString &nodeType, const QString &nodeName)
     // Calculate a position that doesn't overlap with existing nodes
     QPoint position(50 + m_nodeCounter * 30, 50 + m_nodeCounter * 30);
 
-    // Create the node
-    Node newNode(nodeImage, position, nodeType, uniqueName);
+    // Create the node; it has no image of its own and is drawn with its type's card
+    Node newNode(QImage(), position, nodeType, uniqueName);
 
     // Add the node to the list
     m_nodes.append(newNode);
@@ -186,6 +203,47 @@ void CanvasWidget::createNode(const QString &nodeType, const QString &nodeName)
 
 
 
+QRect CanvasWidget::nodeRect(const Node &node) const
+{
+    return QRect(node.getPosition(), node.getImage().isNull() ? CardSize : node.getImage().size());
+}
+
+const QImage &CanvasWidget::typeCard(const QString &type)
+{
+    auto it = m_typeCards.constFind(type);
+    if (it != m_typeCards.constEnd())
+        return it.value();
+
+    QImage card(CardSize, QImage::Format_ARGB32_Premultiplied);
+    card.fill(Qt::white);
+    QPainter painter(&card);
+    painter.setPen(Qt::black);
+    painter.setFont(QFont("Arial", 24));
+    painter.drawText(card.rect(), Qt::AlignCenter, type);
+    return m_typeCards.insert(type, card).value();
+}
+
+QImage CanvasWidget::previewThumbnail(const Node &node)
+{
+    const NodeProperty *preview = node.getProperty("preview");
+    if (!preview)
+        return QImage();
+
+    // A new preview takes a new version stamp, so stale thumbnails are never looked up
+    auto it = m_thumbnails.constFind(preview->version());
+    if (it != m_thumbnails.constEnd())
+        return it.value();
+
+    QImage image = preview->getValue().value<QImage>();
+    QImage thumbnail;
+    if (!image.isNull())
+        thumbnail = image.scaled(CardSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (m_thumbnails.size() >= MaxThumbnails)
+        m_thumbnails.clear();
+    m_thumbnails.insert(preview->version(), thumbnail);
+    return thumbnail;
+}
+
 Node *CanvasWidget::getSelectedNode()
 {
     for (int i = 0; i < m_nodes.size(); ++i)
@@ -207,79 +265,87 @@ QList<Node *> CanvasWidget::getAllNodes()
     return allNodes;
 }
 
-QImage CanvasWidget::processNodeGraph(Node *outputNode)
+QImage CanvasWidget::processNodeGraph(Node *outputNode, double scale, const QRect &roi)
 {
     if (!outputNode)
         return QImage();
 
-    // Get the child nodes (inputs to the output node)
-    QList<Node *> children = outputNode->getChildren();
-    if (children.isEmpty())
-    {
-        qDebug() << "Output node has no connected inputs";
+    // Renders for the GUI are interactive: background exports pause until they finish
+    PriorityGate::Scope interactive(PriorityGate::Interactive);
+
+    // Evaluate the chain; identical subcomputations are shared through the executor's cache
+    cv::Rect region;
+    if (roi.isValid())
+        region = cv::Rect(roi.x(), roi.y(), roi.width(), roi.height());
+    cv::Mat processedCvImage = m_executor.evaluate(outputNode, scale, region);
+    if (processedCvImage.empty())
         return QImage();
-    }
 
-    // For now, just process the first child - in a complete implementation,
-    // you might handle multiple inputs differently
-    Node *sourceNode = children.first();
+    // Convert back to QImage
+    return ImageProcessor::CvMatToQImage(processedCvImage);
+}
+
+std::function<QImage(double scale, const QRect &roi)> CanvasWidget::previewRenderer(Node *outputNode)
+{
+    if (!outputNode)
+        return [](double, const QRect &) { return QImage(); };
 
-    // Start with the base image if it's an image input node
-    if (sourceNode->getType() == "Load Image")
+    auto snapshot = std::make_shared<NodeGraph>();
+    Node *snapshotOutput = snapshot->copyChain(outputNode);
+    return [this, snapshot, snapshotOutput](double scale, const QRect &roi)
     {
-        // Get the file path from the node property
-        QString filePath = sourceNode->getProperty("filePath")->getValue().toString();
-        if (filePath.isEmpty())
-        {
-            qDebug() << "File path is empty";
-            return QImage();
-        }
+        return processNodeGraph(snapshotOutput, scale, roi);
+    };
+}
 
-        // Load the original image
-        QImage originalQImage;
-        if (!originalQImage.load(filePath))
-        {
-            qDebug() << "Failed to load image from:" << filePath;
-            return QImage();
-        }
+double CanvasWidget::previewScale(Node *outputNode, const QSize &bounds)
+{
+    // The node's preview scale, or smaller if that still wouldn't fit the bounds
+    double scale = 1.0;
+    if (outputNode->hasProperty("previewScale"))
+    {
+        scale = outputNode->getProperty("previewScale")->toDouble();
+    }
 
-        // Convert to OpenCV format
-        cv::Mat originalCvImage = ImageProcessor::QImageToCvMat(originalQImage);
-        cv::Mat processedCvImage = originalCvImage.clone();
+    QSize outputSize = GraphExecutor::outputSize(outputNode);
+    if (outputSize.isValid() && bounds.isValid())
+    {
+        double fit = qMin(double(bounds.width()) / outputSize.width(),
+                          double(bounds.height()) / outputSize.height());
+        scale = qMin(scale, fit);
+    }
+    return scale;
+}
 
-        // Process any effects that are connected to this input node
-        QList<Node *> effectNodes = sourceNode->getChildren();
+void CanvasWidget::updateThumbnail(Node *outputNode)
+{
+    if (!outputNode)
+        return;
 
-        // Apply each effect in sequence
-        for (Node *effectNode : effectNodes)
-        {
-            if (effectNode)
+    // Rendered in the background from a copy of the chain, so the GUI stays responsive.
+    // The result is matched back by name: undo and redo replace the nodes meanwhile
+    QString name = outputNode->getName();
+    double scale = previewScale(outputNode, CardSize);
+    auto snapshot = std::make_shared<NodeGraph>();
+    Node *snapshotOutput = snapshot->copyChain(outputNode);
+    m_thumbnailPool.start([this, snapshot, snapshotOutput, name, scale]()
+                          {
+        PriorityGate::Scope background(PriorityGate::Background);
+        cv::Mat result = m_executor.evaluate(snapshotOutput, scale);
+        if (result.empty())
+            return;
+        QImage preview = ImageProcessor::CvMatToQImage(result);
+        QMetaObject::invokeMethod(this, [this, name, preview]()
+                                  {
+            for (Node &node : m_nodes)
             {
-                processedCvImage = ImageProcessor::processNode(effectNode, processedCvImage);
-            }
-        }
-
-        // Convert back to QImage
-        QImage processedQImage = ImageProcessor::CvMatToQImage(processedCvImage);
-
-        // Update the output node preview if it has a preview property
-        if (outputNode->hasProperty("preview"))
-        {
-            double scale = outputNode->getProperty("previewScale")->getValue().toDouble();
-            QImage scaledPreview = processedQImage.scaled(
-                processedQImage.width() * scale,
-                processedQImage.height() * scale,
-                Qt::KeepAspectRatio,
-                Qt::SmoothTransformation);
-
-            outputNode->getProperty("preview")->setValue(QVariant::fromValue(scaledPreview));
-        }
-
-        return processedQImage;
-    }
-
-    qDebug() << "Source node is not a Load Image node";
-    return QImage();
+                if (node.getName() == name && node.hasProperty("preview"))
+                {
+                    node.getProperty("preview")->setValue(QVariant::fromValue(preview));
+                    update();
+                    return;
+                }
+            } }, Qt::QueuedConnection); });
 }
 
 void CanvasWidget::saveOutputImage(Node *outputNode, const QString &filePath)
@@ -287,40 +353,54 @@ void CanvasWidget::saveOutputImage(Node *outputNode, const QString &filePath)
     if (!outputNode)
         return;
 
-    QImage processedImage = processNodeGraph(outputNode);
-    if (processedImage.isNull())
-        return;
-
     // Get output format from node properties
     QString format = "PNG"; // Default
     int quality = 90;       // Default
 
     if (outputNode->hasProperty("outputFormat"))
     {
-        format = outputNode->getProperty("outputFormat")->getValue().toString();
+        format = outputNode->getProperty("outputFormat")->toString();
     }
 
     if (outputNode->hasProperty("quality"))
     {
-        quality = outputNode->getProperty("quality")->getValue().toInt();
+        quality = outputNode->getProperty("quality")->toInt();
     }
 
-    // Save the image
     QString actualFilePath = filePath;
     if (actualFilePath.isEmpty() && outputNode->hasProperty("outputPath"))
     {
-        actualFilePath = outputNode->getProperty("outputPath")->getValue().toString();
+        actualFilePath = outputNode->getProperty("outputPath")->toString();
     }
 
-    if (!actualFilePath.isEmpty())
+    if (actualFilePath.isEmpty())
+        return;
+
+    QList<Renditions::Rendition> renditions;
+    if (outputNode->hasProperty("renditions"))
     {
-        // Ensure file has correct extension
-        if (!actualFilePath.endsWith("." + format.toLower(), Qt::CaseInsensitive))
-        {
-            actualFilePath += "." + format.toLower();
-        }
+        renditions = Renditions::parse(outputNode->getProperty("renditions")->toString(), format);
+    }
 
-        bool saved = processedImage.save(actualFilePath, format.toUtf8().constData(), quality);
+    // Ensure file has correct extension
+    if (!actualFilePath.endsWith("." + format.toLower(), Qt::CaseInsensitive))
+    {
+        actualFilePath += "." + format.toLower();
+    }
+
+    // The full-resolution render runs in the background on a copy of the chain, so the
+    // user can keep editing; previews preempt it between nodes and strips
+    auto snapshot = std::make_shared<NodeGraph>();
+    Node *snapshotOutput = snapshot->copyChain(outputNode);
+    m_exportPool.start([this, snapshot, snapshotOutput, actualFilePath, format, quality, renditions]()
+                       {
+        PriorityGate::Scope background(PriorityGate::Background);
+        cv::Mat result = m_executor.evaluateTiled(snapshotOutput);
+        bool saved = false;
+        if (!result.empty() && renditions.isEmpty())
+            saved = ImageProcessor::writeImage(result, actualFilePath, format, quality);
+        else if (!result.empty()) // Every size comes from this one render
+            saved = Renditions::write(result, renditions, actualFilePath, quality).size() == renditions.size();
         if (saved)
         {
             qDebug() << "Image saved successfully to:" << actualFilePath;
@@ -329,7 +409,8 @@ void CanvasWidget::saveOutputImage(Node *outputNode, const QString &filePath)
         {
             qDebug() << "Failed to save image to:" << actualFilePath;
         }
-    }
+        QMetaObject::invokeMethod(this, [this, actualFilePath, saved]()
+                                  { emit outputSaved(actualFilePath, saved); }, Qt::QueuedConnection); });
 }
 
 void CanvasWidget::clear()
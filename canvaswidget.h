@@ -9,9 +9,13 @@
 #include <QMouseEvent>
 #include "node.h"
 #include "image_processor.h"
+#include "graph_executor.h"
 #include <QStack>
+#include <QHash>
 #include <QDebug>
 #include <QPoint>
+#include <QThreadPool>
+#include <functional>
 
 class CanvasWidget : public QWidget
 {
@@ -23,7 +27,16 @@ public:
     const QList<Node> &getNodes() const { return m_nodes; }
     Node *getSelectedNode();
     QList<Node *> getAllNodes();
-    QImage processNodeGraph(Node *outputNode);
+    // roi, if valid, limits the render to that region of the scaled result
+    QImage processNodeGraph(Node *outputNode, double scale = 1.0, const QRect &roi = QRect());
+    // Renderer for an Output node's tiled preview. It renders a copy of the chain taken
+    // now, so it can run on a worker thread while the graph is edited.
+    std::function<QImage(double scale, const QRect &roi)> previewRenderer(Node *outputNode);
+    // Render an Output node's card thumbnail in the background, then repaint
+    void updateThumbnail(Node *outputNode);
+    // Rewrites the graph optimizer applies before rendering an Output node
+    QStringList graphRewrites(Node *outputNode) { return m_executor.rewrites(outputNode); }
+    // Render at full resolution and write the result in the background; outputSaved reports the outcome
     void saveOutputImage(Node *outputNode, const QString &filePath);
     void clear();
     void removeNode(Node *childNode);
@@ -35,6 +48,7 @@ public:
 signals:
     void nodeSelected(Node *node);
     void nodePropertyChanged(Node *node, const QString &propertyName);
+    void outputSaved(const QString &filePath, bool ok);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -44,12 +58,26 @@ protected:
     
 
 private:
+    // Scale an Output node is previewed at so it fits within bounds
+    static double previewScale(Node *outputNode, const QSize &bounds);
+    // Area a node covers: its own image (a Load Image thumbnail), or a type card
+    QRect nodeRect(const Node &node) const;
+    // Card showing a node type, painted once per type and shared by every node of it
+    const QImage &typeCard(const QString &type);
+    // Small copy of a node's last rendered preview, or a null image if it has none
+    QImage previewThumbnail(const Node &node);
+
     QList<Node> m_nodes;
     Node *m_draggedNode = nullptr; // Currently dragged node
     QPoint m_offset;               // Offset for the mouse inside the node
     int m_nodeCounter = 0;         // For generating unique node names
     QStack<QList<Node>> m_undoStack; // Stack for undo functionality
     QStack<QList<Node>> m_redoStack; // Stack for redo functionality
+    QHash<QString, QImage> m_typeCards;   // Card per node type
+    QHash<quint64, QImage> m_thumbnails;  // Preview thumbnails by the preview property's version
+    GraphExecutor m_executor;        // Evaluates Output chains and caches shared results
+    QThreadPool m_exportPool;        // Background exports; declared after m_executor so it is drained first
+    QThreadPool m_thumbnailPool;     // Card thumbnails, kept apart so a long export doesn't hold them up
 
 };
 
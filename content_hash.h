@@ -0,0 +1,85 @@
+// content_hash.h
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <QFile>
+#include <QString>
+#include <QVariant>
+#include <QtGlobal>
+#include <cstddef>
+#include <cstring>
+
+// Small, deterministic 64-bit hash helpers (FNV-1a based) used to build cache keys.
+// Unlike qHash these are not seeded per process, so keys are stable between runs.
+namespace ContentHash
+{
+    const quint64 Seed = 14695981039346656037ULL;
+
+    inline quint64 bytes(const void *data, std::size_t size, quint64 seed = Seed)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        quint64 h = seed;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    inline quint64 string(const QString &text, quint64 seed = Seed)
+    {
+        return bytes(text.constData(), text.size() * sizeof(QChar), seed);
+    }
+
+    inline quint64 combine(quint64 seed, quint64 value)
+    {
+        return bytes(&value, sizeof(value), seed);
+    }
+
+    // Word-at-a-time variant for large buffers such as whole source files
+    inline quint64 words(const void *data, std::size_t size, quint64 seed = Seed)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        quint64 h = seed ^ (static_cast<quint64>(size) * 0x9E3779B97F4A7C15ULL);
+        std::size_t count = size / sizeof(quint64);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            quint64 w;
+            std::memcpy(&w, p + i * sizeof(quint64), sizeof(w));
+            h ^= w;
+            h *= 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 32;
+        }
+        return bytes(p + count * sizeof(quint64), size % sizeof(quint64), h);
+    }
+
+    // Hash of a file's contents; returns 0 if the file cannot be read
+    inline quint64 file(const QString &path)
+    {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly))
+            return 0;
+
+        if (f.size() == 0)
+            return Seed;
+
+        uchar *mapped = f.map(0, f.size());
+        if (mapped)
+        {
+            quint64 h = words(mapped, static_cast<std::size_t>(f.size()));
+            f.unmap(mapped);
+            return h;
+        }
+
+        QByteArray data = f.readAll();
+        return words(data.constData(), static_cast<std::size_t>(data.size()));
+    }
+
+    inline quint64 variant(const QVariant &value, quint64 seed = Seed)
+    {
+        return string(value.toString(), seed);
+    }
+}
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,242 @@
+// convolution.cpp
+#include "convolution.h"
+#include "autotuner.h"
+#include <QHash>
+#include <QRegularExpression>
+#include <QStringList>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    const int MaxKernelSize = 255;
+    const int MaxEntries = 64;
+
+    // Output tile of the Fourier path, before it is grown to fit the kernel, unless the
+    // kernel profile has measured a better one
+    const int TileSize = 512;
+
+    // Multiply-adds per transform point and log2 of the transform size: forward and
+    // inverse transforms plus the spectrum product, relative to one filter2D tap
+    const double FourierCostPerPoint = 5.0;
+
+    // filter2D on 8-bit images (with SSE3; 50 taps without) switches from direct
+    // correlation to OpenCV's crossCorr at this many taps, but only when the image is
+    // not a view into a larger one: it checks the view's offset and parent size
+    const int Filter2DTransformTaps = 130;
+
+    std::mutex cacheMutex; // Guards the cache below
+    QHash<QString, std::shared_ptr<const Convolution::Kernel>> kernels;
+
+    struct Layout
+    {
+        int dftWidth;
+        int dftHeight;
+        int tileWidth;  // Output pixels per transform: dftWidth - kw + 1
+        int tileHeight;
+    };
+
+    Layout layout(const cv::Size &kernelSize, const cv::Size &imageSize, int tileSize)
+    {
+        // Tiles several times the kernel keep most of each transform as output, and tiles
+        // of a few hundred pixels keep a transform's buffers in cache
+        if (tileSize <= 0)
+            tileSize = Autotuner::choice("convolution.fourierTile", Autotuner::bucket(imageSize), TileSize);
+        const int width = qMin(imageSize.width, qMax(tileSize, 4 * kernelSize.width));
+        const int height = qMin(imageSize.height, qMax(tileSize, 4 * kernelSize.height));
+        Layout result;
+        result.dftWidth = cv::getOptimalDFTSize(width + kernelSize.width - 1);
+        result.dftHeight = cv::getOptimalDFTSize(height + kernelSize.height - 1);
+        result.tileWidth = result.dftWidth - kernelSize.width + 1;
+        result.tileHeight = result.dftHeight - kernelSize.height + 1;
+        return result;
+    }
+
+    // crossCorr's output blocks: 4.5 kernel widths, and at least 256 pixels together
+    // with the kernel
+    int filter2DBlock(const cv::Size &kernelSize)
+    {
+        const int side = qMax(kernelSize.width, kernelSize.height);
+        return qMax(cvRound(side * 4.5), 256 - side + 1);
+    }
+
+    // Per output pixel: transform points per output pixel (tile padding) times the
+    // log-size cost of transforming them
+    double transformCost(const Layout &tiles)
+    {
+        const double points = double(tiles.dftWidth) * tiles.dftHeight;
+        const double overhead = points / (double(tiles.tileWidth) * tiles.tileHeight);
+        return FourierCostPerPoint * std::log2(points) * overhead;
+    }
+
+    // Overlap-save: each tile of output is the valid part of one circular correlation
+    // of a padded input block with the kernel, and tiles run in parallel
+    cv::Mat fourier(const cv::Mat &image, const cv::Mat &weights, const cv::Point &anchor, double offset, int tileSize)
+    {
+        const int kw = weights.cols;
+        const int kh = weights.rows;
+        const Layout tiles = layout(weights.size(), image.size(), tileSize);
+
+        // The kernel's spectrum is the same for every tile
+        cv::Mat kernelPadded = cv::Mat::zeros(tiles.dftHeight, tiles.dftWidth, CV_32F);
+        weights.copyTo(kernelPadded(cv::Rect(0, 0, kw, kh)));
+        cv::Mat kernelSpectrum;
+        cv::dft(kernelPadded, kernelSpectrum, 0, kh);
+
+        std::vector<cv::Mat> planes;
+        cv::split(image, planes);
+        std::vector<cv::Mat> padded(planes.size());
+        std::vector<cv::Mat> results(planes.size());
+        for (size_t c = 0; c < planes.size(); ++c)
+        {
+            cv::copyMakeBorder(planes[c], padded[c], anchor.y, kh - 1 - anchor.y, anchor.x, kw - 1 - anchor.x,
+                               cv::BORDER_REFLECT_101);
+            results[c].create(image.size(), CV_8U);
+        }
+
+        const int across = (image.cols + tiles.tileWidth - 1) / tiles.tileWidth;
+        const int down = (image.rows + tiles.tileHeight - 1) / tiles.tileHeight;
+        const int perPlane = across * down;
+        cv::parallel_for_(cv::Range(0, int(planes.size()) * perPlane), [&](const cv::Range &range)
+                          {
+            cv::Mat buffer(tiles.dftHeight, tiles.dftWidth, CV_32F);
+            cv::Mat spectrum;
+            cv::Mat correlation;
+            for (int t = range.start; t < range.end; ++t)
+            {
+                const int c = t / perPlane;
+                const int x = (t % perPlane % across) * tiles.tileWidth;
+                const int y = (t % perPlane / across) * tiles.tileHeight;
+                const int width = qMin(tiles.tileWidth, image.cols - x);
+                const int height = qMin(tiles.tileHeight, image.rows - y);
+
+                // Input block, zero-filled past the image; the zeros never reach valid output
+                const cv::Rect block(0, 0, width + kw - 1, height + kh - 1);
+                buffer.setTo(0);
+                cv::Mat bufferBlock = buffer(block);
+                padded[c](block + cv::Point(x, y)).convertTo(bufferBlock, CV_32F);
+
+                // Multiplying by the conjugate spectrum correlates, as filter2D does
+                cv::dft(buffer, spectrum, 0, block.height);
+                cv::mulSpectrums(spectrum, kernelSpectrum, spectrum, 0, true);
+                cv::idft(spectrum, correlation, cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, height);
+
+                cv::Mat target = results[c](cv::Rect(x, y, width, height));
+                correlation(cv::Rect(0, 0, width, height)).convertTo(target, CV_8U, 1.0, offset);
+            } });
+
+        cv::Mat output;
+        cv::merge(results, output);
+        return output;
+    }
+}
+
+std::shared_ptr<const Convolution::Kernel> Convolution::parse(const QString &text, bool normalize, QString *error)
+{
+    const QString cacheKey = (normalize ? "normalized:" : "raw:") + text;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = kernels.constFind(cacheKey);
+        if (it != kernels.constEnd())
+            return it.value();
+    }
+
+    QString message;
+    std::vector<std::vector<float>> rows;
+    for (const QString &line : text.split(QRegularExpression("[;\n]"), Qt::SkipEmptyParts))
+    {
+        QStringList fields = line.split(QRegularExpression("[\\s,]+"), Qt::SkipEmptyParts);
+        if (fields.isEmpty())
+            continue;
+        std::vector<float> row;
+        for (const QString &field : fields)
+        {
+            bool ok = false;
+            row.push_back(field.toFloat(&ok));
+            if (!ok)
+                message = "Invalid kernel value '" + field + "'";
+        }
+        if (!rows.empty() && row.size() != rows.front().size())
+            message = "Kernel rows have different lengths";
+        rows.push_back(row);
+    }
+    if (message.isEmpty() && rows.empty())
+        message = "Kernel is empty";
+    if (message.isEmpty() && (int(rows.size()) > MaxKernelSize || int(rows.front().size()) > MaxKernelSize))
+        message = QString("Kernel is larger than %1 x %1").arg(MaxKernelSize);
+    if (!message.isEmpty())
+    {
+        if (error)
+            *error = message;
+        return nullptr;
+    }
+
+    auto kernel = std::make_shared<Kernel>();
+    kernel->weights.create(int(rows.size()), int(rows.front().size()), CV_32F);
+    for (int y = 0; y < kernel->weights.rows; ++y)
+        std::copy(rows[y].begin(), rows[y].end(), kernel->weights.ptr<float>(y));
+
+    double sum = cv::sum(kernel->weights)[0];
+    if (normalize && std::abs(sum) > 1e-6)
+        kernel->weights /= sum;
+
+    // Rank 1 means the kernel is the outer product of a column and a row
+    cv::Mat w, u, vt;
+    cv::SVD::compute(kernel->weights, w, u, vt);
+    if (w.rows < 2 || w.at<float>(1) <= 1e-5f * w.at<float>(0))
+    {
+        float root = std::sqrt(w.at<float>(0));
+        kernel->column = u.col(0) * root;
+        kernel->row = vt.row(0) * root;
+    }
+
+    std::shared_ptr<const Kernel> result = kernel;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (kernels.size() >= MaxEntries)
+        kernels.clear();
+    kernels.insert(cacheKey, result);
+    return result;
+}
+
+Convolution::Strategy Convolution::choose(const Kernel &kernel, const cv::Size &imageSize, bool view)
+{
+    const double taps = double(kernel.weights.total());
+    if (taps <= 1.0)
+        return Strategy::Direct;
+    if (!kernel.row.empty())
+        return Strategy::Separable;
+
+    // A measured crossover for this machine, image size and kind of input wins over
+    // the cost model; filter2D's own transform makes whole images and views differ
+    const char *decision = view ? "convolution.fourierTaps.view" : "convolution.fourierTaps";
+    const int measuredTaps = Autotuner::choice(decision, Autotuner::bucket(imageSize), 0);
+    if (measuredTaps > 0)
+        return taps >= measuredTaps ? Strategy::Fourier : Strategy::Direct;
+
+    // filter2D costs one multiply-add per tap, unless it takes its transform path, which
+    // is modelled like ours with crossCorr's block size (it runs one block at a time,
+    // so ours wins ties)
+    double directCost = taps;
+    if (!view && taps >= Filter2DTransformTaps)
+        directCost = transformCost(layout(kernel.weights.size(), imageSize, filter2DBlock(kernel.weights.size())));
+    const double fourierCost = transformCost(layout(kernel.weights.size(), imageSize, 0));
+    return directCost >= fourierCost ? Strategy::Fourier : Strategy::Direct;
+}
+
+cv::Mat Convolution::apply(const cv::Mat &image, const Kernel &kernel, double offset, Strategy strategy, int tileSize)
+{
+    const cv::Point anchor(kernel.weights.cols / 2, kernel.weights.rows / 2);
+    cv::Mat output;
+    if (strategy == Strategy::Separable && !kernel.row.empty())
+    {
+        cv::sepFilter2D(image, output, -1, kernel.row, kernel.column, anchor, offset, cv::BORDER_REFLECT_101);
+        return output;
+    }
+    if (strategy == Strategy::Fourier)
+        return fourier(image, kernel.weights, anchor, offset, tileSize);
+
+    cv::filter2D(image, output, -1, kernel.weights, anchor, offset, cv::BORDER_REFLECT_101);
+    return output;
+}
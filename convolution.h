@@ -0,0 +1,49 @@
+// convolution.h
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <memory>
+
+// User kernels for the Convolution node. A kernel is parsed and analysed once (cached by
+// its text): rank-1 kernels are split into a row and a column by SVD. Each application
+// then picks the cheapest way to run it for the image at hand:
+//  - Separable: two 1D passes (sepFilter2D), kw + kh multiply-adds per pixel
+//  - Direct: filter2D, kw * kh multiply-adds per pixel, except that for a whole 8-bit
+//    image (not a view into a larger one) and 130 taps or more filter2D correlates
+//    through its own blocked transform instead
+//  - Fourier: tiled overlap-save FFT (cv::dft), a cost per pixel that grows only with
+//    the logarithm of the transform size
+// All three give the same result up to rounding, with filter2D's reflected borders.
+namespace Convolution
+{
+    enum class Strategy
+    {
+        Direct,
+        Separable,
+        Fourier
+    };
+
+    struct Kernel
+    {
+        cv::Mat weights; // CV_32F, anchored at its centre; normalised to sum 1 if asked
+        cv::Mat row;     // Rank-1 factors (1 x kw and kh x 1), empty if not separable
+        cv::Mat column;
+    };
+
+    // Kernel parsed from rows separated by ';' or new lines, with values separated by
+    // spaces or commas, e.g. "1 2 1; 2 4 2; 1 2 1". Null (with error set) if malformed.
+    std::shared_ptr<const Kernel> parse(const QString &text, bool normalize, QString *error = nullptr);
+
+    // Fastest strategy for the kernel on an image of the given size; view says whether
+    // the image is a view into a larger one (cv::Mat::isSubmatrix), as region and tile
+    // renders pass, for which filter2D never takes its transform path
+    Strategy choose(const Kernel &kernel, const cv::Size &imageSize, bool view = false);
+
+    // Correlate an 8-bit image (every channel) with the kernel and add offset, in levels.
+    // tileSize sets the Fourier path's output tiles; 0 takes the kernel profile's choice.
+    cv::Mat apply(const cv::Mat &image, const Kernel &kernel, double offset, Strategy strategy, int tileSize = 0);
+}
+
+#endif // CONVOLUTION_H
@@ -0,0 +1,218 @@
+// disk_cache.cpp
+#include "disk_cache.h"
+#include "metrics.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+namespace
+{
+    const char Magic[4] = {'N', 'I', 'M', 'C'};
+    const quint32 FormatVersion = 1;
+    const qint64 HeaderSize = 64;                       // Pixel data starts 64-byte aligned
+    const size_t MaxPendingBytes = 1024 * 1024 * 1024;  // Drop writes when this far behind
+    const qint64 DefaultMaxBytes = 4LL * 1024 * 1024 * 1024;
+
+    struct EntryHeader
+    {
+        char magic[4];
+        quint32 version;
+        qint32 rows;
+        qint32 cols;
+        qint32 type;
+    };
+
+    size_t matBytes(const cv::Mat &image)
+    {
+        return image.total() * image.elemSize();
+    }
+}
+
+DiskCache::DiskCache(const QString &directory, qint64 maxBytes)
+    : m_directory(directory), m_maxBytes(maxBytes)
+{
+    QDir().mkpath(m_directory);
+
+    // Account for entries left behind by earlier sessions
+    QDir dir(m_directory);
+    for (const QFileInfo &info : dir.entryInfoList({"*.nmat"}, QDir::Files))
+    {
+        m_totalBytes += info.size();
+    }
+
+    m_writer = std::thread(&DiskCache::writerLoop, this);
+
+    m_pendingGauge = Metrics::addGauge("nie_disk_cache_pending_bytes",
+                                       "Bytes queued for the disk cache writer.", [this]() {
+                                           std::lock_guard<std::mutex> lock(m_mutex);
+                                           return double(m_pendingBytes);
+                                       });
+}
+
+DiskCache::~DiskCache()
+{
+    Metrics::removeGauge(m_pendingGauge);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    if (m_writer.joinable())
+        m_writer.join();
+}
+
+DiskCache &DiskCache::shared()
+{
+    static DiskCache cache(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/nodes",
+                           DefaultMaxBytes);
+    return cache;
+}
+
+bool DiskCache::load(quint64 key, cv::Mat &image)
+{
+    QFile file(entryPath(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 size = file.size();
+    if (size < HeaderSize)
+        return false;
+
+    uchar *mapped = file.map(0, size);
+    if (!mapped)
+        return false;
+
+    EntryHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    bool valid = std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+                 header.version == FormatVersion &&
+                 header.rows > 0 && header.cols > 0 &&
+                 CV_MAT_DEPTH(header.type) == CV_8U && CV_MAT_CN(header.type) <= 4;
+
+    if (valid)
+    {
+        // Wrap the mapped pixels, then copy them out before unmapping
+        cv::Mat view(header.rows, header.cols, header.type, mapped + HeaderSize);
+        valid = HeaderSize + static_cast<qint64>(matBytes(view)) == size;
+        if (valid)
+            image = view.clone();
+    }
+    file.unmap(mapped);
+
+    if (!valid)
+    {
+        qDebug() << "Discarding corrupt cache entry:" << file.fileName();
+        file.close();
+        QFile::remove(file.fileName());
+        return false;
+    }
+
+    // Mark the entry as recently used so eviction keeps it
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+void DiskCache::store(quint64 key, const cv::Mat &image)
+{
+    if (image.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pendingBytes + matBytes(image) > MaxPendingBytes)
+            return; // The writer is behind; losing a cache entry is harmless
+        m_pending.emplace_back(key, image);
+        m_pendingBytes += matBytes(image);
+    }
+    m_wake.notify_one();
+}
+
+QString DiskCache::entryPath(quint64 key) const
+{
+    return m_directory + "/" + QString::number(key, 16).rightJustified(16, '0') + ".nmat";
+}
+
+void DiskCache::writeEntry(quint64 key, const cv::Mat &image)
+{
+    QString path = entryPath(key);
+    if (QFile::exists(path))
+        return;
+
+    cv::Mat pixels = image.isContinuous() ? image : image.clone();
+
+    char header[HeaderSize] = {};
+    EntryHeader entryHeader;
+    std::memcpy(entryHeader.magic, Magic, sizeof(Magic));
+    entryHeader.version = FormatVersion;
+    entryHeader.rows = pixels.rows;
+    entryHeader.cols = pixels.cols;
+    entryHeader.type = pixels.type();
+    std::memcpy(header, &entryHeader, sizeof(entryHeader));
+
+    // QSaveFile writes to a temporary file and renames it, so readers in other
+    // processes never see a partial entry
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Failed to open cache entry:" << path;
+        return;
+    }
+    file.write(header, HeaderSize);
+    file.write(reinterpret_cast<const char *>(pixels.data), static_cast<qint64>(matBytes(pixels)));
+    if (!file.commit())
+    {
+        qDebug() << "Failed to write cache entry:" << path;
+        return;
+    }
+
+    m_totalBytes += HeaderSize + static_cast<qint64>(matBytes(pixels));
+    if (m_totalBytes > m_maxBytes)
+        enforceLimit();
+}
+
+void DiskCache::enforceLimit()
+{
+    // Oldest modification time first; load() refreshes it on every hit
+    QDir dir(m_directory);
+    QFileInfoList entries = dir.entryInfoList({"*.nmat"}, QDir::Files, QDir::Time | QDir::Reversed);
+
+    m_totalBytes = 0;
+    for (const QFileInfo &info : entries)
+    {
+        m_totalBytes += info.size();
+    }
+
+    // Trim to 90% of the limit so we don't rescan on every write
+    const qint64 target = m_maxBytes - m_maxBytes / 10;
+    for (const QFileInfo &info : entries)
+    {
+        if (m_totalBytes <= target)
+            break;
+        if (QFile::remove(info.filePath()))
+            m_totalBytes -= info.size();
+    }
+}
+
+void DiskCache::writerLoop()
+{
+    for (;;)
+    {
+        std::pair<quint64, cv::Mat> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+            if (m_pending.empty())
+                return; // Stopping and fully drained
+
+            job = std::move(m_pending.front());
+            m_pending.pop_front();
+            m_pendingBytes -= matBytes(job.second);
+        }
+        writeEntry(job.first, job.second);
+    }
+}
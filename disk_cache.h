@@ -0,0 +1,54 @@
+// disk_cache.h
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Persistent, content-addressed store of node results shared by every process
+// (GUI and headless) that uses the same cache directory.
+// Entries are raw pixel dumps behind a fixed 64-byte header, so reading one is a
+// memory map plus a copy instead of an image decode. The directory is kept under
+// a size limit by evicting the least recently used files first.
+class DiskCache
+{
+public:
+    DiskCache(const QString &directory, qint64 maxBytes);
+    ~DiskCache();
+
+    // Process-wide cache in the application's standard cache location
+    static DiskCache &shared();
+
+    // Read the entry for key into image; returns false on a miss
+    bool load(quint64 key, cv::Mat &image);
+
+    // Queue image for writing under key; the write happens on a background thread
+    void store(quint64 key, const cv::Mat &image);
+
+    QString directory() const { return m_directory; }
+
+private:
+    QString entryPath(quint64 key) const;
+    void writeEntry(quint64 key, const cv::Mat &image);
+    void enforceLimit();
+    void writerLoop();
+
+    QString m_directory;
+    qint64 m_maxBytes;
+    qint64 m_totalBytes = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::pair<quint64, cv::Mat>> m_pending;
+    size_t m_pendingBytes = 0;
+    bool m_stopping = false;
+    std::thread m_writer;
+    int m_pendingGauge = 0;
+};
+
+#endif // DISK_CACHE_H
@@ -0,0 +1,793 @@
+// expression.cpp
+#include "expression.h"
+#include <QChar>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    // Pixels per register; a program's registers stay in the first-level cache
+    const int Block = 256;
+
+    const int MaxEntries = 64;
+
+    enum class Op
+    {
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Neg,
+        Abs,
+        Sqrt,
+        Exp,
+        Log,
+        Sin,
+        Cos,
+        Tan,
+        Floor,
+        Min,
+        Max,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        Select // a ? b : c
+    };
+
+    // Inputs in the order of Program::inputs
+    enum Input
+    {
+        InputR,
+        InputG,
+        InputB,
+        InputA,
+        InputX,
+        InputY,
+        InputW,
+        InputH,
+        InputP1,
+        InputP2,
+        InputCount
+    };
+    const char *const InputNames[InputCount] = {"r", "g", "b", "a", "x", "y", "w", "h", "p1", "p2"};
+
+    struct Instruction
+    {
+        Op op;
+        int dst;
+        int a;
+        int b;
+        int c;
+    };
+
+    float evaluate(Op op, float a, float b, float c)
+    {
+        switch (op)
+        {
+        case Op::Add: return a + b;
+        case Op::Sub: return a - b;
+        case Op::Mul: return a * b;
+        case Op::Div: return a / b;
+        case Op::Pow: return std::pow(a, b);
+        case Op::Neg: return -a;
+        case Op::Abs: return std::fabs(a);
+        case Op::Sqrt: return std::sqrt(a);
+        case Op::Exp: return std::exp(a);
+        case Op::Log: return std::log(a);
+        case Op::Sin: return std::sin(a);
+        case Op::Cos: return std::cos(a);
+        case Op::Tan: return std::tan(a);
+        case Op::Floor: return std::floor(a);
+        case Op::Min: return std::min(a, b);
+        case Op::Max: return std::max(a, b);
+        case Op::Less: return a < b ? 1.0f : 0.0f;
+        case Op::LessEqual: return a <= b ? 1.0f : 0.0f;
+        case Op::Greater: return a > b ? 1.0f : 0.0f;
+        case Op::GreaterEqual: return a >= b ? 1.0f : 0.0f;
+        case Op::Equal: return a == b ? 1.0f : 0.0f;
+        case Op::NotEqual: return a != b ? 1.0f : 0.0f;
+        case Op::Select: return a != 0.0f ? b : c;
+        }
+        return 0.0f;
+    }
+
+    int arity(Op op)
+    {
+        if (op == Op::Select)
+            return 3;
+        if (op == Op::Neg || (op >= Op::Abs && op <= Op::Floor))
+            return 1;
+        return 2;
+    }
+}
+
+struct Expression::Program
+{
+    std::vector<Instruction> code;
+    std::vector<std::pair<int, float>> constants; // Register and value, filled once per thread
+    int inputs[InputCount];                       // Register each input is loaded into, -1 if unread
+    int outputs[4];                               // Registers holding r, g, b, a; -1 keeps the input
+    int registers = 0;
+};
+
+namespace
+{
+    using Expression::Program;
+
+    // A value while compiling: a constant, or a virtual register
+    struct Value
+    {
+        int reg = -1;
+        float number = 0.0f;
+        bool isConstant() const { return reg < 0; }
+    };
+
+    struct Token
+    {
+        enum Kind
+        {
+            Number,
+            Name,
+            Symbol,
+            Separator,
+            End
+        };
+        Kind kind;
+        QString text;
+        float number;
+    };
+
+    // Recursive-descent parser that emits bytecode as it goes
+    class Compiler
+    {
+    public:
+        explicit Compiler(Program &program) : m_program(program)
+        {
+            std::fill(m_program.inputs, m_program.inputs + InputCount, -1);
+            std::fill(m_program.outputs, m_program.outputs + 4, -1);
+        }
+
+        bool compile(const QString &source, QString *error)
+        {
+            tokenize(source);
+            while (!m_failed && peek().kind != Token::End)
+            {
+                if (peek().kind == Token::Separator)
+                {
+                    ++m_pos;
+                    continue;
+                }
+                statement();
+                if (!m_failed && peek().kind != Token::Separator && peek().kind != Token::End)
+                    fail("Expected ';' before '" + peek().text + "'");
+            }
+            if (m_failed)
+            {
+                *error = m_error;
+                return false;
+            }
+
+            for (int c = 0; c < 4; ++c)
+            {
+                auto it = m_names.constFind(InputNames[c]);
+                if (it != m_names.constEnd())
+                    m_program.outputs[c] = materialize(it.value());
+            }
+            allocate();
+            return true;
+        }
+
+    private:
+        void tokenize(const QString &source)
+        {
+            int i = 0;
+            while (i < source.size())
+            {
+                const QChar ch = source[i];
+                if (ch == '\n' || ch == ';')
+                {
+                    m_tokens.append({Token::Separator, QString(ch), 0.0f});
+                    ++i;
+                }
+                else if (ch.isSpace())
+                {
+                    ++i;
+                }
+                else if (ch.isDigit() || (ch == '.' && i + 1 < source.size() && source[i + 1].isDigit()))
+                {
+                    int start = i;
+                    while (i < source.size() && (source[i].isDigit() || source[i] == '.'))
+                        ++i;
+                    if (i < source.size() && (source[i] == 'e' || source[i] == 'E'))
+                    {
+                        int exponent = i + 1;
+                        if (exponent < source.size() && (source[exponent] == '+' || source[exponent] == '-'))
+                            ++exponent;
+                        if (exponent < source.size() && source[exponent].isDigit())
+                        {
+                            i = exponent;
+                            while (i < source.size() && source[i].isDigit())
+                                ++i;
+                        }
+                    }
+                    QString text = source.mid(start, i - start);
+                    bool ok = false;
+                    float number = text.toFloat(&ok);
+                    if (!ok)
+                    {
+                        fail("Invalid number '" + text + "'");
+                        return;
+                    }
+                    m_tokens.append({Token::Number, text, number});
+                }
+                else if (ch.isLetter() || ch == '_')
+                {
+                    int start = i;
+                    while (i < source.size() && (source[i].isLetterOrNumber() || source[i] == '_'))
+                        ++i;
+                    m_tokens.append({Token::Name, source.mid(start, i - start), 0.0f});
+                }
+                else
+                {
+                    // Two-character comparisons first
+                    QString two = source.mid(i, 2);
+                    if (two == "<=" || two == ">=" || two == "==" || two == "!=")
+                    {
+                        m_tokens.append({Token::Symbol, two, 0.0f});
+                        i += 2;
+                    }
+                    else if (QString("+-*/^(),=<>").contains(ch))
+                    {
+                        m_tokens.append({Token::Symbol, QString(ch), 0.0f});
+                        ++i;
+                    }
+                    else
+                    {
+                        fail(QString("Unexpected character '%1'").arg(ch));
+                        return;
+                    }
+                }
+            }
+            m_tokens.append({Token::End, "end of expression", 0.0f});
+        }
+
+        const Token &peek(int ahead = 0) const
+        {
+            return m_tokens[qMin(m_pos + ahead, m_tokens.size() - 1)];
+        }
+
+        bool accept(const char *symbol)
+        {
+            if (peek().kind == Token::Symbol && peek().text == symbol)
+            {
+                ++m_pos;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(const char *symbol)
+        {
+            if (!accept(symbol))
+                fail(QString("Expected '%1' before '%2'").arg(symbol, peek().text));
+        }
+
+        void fail(const QString &message)
+        {
+            if (!m_failed)
+                m_error = message;
+            m_failed = true;
+        }
+
+        void statement()
+        {
+            if (peek().kind == Token::Name && peek(1).kind == Token::Symbol && peek(1).text == "=")
+            {
+                QString name = peek().text;
+                m_pos += 2;
+                if (QStringList({"x", "y", "w", "h", "p1", "p2", "pi"}).contains(name))
+                {
+                    fail("Cannot assign to '" + name + "'");
+                    return;
+                }
+                Value value = expression();
+                m_names.insert(name, value);
+                return;
+            }
+
+            // A bare expression is a gray level
+            Value value = expression();
+            m_names.insert("r", value);
+            m_names.insert("g", value);
+            m_names.insert("b", value);
+        }
+
+        Value expression()
+        {
+            Value left = additive();
+            static const QStringList comparisons = {"<", "<=", ">", ">=", "==", "!="};
+            static const Op ops[] = {Op::Less, Op::LessEqual, Op::Greater, Op::GreaterEqual, Op::Equal, Op::NotEqual};
+            while (!m_failed && peek().kind == Token::Symbol && comparisons.contains(peek().text))
+            {
+                Op op = ops[comparisons.indexOf(peek().text)];
+                ++m_pos;
+                left = emit(op, left, additive());
+            }
+            return left;
+        }
+
+        Value additive()
+        {
+            Value left = term();
+            while (!m_failed)
+            {
+                if (accept("+"))
+                    left = emit(Op::Add, left, term());
+                else if (accept("-"))
+                    left = emit(Op::Sub, left, term());
+                else
+                    break;
+            }
+            return left;
+        }
+
+        Value term()
+        {
+            Value left = unary();
+            while (!m_failed)
+            {
+                if (accept("*"))
+                    left = emit(Op::Mul, left, unary());
+                else if (accept("/"))
+                    left = emit(Op::Div, left, unary());
+                else
+                    break;
+            }
+            return left;
+        }
+
+        Value unary()
+        {
+            if (accept("-"))
+                return emit(Op::Neg, unary());
+            if (accept("+"))
+                return unary();
+            return power();
+        }
+
+        Value power()
+        {
+            // Right-associative, and binds tighter than a leading minus: -x^2 is -(x^2)
+            Value base = primary();
+            if (!m_failed && accept("^"))
+                return emit(Op::Pow, base, unary());
+            return base;
+        }
+
+        Value primary()
+        {
+            const Token token = peek();
+            if (token.kind == Token::Number)
+            {
+                ++m_pos;
+                return constant(token.number);
+            }
+            if (accept("("))
+            {
+                Value value = expression();
+                expect(")");
+                return value;
+            }
+            if (token.kind != Token::Name)
+            {
+                fail("Unexpected '" + token.text + "'");
+                return Value();
+            }
+
+            ++m_pos;
+            if (accept("("))
+                return call(token.text);
+            return name(token.text);
+        }
+
+        Value name(const QString &text)
+        {
+            auto it = m_names.constFind(text);
+            if (it != m_names.constEnd())
+                return it.value();
+            if (text == "pi")
+                return constant(float(M_PI));
+            for (int i = 0; i < InputCount; ++i)
+            {
+                if (text == InputNames[i])
+                {
+                    if (m_program.inputs[i] < 0)
+                    {
+                        m_program.inputs[i] = m_registers++;
+                        m_pinned.append(m_program.inputs[i]);
+                    }
+                    Value value;
+                    value.reg = m_program.inputs[i];
+                    return value;
+                }
+            }
+            fail("Unknown name '" + text + "'");
+            return Value();
+        }
+
+        Value call(const QString &function)
+        {
+            QVector<Value> args;
+            if (!accept(")"))
+            {
+                do
+                {
+                    args.append(expression());
+                } while (!m_failed && accept(","));
+                expect(")");
+            }
+            if (m_failed)
+                return Value();
+
+            static const QHash<QString, Op> unaryFunctions = {
+                {"abs", Op::Abs}, {"sqrt", Op::Sqrt}, {"exp", Op::Exp}, {"log", Op::Log},
+                {"sin", Op::Sin}, {"cos", Op::Cos}, {"tan", Op::Tan}, {"floor", Op::Floor}};
+            static const QHash<QString, Op> binaryFunctions = {{"min", Op::Min}, {"max", Op::Max}, {"pow", Op::Pow}};
+
+            auto arguments = [&](int count)
+            {
+                if (args.size() != count)
+                    fail(QString("%1() takes %2 argument(s)").arg(function).arg(count));
+                return !m_failed;
+            };
+
+            if (unaryFunctions.contains(function))
+                return arguments(1) ? emit(unaryFunctions.value(function), args[0]) : Value();
+            if (binaryFunctions.contains(function))
+                return arguments(2) ? emit(binaryFunctions.value(function), args[0], args[1]) : Value();
+            if (function == "step")
+                return arguments(2) ? emit(Op::GreaterEqual, args[1], args[0]) : Value(); // step(edge, v)
+            if (function == "clamp")
+                return arguments(3) ? emit(Op::Min, emit(Op::Max, args[0], args[1]), args[2]) : Value();
+            if (function == "mix")
+            {
+                if (!arguments(3))
+                    return Value();
+                return emit(Op::Add, args[0], emit(Op::Mul, emit(Op::Sub, args[1], args[0]), args[2]));
+            }
+            if (function == "if")
+                return arguments(3) ? emit(Op::Select, args[0], args[1], args[2]) : Value();
+
+            fail("Unknown function '" + function + "'");
+            return Value();
+        }
+
+        Value constant(float number)
+        {
+            Value value;
+            value.number = number;
+            return value;
+        }
+
+        Value emit(Op op, Value a, Value b = Value(), Value c = Value())
+        {
+            if (m_failed)
+                return Value();
+
+            // Operations on constants are done now, once
+            const int count = arity(op);
+            if (a.isConstant() && (count < 2 || b.isConstant()) && (count < 3 || c.isConstant()))
+                return constant(evaluate(op, a.number, b.number, c.number));
+
+            Instruction instruction;
+            instruction.op = op;
+            instruction.a = materialize(a);
+            instruction.b = count >= 2 ? materialize(b) : -1;
+            instruction.c = count >= 3 ? materialize(c) : -1;
+            instruction.dst = m_registers++;
+            m_program.code.push_back(instruction);
+
+            Value result;
+            result.reg = instruction.dst;
+            return result;
+        }
+
+        // Register holding the value; equal constants share one
+        int materialize(const Value &value)
+        {
+            if (!value.isConstant())
+                return value.reg;
+
+            quint32 bits;
+            std::memcpy(&bits, &value.number, sizeof(bits));
+            auto it = m_constants.constFind(bits);
+            if (it != m_constants.constEnd())
+                return it.value();
+
+            int reg = m_registers++;
+            m_constants.insert(bits, reg);
+            m_program.constants.push_back({reg, value.number});
+            m_pinned.append(reg);
+            return reg;
+        }
+
+        // Drop instructions whose results are never read, then map the virtual registers
+        // onto as few physical ones as their lifetimes allow
+        void allocate()
+        {
+            std::vector<Instruction> &code = m_program.code;
+
+            std::vector<bool> live(m_registers, false);
+            for (int reg : m_program.outputs)
+            {
+                if (reg >= 0)
+                    live[reg] = true;
+            }
+            std::vector<Instruction> kept;
+            for (int i = int(code.size()) - 1; i >= 0; --i)
+            {
+                const Instruction &instruction = code[i];
+                if (!live[instruction.dst])
+                    continue;
+                for (int operand : {instruction.a, instruction.b, instruction.c})
+                {
+                    if (operand >= 0)
+                        live[operand] = true;
+                }
+                kept.push_back(instruction);
+            }
+            std::reverse(kept.begin(), kept.end());
+            code = kept;
+
+            // Last instruction reading each register; outputs are read after the program
+            std::vector<int> lastUse(m_registers, -1);
+            for (int i = 0; i < int(code.size()); ++i)
+            {
+                for (int operand : {code[i].a, code[i].b, code[i].c})
+                {
+                    if (operand >= 0)
+                        lastUse[operand] = i;
+                }
+            }
+            for (int reg : m_program.outputs)
+            {
+                if (reg >= 0)
+                    lastUse[reg] = int(code.size());
+            }
+
+            // Inputs and constants are written before the program runs, so they keep
+            // their registers throughout
+            std::vector<int> physical(m_registers, -1);
+            int used = 0;
+            for (int reg : m_pinned)
+            {
+                if (live[reg])
+                    physical[reg] = used++;
+            }
+
+            std::vector<int> free;
+            for (int i = 0; i < int(code.size()); ++i)
+            {
+                Instruction &instruction = code[i];
+
+                // Operands read for the last time free their registers first, so the
+                // result may overwrite one in place; every instruction is elementwise
+                for (int operand : {instruction.a, instruction.b, instruction.c})
+                {
+                    if (operand >= 0 && lastUse[operand] == i && physical[operand] >= 0 &&
+                        std::find(m_pinned.begin(), m_pinned.end(), operand) == m_pinned.end() &&
+                        std::find(free.begin(), free.end(), physical[operand]) == free.end())
+                        free.push_back(physical[operand]);
+                }
+                if (free.empty())
+                {
+                    physical[instruction.dst] = used++;
+                }
+                else
+                {
+                    physical[instruction.dst] = free.back();
+                    free.pop_back();
+                }
+
+                instruction.a = physical[instruction.a];
+                instruction.b = instruction.b >= 0 ? physical[instruction.b] : -1;
+                instruction.c = instruction.c >= 0 ? physical[instruction.c] : -1;
+                instruction.dst = physical[instruction.dst];
+            }
+
+            for (int i = 0; i < InputCount; ++i)
+            {
+                int reg = m_program.inputs[i];
+                m_program.inputs[i] = reg >= 0 && live[reg] ? physical[reg] : -1;
+            }
+            for (int &reg : m_program.outputs)
+            {
+                if (reg >= 0)
+                    reg = physical[reg];
+            }
+            std::vector<std::pair<int, float>> constants;
+            for (const auto &constant : m_program.constants)
+            {
+                if (live[constant.first])
+                    constants.push_back({physical[constant.first], constant.second});
+            }
+            m_program.constants = constants;
+            m_program.registers = qMax(1, used);
+        }
+
+        Program &m_program;
+        QVector<Token> m_tokens;
+        int m_pos = 0;
+        bool m_failed = false;
+        QString m_error;
+        int m_registers = 0;          // Virtual registers so far
+        QVector<int> m_pinned;        // Virtual registers of inputs and constants
+        QHash<QString, Value> m_names; // Assigned names, and r, g, b, a once assigned
+        QHash<quint32, int> m_constants;
+    };
+
+    std::mutex cacheMutex; // Guards the cache below
+    QHash<QString, std::shared_ptr<const Program>> programs;
+
+    // One instruction over n pixels of each register
+    void execute(const Instruction &instruction, float *storage, int n)
+    {
+        float *d = storage + size_t(instruction.dst) * Block;
+        const float *a = storage + size_t(instruction.a) * Block;
+        const float *b = instruction.b >= 0 ? storage + size_t(instruction.b) * Block : a;
+        const float *c = instruction.c >= 0 ? storage + size_t(instruction.c) * Block : a;
+
+        switch (instruction.op)
+        {
+        case Op::Add: for (int i = 0; i < n; ++i) d[i] = a[i] + b[i]; break;
+        case Op::Sub: for (int i = 0; i < n; ++i) d[i] = a[i] - b[i]; break;
+        case Op::Mul: for (int i = 0; i < n; ++i) d[i] = a[i] * b[i]; break;
+        case Op::Div: for (int i = 0; i < n; ++i) d[i] = a[i] / b[i]; break;
+        case Op::Pow: for (int i = 0; i < n; ++i) d[i] = std::pow(a[i], b[i]); break;
+        case Op::Neg: for (int i = 0; i < n; ++i) d[i] = -a[i]; break;
+        case Op::Abs: for (int i = 0; i < n; ++i) d[i] = std::fabs(a[i]); break;
+        case Op::Sqrt: for (int i = 0; i < n; ++i) d[i] = std::sqrt(a[i]); break;
+        case Op::Exp: for (int i = 0; i < n; ++i) d[i] = std::exp(a[i]); break;
+        case Op::Log: for (int i = 0; i < n; ++i) d[i] = std::log(a[i]); break;
+        case Op::Sin: for (int i = 0; i < n; ++i) d[i] = std::sin(a[i]); break;
+        case Op::Cos: for (int i = 0; i < n; ++i) d[i] = std::cos(a[i]); break;
+        case Op::Tan: for (int i = 0; i < n; ++i) d[i] = std::tan(a[i]); break;
+        case Op::Floor: for (int i = 0; i < n; ++i) d[i] = std::floor(a[i]); break;
+        case Op::Min: for (int i = 0; i < n; ++i) d[i] = std::min(a[i], b[i]); break;
+        case Op::Max: for (int i = 0; i < n; ++i) d[i] = std::max(a[i], b[i]); break;
+        case Op::Less: for (int i = 0; i < n; ++i) d[i] = a[i] < b[i] ? 1.0f : 0.0f; break;
+        case Op::LessEqual: for (int i = 0; i < n; ++i) d[i] = a[i] <= b[i] ? 1.0f : 0.0f; break;
+        case Op::Greater: for (int i = 0; i < n; ++i) d[i] = a[i] > b[i] ? 1.0f : 0.0f; break;
+        case Op::GreaterEqual: for (int i = 0; i < n; ++i) d[i] = a[i] >= b[i] ? 1.0f : 0.0f; break;
+        case Op::Equal: for (int i = 0; i < n; ++i) d[i] = a[i] == b[i] ? 1.0f : 0.0f; break;
+        case Op::NotEqual: for (int i = 0; i < n; ++i) d[i] = a[i] != b[i] ? 1.0f : 0.0f; break;
+        case Op::Select: for (int i = 0; i < n; ++i) d[i] = a[i] != 0.0f ? b[i] : c[i]; break;
+        }
+    }
+}
+
+std::shared_ptr<const Expression::Program> Expression::compile(const QString &source, QString *error)
+{
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = programs.constFind(source);
+        if (it != programs.constEnd())
+            return it.value();
+    }
+
+    auto program = std::make_shared<Program>();
+    QString message;
+    if (!Compiler(*program).compile(source, &message))
+    {
+        if (error)
+            *error = message;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (programs.size() >= MaxEntries)
+        programs.clear();
+    programs.insert(source, program);
+    return program;
+}
+
+cv::Mat Expression::apply(const cv::Mat &image, const Program &program, double p1, double p2, double scale,
+                         const cv::Point &origin, const cv::Size &frameSize)
+{
+    const int channels = image.channels();
+    const int outputChannels = channels == 1 ? 3 : channels;
+    cv::Mat output(image.size(), CV_8UC(outputChannels));
+
+    // Byte offset of each output channel's source for the results left unassigned, and
+    // the input channel each of r, g, b, a is read from (alpha is 1 without one)
+    const int sourceOffset[4] = {channels == 1 ? 0 : 2, channels == 1 ? 0 : 1, 0, 3};
+    const float toFull = float(1.0 / scale);
+    const cv::Size frame = frameSize.area() > 0 ? frameSize : image.size();
+    const std::pair<int, float> uniforms[] = {
+        {program.inputs[InputW], frame.width * toFull}, {program.inputs[InputH], frame.height * toFull},
+        {program.inputs[InputP1], float(p1)}, {program.inputs[InputP2], float(p2)}};
+
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range &rows)
+                      {
+        std::vector<float> storage(size_t(program.registers) * Block);
+        auto reg = [&](int index) { return storage.data() + size_t(index) * Block; };
+        for (const auto &constant : program.constants)
+            std::fill_n(reg(constant.first), Block, constant.second);
+        for (const auto &uniform : uniforms)
+        {
+            if (uniform.first >= 0)
+                std::fill_n(reg(uniform.first), Block, uniform.second);
+        }
+
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            if (program.inputs[InputY] >= 0)
+                std::fill_n(reg(program.inputs[InputY]), Block, (origin.y + y) * toFull);
+
+            const uchar *src = image.ptr<uchar>(y);
+            uchar *dst = output.ptr<uchar>(y);
+            for (int x0 = 0; x0 < image.cols; x0 += Block)
+            {
+                const int n = qMin(Block, image.cols - x0);
+                const uchar *p = src + x0 * channels;
+
+                for (int k = 0; k < 4; ++k)
+                {
+                    const int index = program.inputs[InputR + k];
+                    if (index < 0)
+                        continue;
+                    float *values = reg(index);
+                    if (k == 3 && channels != 4)
+                    {
+                        std::fill_n(values, n, 1.0f);
+                        continue;
+                    }
+                    const int offset = sourceOffset[k];
+                    for (int i = 0; i < n; ++i)
+                        values[i] = p[i * channels + offset] * (1.0f / 255.0f);
+                }
+                if (program.inputs[InputX] >= 0)
+                {
+                    float *values = reg(program.inputs[InputX]);
+                    for (int i = 0; i < n; ++i)
+                        values[i] = (origin.x + x0 + i) * toFull;
+                }
+
+                for (const Instruction &instruction : program.code)
+                    execute(instruction, storage.data(), n);
+
+                // Written as B, G, R(, A); unassigned channels are copied from the input
+                uchar *q = dst + x0 * outputChannels;
+                for (int k = 0; k < outputChannels; ++k)
+                {
+                    const int channel = k == 3 ? 3 : 2 - k; // Output byte k holds b, g, r, a
+                    const int index = program.outputs[channel];
+                    if (index >= 0)
+                    {
+                        const float *values = reg(index);
+                        for (int i = 0; i < n; ++i)
+                            q[i * outputChannels + k] = cv::saturate_cast<uchar>(values[i] * 255.0f);
+                    }
+                    else
+                    {
+                        const int offset = sourceOffset[channel];
+                        for (int i = 0; i < n; ++i)
+                            q[i * outputChannels + k] = p[i * channels + offset];
+                    }
+                }
+            }
+        } });
+
+    return output;
+}
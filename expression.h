@@ -0,0 +1,36 @@
+// expression.h
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <memory>
+
+// Per-pixel formulas for the Expression node, e.g. "r = mix(r, (r + g + b) / 3, p1); b = b * 0.9".
+// Statements are separated by ';' or new lines and assign to r, g, b, a or to temporaries;
+// a bare expression sets r, g and b. Inputs are r, g, b, a (0 to 1), x, y, w, h
+// (full-resolution pixels), p1, p2 (node parameters) and pi, with + - * / ^,
+// comparisons (1 or 0) and abs, sqrt, exp, log, sin, cos, tan, floor, min, max, pow,
+// step, clamp, mix and if(condition, then, else).
+// Source text is parsed once into register bytecode (constants folded, unused values
+// dropped, registers reused), and the bytecode runs over blocks of a row at a time, so
+// each instruction is one tight loop the compiler can vectorize.
+namespace Expression
+{
+    // Compiled form of an expression; opaque outside expression.cpp
+    struct Program;
+
+    // Program for the source text, or null (with error set) if it isn't valid.
+    // Programs are cached by their text, so re-rendering a node compiles nothing.
+    std::shared_ptr<const Program> compile(const QString &source, QString *error = nullptr);
+
+    // Run the program over an 8-bit gray, BGR or BGRA image in parallel row bands. scale
+    // is the image's resolution relative to full size. A region of a larger frame is
+    // placed by origin (its top-left corner) and frameSize, at that scale, so x, y, w and
+    // h match a whole-frame run; an empty frameSize means the image is the frame.
+    // Gray input gives BGR output; alpha is kept unless the program assigns a.
+    cv::Mat apply(const cv::Mat &image, const Program &program, double p1, double p2, double scale = 1.0,
+                  const cv::Point &origin = cv::Point(), const cv::Size &frameSize = cv::Size());
+}
+
+#endif // EXPRESSION_H
@@ -0,0 +1,684 @@
+// graph_executor.cpp
+#include "graph_executor.h"
+#include "autotuner.h"
+#include "image_processor.h"
+#include "content_hash.h"
+#include "metrics.h"
+#include "priority_gate.h"
+#include "lut3d.h"
+#include "histogram.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImage>
+#include <QImageReader>
+#include <QVector>
+#include <QtMath>
+#include <cmath>
+#include <QDebug>
+
+namespace
+{
+    // Bump whenever a kernel changes its output so stale disk entries are never reused
+    // 2: Grayscale and gray Channel Splitter results are single-channel
+    // 3: pointwise nodes keep the alpha of BGRA input
+    const quint64 KernelVersion = 3;
+
+    size_t matBytes(const cv::Mat &image)
+    {
+        return image.total() * image.elemSize();
+    }
+}
+
+GraphExecutor::GraphExecutor(DiskCache *diskCache, size_t cacheBudgetBytes)
+    : m_diskCache(diskCache), m_cacheBudget(cacheBudgetBytes)
+{
+    m_gaugeIds.append(Metrics::addGauge("nie_executor_cache_bytes",
+                                        "Bytes held by in-memory result caches.", [this]() {
+                                            std::lock_guard<std::mutex> lock(m_mutex);
+                                            return double(m_cacheBytes);
+                                        }));
+    m_gaugeIds.append(Metrics::addGauge("nie_executor_cache_budget_bytes",
+                                        "Byte budget of in-memory result caches.", [this]() {
+                                            return double(m_cacheBudget);
+                                        }));
+    m_gaugeIds.append(Metrics::addGauge("nie_executor_cache_entries",
+                                        "Results held by in-memory result caches.", [this]() {
+                                            std::lock_guard<std::mutex> lock(m_mutex);
+                                            return double(m_cache.size());
+                                        }));
+}
+
+GraphExecutor::~GraphExecutor()
+{
+    for (int id : m_gaugeIds)
+        Metrics::removeGauge(id);
+}
+
+cv::Mat GraphExecutor::evaluate(Node *outputNode, double scale, const cv::Rect &roi)
+{
+    if (!outputNode)
+        return cv::Mat();
+
+    // Get the child nodes (inputs to the output node)
+    QList<Node *> children = outputNode->getChildren();
+    if (children.isEmpty())
+    {
+        qDebug() << "Output node has no connected inputs";
+        return cv::Mat();
+    }
+
+    // Only the first input is evaluated, as before
+    Node *sourceNode = children.first();
+    if (sourceNode->kind() != Node::Kind::LoadImage)
+    {
+        qDebug() << "Source node is not a Load Image node";
+        return cv::Mat();
+    }
+
+    scale = qBound(0.001, scale, 1.0);
+
+    auto load = [this, sourceNode](double sourceScale, quint64 &key)
+    {
+        return loadSource(sourceNode, sourceScale, key);
+    };
+
+    // The plan keeps any merged nodes alive until the render is done
+    GraphOptimizer::Plan plan = m_optimizer.optimize(chainSteps(sourceNode));
+    const QList<Node *> &steps = plan.steps;
+    quint64 key = 0;
+    bool premultiplied = ImageProcessor::alphaMode(sourceNode) == ImageProcessor::AlphaMode::Premultiplied;
+    ImageProcessor::PremultipliedScope alphaScope(premultiplied);
+    cv::Mat result = evaluatePlanned(steps, steps.size(), load, sourceSize(outputNode), scale, roi, key);
+    return premultiplied ? ImageProcessor::unpremultiply(result) : result;
+}
+
+cv::Mat GraphExecutor::evaluateImage(Node *outputNode, const cv::Mat &source)
+{
+    if (!outputNode || outputNode->getChildren().isEmpty() || source.empty())
+        return cv::Mat();
+
+    // The source node's own input is replaced by the given pixels
+    Node *sourceNode = outputNode->getChildren().first();
+    bool premultiplied = ImageProcessor::alphaMode(sourceNode) == ImageProcessor::AlphaMode::Premultiplied &&
+                         source.channels() == 4;
+    cv::Mat pixels = premultiplied ? ImageProcessor::premultiply(source)
+                                   : (source.isContinuous() ? source : source.clone());
+    quint64 pixelsKey = ContentHash::combine(ContentHash::string(premultiplied ? "Premultiplied" : "Image"), KernelVersion);
+    pixelsKey = ContentHash::combine(pixelsKey, Autotuner::outputKey());
+    pixelsKey = ContentHash::combine(pixelsKey, static_cast<quint64>(pixels.rows));
+    pixelsKey = ContentHash::combine(pixelsKey, static_cast<quint64>(pixels.cols));
+    pixelsKey = ContentHash::combine(pixelsKey, static_cast<quint64>(pixels.type()));
+    pixelsKey = ContentHash::words(pixels.data, matBytes(pixels), pixelsKey);
+
+    // Downscales pushed up to the source are made from the pixels themselves
+    auto load = [this, pixels, pixelsKey](double sourceScale, quint64 &key)
+    {
+        key = pixelsKey;
+        if (sourceScale >= 1.0)
+            return pixels;
+
+        key = ContentHash::combine(ContentHash::string("scaled", pixelsKey), static_cast<quint64>(qRound64(sourceScale * 1e6)));
+        cv::Mat image;
+        if (lookupInMemory(key, image))
+            return image;
+        cv::Size target(qMax(1, qRound(pixels.cols * sourceScale)), qMax(1, qRound(pixels.rows * sourceScale)));
+        cv::resize(pixels, image, target, 0, 0, cv::INTER_AREA);
+        storeInMemory(key, image);
+        return image;
+    };
+
+    // The plan keeps any merged nodes alive until the render is done
+    GraphOptimizer::Plan plan = m_optimizer.optimize(chainSteps(sourceNode));
+    const QList<Node *> &steps = plan.steps;
+    quint64 key = 0;
+    ImageProcessor::PremultipliedScope alphaScope(premultiplied);
+    cv::Mat result = evaluatePlanned(steps, steps.size(), load, QSize(pixels.cols, pixels.rows), 1.0, cv::Rect(), key);
+    return premultiplied ? ImageProcessor::unpremultiply(result) : result;
+}
+
+QList<Node *> GraphExecutor::chainSteps(Node *sourceNode)
+{
+    QList<Node *> steps;
+    for (Node *effectNode : sourceNode->getChildren())
+    {
+        if (effectNode)
+            steps.append(effectNode);
+    }
+    return steps;
+}
+
+cv::Size GraphExecutor::prefixSize(const QList<Node *> &steps, int count, const QSize &fullSize, double scale)
+{
+    // Same rounding as the scaled source
+    cv::Size size(fullSize.width(), fullSize.height());
+    if (scale < 1.0)
+        size = cv::Size(qMax(1, qRound(fullSize.width() * scale)), qMax(1, qRound(fullSize.height() * scale)));
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (ImageProcessor::isGeometric(steps[i]))
+            size = ImageProcessor::outputSize(steps[i], size, scale);
+    }
+    return size;
+}
+
+cv::Mat GraphExecutor::evaluatePlanned(const QList<Node *> &steps, int count, const SourceLoader &load,
+                                       const QSize &fullSize, double scale, const cv::Rect &roi, quint64 &key)
+{
+    // Split off the nodes after the last geometric node; they run in its output's frame
+    int g = count - 1;
+    while (g >= 0 && !ImageProcessor::isGeometric(steps[g]))
+        --g;
+    QList<Node *> tail = steps.mid(g + 1, count - g - 1);
+
+    if (g < 0)
+    {
+        cv::Mat image = load(scale, key);
+        if (image.empty())
+            return cv::Mat();
+        quint64 sourceKey = key;
+        for (Node *effectNode : tail)
+            key = stepKey(effectNode, key);
+        return evaluateChain(tail, image, scale, sourceKey, roi);
+    }
+
+    if (!fullSize.isValid())
+        return cv::Mat();
+
+    Node *geometry = steps[g];
+    const cv::Size outSize = prefixSize(steps, g + 1, fullSize, scale);
+    const cv::Rect outBounds(0, 0, outSize.width, outSize.height);
+
+    // Part of the geometric node's output the rest of the chain reads
+    cv::Rect needed = outBounds;
+    if (roi.area() > 0)
+    {
+        needed = roi;
+        for (int i = tail.size() - 1; i >= 0; --i)
+        {
+            int halo = ImageProcessor::nodeHalo(tail[i], scale);
+            needed = cv::Rect(needed.x - halo, needed.y - halo, needed.width + 2 * halo, needed.height + 2 * halo);
+        }
+        needed &= outBounds;
+        if (needed.area() == 0)
+            return cv::Mat();
+    }
+
+    quint64 inputKey = 0;
+    quint64 upstreamKey = 0;
+    cv::Mat input;
+    if (geometry->kind() == Node::Kind::Crop)
+    {
+        // Crop pushdown: upstream nodes only compute the pixels that survive the crop
+        cv::Rect crop = ImageProcessor::cropRect(geometry, prefixSize(steps, g, fullSize, scale), scale);
+        input = evaluatePlanned(steps, g, load, fullSize, scale, needed + crop.tl(), upstreamKey);
+        inputKey = stepKey(geometry, upstreamKey);
+    }
+    else
+    {
+        double upstreamScale = scale;
+        if (geometry->kind() == Node::Kind::Resize)
+        {
+            // Downscale pushdown: when the upstream nodes follow the render scale, run them
+            // at (about) the target size instead of shrinking their full-size result
+            cv::Size inSize = prefixSize(steps, g, fullSize, scale);
+            double factor = qMax(double(outSize.width) / inSize.width, double(outSize.height) / inSize.height);
+            bool commutes = true;
+            for (int i = 0; i < g; ++i)
+                commutes = commutes && ImageProcessor::commutesWithScale(steps[i]);
+            if (factor < 1.0 && commutes)
+                upstreamScale = scale * factor;
+        }
+
+        cv::Mat upstream = evaluatePlanned(steps, g, load, fullSize, upstreamScale, cv::Rect(), upstreamKey);
+        if (upstream.empty())
+            return cv::Mat();
+
+        if (geometry->kind() == Node::Kind::Resize)
+        {
+            // The upstream scale no longer identifies the output size, so the key carries it
+            inputKey = ContentHash::combine(stepKey(geometry, upstreamKey), static_cast<quint64>(outSize.width));
+            inputKey = ContentHash::combine(inputKey, static_cast<quint64>(outSize.height));
+            if (!lookup(inputKey, input))
+            {
+                QString interpolation = geometry->getProperty("interpolation")->toString();
+                input = ImageProcessor::applyResize(upstream, outSize, interpolation);
+                store(inputKey, input);
+            }
+        }
+        else
+        {
+            input = runStep(geometry, upstream, scale, upstreamKey, inputKey);
+        }
+        if (!input.empty() && needed != outBounds)
+            input = input(needed & cv::Rect(0, 0, input.cols, input.rows));
+    }
+    if (input.empty())
+        return cv::Mat();
+
+    key = inputKey;
+    for (Node *effectNode : tail)
+        key = stepKey(effectNode, key);
+
+    if (needed == outBounds && roi.area() == 0)
+        return evaluateChain(tail, input, scale, inputKey, cv::Rect());
+
+    // Only part of the geometric node's output exists; run the rest of the chain on it
+    cv::Rect target = (roi.area() > 0 ? roi & outBounds : outBounds) - needed.tl();
+    return evaluateChain(tail, input, scale, regionKey(inputKey, needed), target, needed.tl(), outSize);
+}
+
+cv::Mat GraphExecutor::evaluateChain(const QList<Node *> &steps, cv::Mat image, double scale, quint64 key,
+                                     const cv::Rect &roi, const cv::Point &origin, const cv::Size &frameSize)
+{
+    const cv::Rect bounds(0, 0, image.cols, image.rows);
+    cv::Rect target = roi.area() > 0 ? (roi & bounds) : bounds;
+    if (target.area() == 0)
+        return cv::Mat();
+    if (target != bounds)
+        return evaluateRegion(steps, image, scale, key, target, origin, frameSize);
+
+    // Apply each effect connected to the input node in sequence
+    for (Node *effectNode : steps)
+    {
+        PriorityGate::checkpoint();
+        image = runStep(effectNode, image, scale, key, key, origin, frameSize);
+    }
+
+    return image;
+}
+
+cv::Mat GraphExecutor::evaluateRegion(const QList<Node *> &steps, const cv::Mat &source, double scale,
+                                      quint64 sourceKey, const cv::Rect &target, const cv::Point &origin,
+                                      const cv::Size &frameSize)
+{
+    // Keys of each step's full-frame output, computed without touching pixels
+    QVector<quint64> fullKeys(steps.size() + 1);
+    fullKeys[0] = sourceKey;
+    for (int i = 0; i < steps.size(); ++i)
+    {
+        fullKeys[i + 1] = stepKey(steps[i], fullKeys[i]);
+    }
+
+    // A full-frame result that is already in memory only needs cropping
+    cv::Mat cached;
+    if (lookupInMemory(fullKeys.last(), cached))
+        return cached(target);
+
+    // Walk back from the target: each step needs its output region plus its halo
+    const cv::Rect bounds(0, 0, source.cols, source.rows);
+    QVector<cv::Rect> regions(steps.size() + 1);
+    regions[steps.size()] = target;
+    for (int i = steps.size() - 1; i >= 0; --i)
+    {
+        int halo = ImageProcessor::nodeHalo(steps[i], scale);
+        const cv::Rect &out = regions[i + 1];
+        regions[i] = cv::Rect(out.x - halo, out.y - halo, out.width + 2 * halo, out.height + 2 * halo) & bounds;
+    }
+
+    // Each intermediate is exactly the full-frame output restricted to its region,
+    // so it is keyed by both (regionKey) and shared between overlapping requests
+    cv::Mat image = source(regions[0]);
+    for (int i = 0; i < steps.size(); ++i)
+    {
+        PriorityGate::checkpoint();
+        quint64 outputKey = regionKey(fullKeys[i + 1], regions[i + 1]);
+        cv::Mat result;
+        cv::Mat full;
+        if (lookupInMemory(fullKeys[i + 1], full))
+        {
+            result = full(regions[i + 1]);
+        }
+        else if (regions[i] == bounds)
+        {
+            // A step that needs the whole frame (a full-frame halo) runs once per render:
+            // its output is cached under the full-frame key and every tile or strip
+            // crops from it
+            quint64 fullKey;
+            full = runStep(steps[i], image, scale, fullKeys[i], fullKey, origin, frameSize);
+            result = full(regions[i + 1]);
+        }
+        else if (!lookupInMemory(outputKey, result))
+        {
+            // Position-reading nodes (Expression) are told where the region lies
+            quint64 inputKey = regionKey(fullKeys[i], regions[i]);
+            cv::Size frame = frameSize.area() > 0 ? frameSize : bounds.size();
+            cv::Mat processed = ImageProcessor::processNode(steps[i], image, scale, cv::Mat(), inputKey,
+                                                            origin + regions[i].tl(), frame);
+
+            // Only pixels at least a halo away from the cut edges are exact; keep those
+            result = processed(regions[i + 1] - regions[i].tl()).clone();
+
+            // Region results are small and short-lived, so they stay out of the disk cache
+            storeInMemory(outputKey, result);
+        }
+        image = result;
+    }
+
+    return image;
+}
+
+cv::Mat GraphExecutor::evaluateTiled(Node *outputNode, int stripRows)
+{
+    QSize size = outputSize(outputNode);
+    if (!size.isValid() || size.height() <= stripRows)
+        return evaluate(outputNode);
+
+    cv::Mat result;
+    for (int y = 0; y < size.height(); y += stripRows)
+    {
+        PriorityGate::checkpoint();
+        cv::Rect strip(0, y, size.width(), qMin(stripRows, size.height() - y));
+        cv::Mat part = evaluate(outputNode, 1.0, strip);
+        if (part.empty())
+            return cv::Mat();
+
+        if (result.empty())
+            result.create(size.height(), size.width(), part.type());
+        part.copyTo(result(strip));
+    }
+    return result;
+}
+
+QSize GraphExecutor::sourceSize(Node *outputNode)
+{
+    if (!outputNode || outputNode->getChildren().isEmpty())
+        return QSize();
+
+    Node *sourceNode = outputNode->getChildren().first();
+    if (sourceNode->kind() != Node::Kind::LoadImage)
+        return QSize();
+
+    return QImageReader(sourceNode->getProperty("filePath")->toString()).size();
+}
+
+QSize GraphExecutor::outputSize(Node *outputNode)
+{
+    QSize size = sourceSize(outputNode);
+    if (!size.isValid())
+        return size;
+
+    QList<Node *> steps = chainSteps(outputNode->getChildren().first());
+    cv::Size result = prefixSize(steps, steps.size(), size, 1.0);
+    return QSize(result.width, result.height);
+}
+
+QStringList GraphExecutor::rewrites(Node *outputNode)
+{
+    if (!outputNode || outputNode->getChildren().isEmpty())
+        return QStringList();
+    return m_optimizer.optimize(chainSteps(outputNode->getChildren().first())).rewrites;
+}
+
+void GraphExecutor::clearCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cache.clear();
+        m_cacheBytes = 0;
+    }
+    Histogram::clearCache();
+}
+
+quint64 GraphExecutor::nodeKey(Node *node)
+{
+    return node->contentKey();
+}
+
+quint64 GraphExecutor::blurKey(quint64 inputKey, int radius, const QString &blurType)
+{
+    quint64 h = ContentHash::string("Blur");
+    h = ContentHash::combine(h, static_cast<quint64>(radius));
+    h = ContentHash::string(blurType, h);
+    return ContentHash::combine(inputKey, h);
+}
+
+cv::Mat GraphExecutor::loadSource(Node *sourceNode, double scale, quint64 &key)
+{
+    // Get the file path from the node property
+    QString filePath = sourceNode->getProperty("filePath")->toString();
+    if (filePath.isEmpty())
+    {
+        qDebug() << "File path is empty";
+        return cv::Mat();
+    }
+
+    QFileInfo info(filePath);
+    if (!info.exists())
+    {
+        qDebug() << "Failed to load image from:" << filePath;
+        return cv::Mat();
+    }
+
+    // The source is identified by its contents; the hash is only recomputed
+    // when the file's size or modification time changes
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    SourceStamp stamp;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stamp = m_sourceStamps.value(filePath);
+    }
+    if (stamp.contentKey == 0 || stamp.modified != modified || stamp.size != info.size())
+    {
+        stamp.modified = modified;
+        stamp.size = info.size();
+        // Without a cache nothing is ever looked up by this key, so reading the whole
+        // file to hash it would be wasted; the path and stamp still tell sources apart
+        if (m_diskCache == nullptr && m_cacheBudget == 0)
+            stamp.contentKey = ContentHash::combine(ContentHash::combine(ContentHash::string(filePath), static_cast<quint64>(stamp.size)),
+                                                    static_cast<quint64>(modified));
+        else
+            stamp.contentKey = ContentHash::file(filePath);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sourceStamps.insert(filePath, stamp);
+    }
+    // The kernel profile picks between kernels that round differently, so results under
+    // another profile are never reused
+    quint64 sourceKey = ContentHash::combine(ContentHash::string("Load Image"), KernelVersion);
+    sourceKey = ContentHash::combine(sourceKey, Autotuner::outputKey());
+    sourceKey = ContentHash::combine(sourceKey, stamp.contentKey);
+
+    // Keeping alpha changes the working pixels, so it changes every key downstream too
+    ImageProcessor::AlphaMode alpha = ImageProcessor::alphaMode(sourceNode);
+    if (alpha != ImageProcessor::AlphaMode::Ignore)
+        sourceKey = ContentHash::combine(sourceKey, static_cast<quint64>(alpha));
+
+    if (scale >= 1.0)
+    {
+        key = sourceKey;
+        return loadFullSource(filePath, alpha, sourceKey);
+    }
+
+    key = ContentHash::combine(ContentHash::string("scaled", sourceKey), static_cast<quint64>(qRound64(scale * 1e6)));
+    cv::Mat image;
+    if (lookup(key, image))
+        return image;
+
+    // Start from the smallest pyramid level that is still at least as large as the target
+    int level = qMax(0, static_cast<int>(std::floor(std::log2(1.0 / scale))));
+    cv::Mat levelImage = pyramidLevel(filePath, alpha, sourceKey, level);
+    if (levelImage.empty())
+        return cv::Mat();
+
+    QSize fullSize = QImageReader(filePath).size();
+    if (!fullSize.isValid())
+        fullSize = QSize(levelImage.cols << level, levelImage.rows << level);
+
+    cv::Size target(qMax(1, qRound(fullSize.width() * scale)), qMax(1, qRound(fullSize.height() * scale)));
+    if (levelImage.size() == target)
+        image = levelImage;
+    else
+        cv::resize(levelImage, image, target, 0, 0, cv::INTER_AREA);
+
+    store(key, image);
+    return image;
+}
+
+cv::Mat GraphExecutor::pyramidLevel(const QString &filePath, ImageProcessor::AlphaMode alpha, quint64 sourceKey, int level)
+{
+    if (level == 0)
+        return loadFullSource(filePath, alpha, sourceKey);
+
+    // Each level halves the previous one, so a warm cache never touches the full image
+    quint64 levelKey = ContentHash::combine(ContentHash::string("pyramid", sourceKey), static_cast<quint64>(level));
+    cv::Mat coarser;
+    if (lookup(levelKey, coarser))
+        return coarser;
+
+    cv::Mat finer = pyramidLevel(filePath, alpha, sourceKey, level - 1);
+    if (finer.empty())
+        return cv::Mat();
+
+    cv::resize(finer, coarser, cv::Size((finer.cols + 1) / 2, (finer.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+    store(levelKey, coarser);
+    return coarser;
+}
+
+cv::Mat GraphExecutor::loadFullSource(const QString &filePath, ImageProcessor::AlphaMode alpha, quint64 key)
+{
+    cv::Mat image;
+    if (lookup(key, image))
+        return image;
+
+    // Load the original image
+    QImage originalQImage;
+    if (!originalQImage.load(filePath))
+    {
+        qDebug() << "Failed to load image from:" << filePath;
+        return cv::Mat();
+    }
+
+    // Convert to OpenCV format
+    image = ImageProcessor::QImageToCvMat(originalQImage, alpha);
+    store(key, image);
+    return image;
+}
+
+quint64 GraphExecutor::regionKey(quint64 key, const cv::Rect &region)
+{
+    key = ContentHash::combine(ContentHash::string("region", key), static_cast<quint64>(region.x));
+    key = ContentHash::combine(key, static_cast<quint64>(region.y));
+    key = ContentHash::combine(key, static_cast<quint64>(region.width));
+    return ContentHash::combine(key, static_cast<quint64>(region.height));
+}
+
+quint64 GraphExecutor::stepKey(Node *node, quint64 inputKey)
+{
+    if (node->kind() == Node::Kind::Blur)
+    {
+        int radius = node->getProperty("radius")->toInt();
+        QString blurType = node->getProperty("blurType")->toString();
+        return blurKey(inputKey, radius, blurType);
+    }
+    if (node->kind() == Node::Kind::Lut3D)
+    {
+        // The path alone would keep serving results after the file is edited
+        quint64 lutKey = Lut3D::fileKey(node->getProperty("lutPath")->toString());
+        return ContentHash::combine(ContentHash::combine(inputKey, nodeKey(node)), lutKey);
+    }
+    return ContentHash::combine(inputKey, nodeKey(node));
+}
+
+cv::Mat GraphExecutor::runStep(Node *node, const cv::Mat &input, double scale, quint64 inputKey, quint64 &outputKey,
+                               const cv::Point &origin, const cv::Size &frameSize)
+{
+    const Node::Kind kind = node->kind();
+    outputKey = stepKey(node, inputKey);
+
+    cv::Mat result;
+    if (lookup(outputKey, result))
+        return result;
+
+    // Unsharp masking reuses (or publishes) the same Gaussian a Blur node would produce
+    cv::Mat gaussian;
+    if (kind == Node::Kind::Sharpen && node->getProperty("mode")->toString() == "Unsharp Mask")
+    {
+        int radius = node->getProperty("radius")->toInt();
+        quint64 gaussianKey = blurKey(inputKey, radius, "Uniform");
+        if (!lookup(gaussianKey, gaussian))
+        {
+            gaussian = ImageProcessor::applyBlur(input, ImageProcessor::scaledRadius(radius, scale), "Uniform");
+            store(gaussianKey, gaussian);
+        }
+    }
+
+    result = ImageProcessor::processNode(node, input, scale, gaussian, inputKey, origin, frameSize);
+    store(outputKey, result);
+    return result;
+}
+
+bool GraphExecutor::lookup(quint64 key, cv::Mat &image)
+{
+    if (lookupInMemory(key, image))
+        return true;
+
+    // Fall back to results persisted by this or an earlier session
+    if (!m_diskCache)
+        return false;
+
+    bool hit = m_diskCache->load(key, image);
+    Metrics::recordCacheLookup(Metrics::CacheLevel::Disk, hit);
+    if (hit)
+        storeInMemory(key, image);
+    return hit;
+}
+
+bool GraphExecutor::lookupInMemory(quint64 key, cv::Mat &image)
+{
+    bool hit = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end())
+        {
+            it->lastUse = ++m_useCounter;
+            image = it->image;
+            hit = true;
+        }
+    }
+    // Recorded outside the lock: a scrape holds the metrics lock while sampling our gauges
+    Metrics::recordCacheLookup(Metrics::CacheLevel::Memory, hit);
+    return hit;
+}
+
+void GraphExecutor::store(quint64 key, const cv::Mat &image)
+{
+    storeInMemory(key, image);
+    if (m_diskCache)
+        m_diskCache->store(key, image);
+}
+
+void GraphExecutor::storeInMemory(quint64 key, const cv::Mat &image)
+{
+    size_t bytes = matBytes(image);
+    if (image.empty() || bytes > m_cacheBudget)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto existing = m_cache.find(key);
+    if (existing != m_cache.end())
+    {
+        m_cacheBytes -= matBytes(existing->image);
+        m_cache.erase(existing);
+    }
+
+    // Evict least recently used results until the new one fits
+    while (m_cacheBytes + bytes > m_cacheBudget && !m_cache.isEmpty())
+    {
+        auto oldest = m_cache.begin();
+        for (auto it = m_cache.begin(); it != m_cache.end(); ++it)
+        {
+            if (it->lastUse < oldest->lastUse)
+                oldest = it;
+        }
+        m_cacheBytes -= matBytes(oldest->image);
+        m_cache.erase(oldest);
+    }
+
+    CacheEntry entry;
+    entry.image = image;
+    entry.lastUse = ++m_useCounter;
+    m_cache.insert(key, entry);
+    m_cacheBytes += bytes;
+}
@@ -0,0 +1,121 @@
+// graph_executor.h
+#ifndef GRAPH_EXECUTOR_H
+#define GRAPH_EXECUTOR_H
+
+#include <opencv2/opencv.hpp>
+#include <QHash>
+#include <QSize>
+#include <QString>
+#include <functional>
+#include <mutex>
+#include "node.h"
+#include "disk_cache.h"
+#include "graph_optimizer.h"
+#include "image_processor.h"
+
+// Evaluates the chain feeding an Output node and shares identical subcomputations.
+// Every intermediate result is keyed by a hash of (node kind, parameters, input key),
+// so work reached again from another Output node or a later refresh runs only once.
+// Sources are identified by their file contents, which makes the keys valid across
+// sessions; results are also persisted to the disk cache for warm starts.
+// Chains are rewritten by a GraphOptimizer before they run.
+// The caches are internally locked, so one executor can serve several threads as long
+// as each thread evaluates its own nodes.
+class GraphExecutor
+{
+public:
+    explicit GraphExecutor(DiskCache *diskCache = &DiskCache::shared(),
+                           size_t cacheBudgetBytes = 512 * 1024 * 1024);
+    ~GraphExecutor();
+
+    // Evaluate the chain feeding an Output node; returns an empty Mat on failure.
+    // With scale < 1 the chain runs directly at that resolution, starting from a
+    // cached source pyramid, instead of rendering full size and downscaling.
+    // A non-empty roi (in scaled pixels) limits the work to that region: it is grown
+    // by each node's halo on the way back to the source, so only needed pixels are computed.
+    cv::Mat evaluate(Node *outputNode, double scale = 1.0, const cv::Rect &roi = cv::Rect());
+
+    // Evaluate the chain feeding an Output node on the given pixels instead of the
+    // file its source node points at (e.g. images handed over in shared memory)
+    cv::Mat evaluateImage(Node *outputNode, const cv::Mat &source);
+
+    // Full-resolution render in horizontal strips. Background work is preempted at
+    // priority checkpoints between strips as well as between nodes, so an interactive
+    // preview never waits for a whole large export
+    cv::Mat evaluateTiled(Node *outputNode, int stripRows = 512);
+
+    // Full-resolution size of the source feeding an Output node, read from the file header
+    static QSize sourceSize(Node *outputNode);
+
+    // Full-resolution size of the Output node's result, after any Crop, Resize or Rotate
+    static QSize outputSize(Node *outputNode);
+
+    // Rewrites the optimizer applies to the chain feeding an Output node, one line each
+    QStringList rewrites(Node *outputNode);
+
+    // Drop every cached intermediate result
+    void clearCache();
+
+    // Hash of a node's kind and parameters (its name and position are ignored)
+    static quint64 nodeKey(Node *node);
+
+    // Key of a blur of the image identified by inputKey. Blur nodes and the
+    // Gaussian inside Sharpen's unsharp mask share it, so they share results too.
+    static quint64 blurKey(quint64 inputKey, int radius, const QString &blurType);
+
+private:
+    struct CacheEntry
+    {
+        cv::Mat image;
+        quint64 lastUse = 0;
+    };
+
+    // Content hash of a source file, valid while its size and mtime are unchanged
+    struct SourceStamp
+    {
+        qint64 modified = 0;
+        qint64 size = 0;
+        quint64 contentKey = 0;
+    };
+
+    // Source pixels at a render scale, and their key
+    using SourceLoader = std::function<cv::Mat(double scale, quint64 &key)>;
+
+    // Result of steps[0, count) at the given scale, restricted to roi if set; key receives the
+    // full-frame key. Geometric nodes split the chain: crops are pushed upstream as regions
+    // and downscales as a lower render scale, so upstream nodes only compute what survives.
+    cv::Mat evaluatePlanned(const QList<Node *> &steps, int count, const SourceLoader &load,
+                            const QSize &fullSize, double scale, const cv::Rect &roi, quint64 &key);
+    static cv::Size prefixSize(const QList<Node *> &steps, int count, const QSize &fullSize, double scale);
+    static QList<Node *> chainSteps(Node *sourceNode);
+    cv::Mat loadSource(Node *sourceNode, double scale, quint64 &key);
+    cv::Mat loadFullSource(const QString &filePath, ImageProcessor::AlphaMode alpha, quint64 key);
+    cv::Mat pyramidLevel(const QString &filePath, ImageProcessor::AlphaMode alpha, quint64 sourceKey, int level);
+    // origin and frameSize place image in its frame when it is only a region of it, as
+    // for ImageProcessor::processNode
+    cv::Mat evaluateChain(const QList<Node *> &steps, cv::Mat image, double scale, quint64 key,
+                          const cv::Rect &roi, const cv::Point &origin = cv::Point(),
+                          const cv::Size &frameSize = cv::Size());
+    cv::Mat evaluateRegion(const QList<Node *> &steps, const cv::Mat &source, double scale, quint64 sourceKey,
+                           const cv::Rect &target, const cv::Point &origin, const cv::Size &frameSize);
+    cv::Mat runStep(Node *node, const cv::Mat &input, double scale, quint64 inputKey, quint64 &outputKey,
+                    const cv::Point &origin = cv::Point(), const cv::Size &frameSize = cv::Size());
+    static quint64 stepKey(Node *node, quint64 inputKey);
+    static quint64 regionKey(quint64 key, const cv::Rect &region);
+    bool lookup(quint64 key, cv::Mat &image);
+    bool lookupInMemory(quint64 key, cv::Mat &image);
+    void store(quint64 key, const cv::Mat &image);
+    void storeInMemory(quint64 key, const cv::Mat &image);
+
+    DiskCache *m_diskCache;
+    std::mutex m_mutex; // Guards the caches and source stamps below
+    QHash<QString, SourceStamp> m_sourceStamps;
+    QHash<quint64, CacheEntry> m_cache;
+    size_t m_cacheBytes = 0;
+    size_t m_cacheBudget;
+    quint64 m_useCounter = 0;
+    QList<int> m_gaugeIds;
+    GraphOptimizer m_optimizer;
+};
+
+#endif // GRAPH_EXECUTOR_H
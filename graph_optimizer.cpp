@@ -0,0 +1,269 @@
+// graph_optimizer.cpp
+#include "graph_optimizer.h"
+#include "graph_executor.h"
+#include "content_hash.h"
+#include <QDebug>
+#include <QtMath>
+#include <cmath>
+
+namespace
+{
+    const int MaxPlans = 256;
+
+    QString label(Node *node)
+    {
+        return node->getName().isEmpty() ? node->getType() : node->getName();
+    }
+
+    double number(Node *node, const QString &name)
+    {
+        return node->getProperty(name)->toDouble();
+    }
+
+    bool isQuarterTurn(Node *node)
+    {
+        return std::fmod(number(node, "angle"), 90.0) == 0.0;
+    }
+}
+
+GraphOptimizer::Plan GraphOptimizer::optimize(const QList<Node *> &steps)
+{
+    // A plan depends on which nodes these are (it refers to them) and on their parameters;
+    // a node's version stamp changes with every edit, so it stands in for the parameters
+    quint64 key = ContentHash::Seed;
+    for (Node *node : steps)
+    {
+        key = ContentHash::combine(key, static_cast<quint64>(reinterpret_cast<quintptr>(node)));
+        key = ContentHash::combine(key, node->version());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_plans.constFind(key);
+        if (it != m_plans.constEnd())
+            return it.value();
+    }
+
+    Plan result = plan(steps);
+    if (!result.rewrites.isEmpty())
+        qDebug() << "Graph optimizer:" << result.rewrites.join("; ");
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_plans.size() >= MaxPlans)
+        {
+            // Plans handed out keep their merged nodes; forget the ones nothing uses now
+            m_plans.clear();
+            for (auto it = m_merged.begin(); it != m_merged.end();)
+            {
+                if (it->expired())
+                    it = m_merged.erase(it);
+                else
+                    ++it;
+            }
+        }
+        m_plans.insert(key, result);
+    }
+    return result;
+}
+
+GraphOptimizer::Plan GraphOptimizer::plan(const QList<Node *> &steps)
+{
+    Plan result;
+    QList<Node *> &chain = result.steps;
+    chain = steps;
+
+    // One rewrite per pass until none applies; every rule shortens the chain or moves a
+    // reducer strictly earlier, so this terminates
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (int i = 0; i < chain.size() && !changed; ++i)
+        {
+            if (isIdentity(chain[i], i > 0 ? chain[i - 1] : nullptr))
+            {
+                result.rewrites.append(QString("removed %1 (no effect)").arg(label(chain[i])));
+                chain.removeAt(i);
+                changed = true;
+            }
+        }
+
+        for (int i = 1; i < chain.size() && !changed; ++i)
+        {
+            if (Node *merged = merge(chain[i - 1], chain[i], result))
+            {
+                result.rewrites.append(QString("merged %1 and %2").arg(label(chain[i - 1]), label(chain[i])));
+                chain[i - 1] = merged;
+                chain.removeAt(i);
+                changed = true;
+            }
+        }
+
+        for (int i = 1; i < chain.size() && !changed; ++i)
+        {
+            if (reducesChannels(chain[i]) && commutesWithReduction(chain[i], chain[i - 1]))
+            {
+                result.rewrites.append(QString("moved %1 ahead of %2").arg(label(chain[i]), label(chain[i - 1])));
+                chain.swapItemsAt(i - 1, i);
+                changed = true;
+            }
+        }
+    }
+
+    return result;
+}
+
+bool GraphOptimizer::isIdentity(Node *node, Node *previous)
+{
+    const Node::Kind kind = node->kind();
+
+    if (kind == Node::Kind::Brightness)
+    {
+        return number(node, "brightness") == 0.0 && number(node, "contrast") == 0.0;
+    }
+    else if (kind == Node::Kind::Sharpen)
+    {
+        // Amount 0 leaves the kernel and the unsharp mask as the identity
+        return number(node, "amount") == 0.0 && number(node, "Contrast") == 1.0;
+    }
+    else if (kind == Node::Kind::Blur)
+    {
+        return number(node, "radius") <= 0.0;
+    }
+    else if (kind == Node::Kind::Lut3D)
+    {
+        return node->getProperty("lutPath")->toString().isEmpty();
+    }
+    else if (kind == Node::Kind::Convolution)
+    {
+        return node->getProperty("kernel")->toString().trimmed().isEmpty();
+    }
+    else if (kind == Node::Kind::Expression)
+    {
+        return node->getProperty("expression")->toString().trimmed().isEmpty();
+    }
+    else if (kind == Node::Kind::HistogramEqualize)
+    {
+        return number(node, "amount") <= 0.0;
+    }
+    else if (kind == Node::Kind::Median || kind == Node::Kind::Morphology)
+    {
+        return number(node, "radius") <= 0.0;
+    }
+    else if (kind == Node::Kind::Bilateral)
+    {
+        return number(node, "radius") <= 0.0 || number(node, "range") <= 0.0;
+    }
+    else if (kind == Node::Kind::GuidedFilter)
+    {
+        return number(node, "radius") <= 0.0 || number(node, "smoothing") <= 0.0;
+    }
+    else if (kind == Node::Kind::Crop)
+    {
+        return number(node, "x") == 0.0 && number(node, "y") == 0.0 &&
+               number(node, "width") == 0.0 && number(node, "height") == 0.0;
+    }
+    else if (kind == Node::Kind::Resize)
+    {
+        return number(node, "width") <= 0.0 && number(node, "height") <= 0.0;
+    }
+    else if (kind == Node::Kind::Rotate)
+    {
+        return std::fmod(number(node, "angle"), 360.0) == 0.0;
+    }
+    else if (kind == Node::Kind::Grayscale)
+    {
+        // All three channels are already equal, and every method maps v,v,v to v
+        return previous && reducesChannels(previous);
+    }
+
+    return false;
+}
+
+bool GraphOptimizer::reducesChannels(Node *node)
+{
+    const Node::Kind kind = node->kind();
+    if (kind == Node::Kind::ChannelSplitter)
+        return node->getProperty("grayscaleOutput")->toBool();
+    return kind == Node::Kind::Grayscale;
+}
+
+bool GraphOptimizer::commutesWithReduction(Node *reducer, Node *node)
+{
+    const Node::Kind kind = node->kind();
+
+    // Picking one channel commutes with anything that treats channels independently
+    if (reducer->kind() == Node::Kind::ChannelSplitter)
+        return kind == Node::Kind::Blur || kind == Node::Kind::Sharpen || kind == Node::Kind::Brightness || kind == Node::Kind::GuidedFilter ||
+               kind == Node::Kind::Median || kind == Node::Kind::Morphology;
+
+    // A weighted channel sum commutes with a blur, which neither clips nor mixes channels.
+    // Lightness (max + min) / 2 is not linear, and sharpening and brightness can clip
+    // one channel but not another.
+    return reducer->getProperty("method")->toString() != "Lightness" && kind == Node::Kind::Blur;
+}
+
+Node *GraphOptimizer::merge(Node *first, Node *second, Plan &plan)
+{
+    const Node::Kind kind = first->kind();
+    if (second->kind() != kind)
+        return nullptr;
+
+    if (kind == Node::Kind::Brightness)
+    {
+        double alpha1 = 1.0 + number(first, "contrast") / 100.0;
+        double beta1 = number(first, "brightness");
+        double alpha2 = 1.0 + number(second, "contrast") / 100.0;
+        double beta2 = number(second, "brightness");
+
+        // Two affine maps compose into one. Where the first one clips, the second must
+        // clip those pixels the same way, or the merged map would bring back detail
+        bool clipsLow = qMin(beta1, 255.0 * alpha1 + beta1) < 0.0;
+        bool clipsHigh = qMax(beta1, 255.0 * alpha1 + beta1) > 255.0;
+        if ((clipsLow || clipsHigh) && alpha2 < 0.0)
+            return nullptr;
+        if (clipsLow && beta2 > 0.0)
+            return nullptr;
+        if (clipsHigh && 255.0 * alpha2 + beta2 < 255.0)
+            return nullptr;
+
+        Node *merged = new Node(QImage(), QPoint(), "Brightness", label(first) + "+" + label(second));
+        merged->getProperty("contrast")->setValue((alpha1 * alpha2 - 1.0) * 100.0);
+        merged->getProperty("brightness")->setValue(alpha2 * beta1 + beta2);
+        return adopt(merged, plan);
+    }
+    else if (kind == Node::Kind::Rotate)
+    {
+        // Quarter turns are exact, so two of them are one; free angles would resample twice
+        if (!isQuarterTurn(first) || !isQuarterTurn(second))
+            return nullptr;
+
+        Node *merged = new Node(QImage(), QPoint(), "Rotate", label(first) + "+" + label(second));
+        merged->getProperty("angle")->setValue(std::fmod(number(first, "angle") + number(second, "angle"), 360.0));
+        return adopt(merged, plan);
+    }
+
+    return nullptr;
+}
+
+Node *GraphOptimizer::adopt(Node *node, Plan &plan)
+{
+    // Equal merges share one node, so their results share cache entries too
+    quint64 key = GraphExecutor::nodeKey(node);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<Node> shared = m_merged.value(key).lock();
+    if (shared)
+    {
+        delete node;
+    }
+    else
+    {
+        shared.reset(node);
+        m_merged.insert(key, shared);
+    }
+    plan.merged.append(shared);
+    return shared.get();
+}
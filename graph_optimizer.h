@@ -0,0 +1,49 @@
+// graph_optimizer.h
+#ifndef GRAPH_OPTIMIZER_H
+#define GRAPH_OPTIMIZER_H
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <memory>
+#include <mutex>
+#include "node.h"
+
+// Rule-based rewrites of an effect chain before it runs:
+//  - identity nodes are dropped (Brightness 0/0, Sharpen amount 0 at Contrast 1.0,
+//    blur radius 0, full-frame crops, 0x0 resizes, whole turns, repeated grayscale)
+//  - compatible neighbours are merged (Brightness pairs, quarter-turn Rotate pairs)
+//  - channel-reducing nodes move ahead of the per-channel filters before them
+// Every rule keeps the result equal up to 8-bit rounding. Plans are cached, so running
+// it for every preview tile is cheap. Merged nodes belong to the plans that use them and
+// are freed once no cached or running plan does.
+class GraphOptimizer
+{
+public:
+    GraphOptimizer() = default;
+    GraphOptimizer(const GraphOptimizer &) = delete;
+    GraphOptimizer &operator=(const GraphOptimizer &) = delete;
+
+    struct Plan
+    {
+        QList<Node *> steps;  // Optimised copy of the input chain
+        QStringList rewrites; // Rewrites applied, one line each
+        QList<std::shared_ptr<Node>> merged; // Keeps merged nodes in steps alive; hold the plan while rendering
+    };
+
+    Plan optimize(const QList<Node *> &steps);
+
+private:
+    Plan plan(const QList<Node *> &steps);
+    static bool isIdentity(Node *node, Node *previous);
+    static bool reducesChannels(Node *node);
+    static bool commutesWithReduction(Node *reducer, Node *node);
+    Node *merge(Node *first, Node *second, Plan &plan);
+    Node *adopt(Node *node, Plan &plan);
+
+    std::mutex m_mutex;            // Guards the plans and merged nodes below
+    QHash<quint64, Plan> m_plans;  // By the identity and parameters of the input chain
+    QHash<quint64, std::weak_ptr<Node>> m_merged; // Merged nodes in use, by their parameters
+};
+
+#endif // GRAPH_OPTIMIZER_H
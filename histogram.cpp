@@ -0,0 +1,158 @@
+// histogram.cpp
+#include "histogram.h"
+#include "content_hash.h"
+#include <QHash>
+#include <algorithm>
+#include <mutex>
+
+namespace
+{
+    // Histograms are small, but one per distinct input adds up over a long session
+    const int MaxEntries = 64;
+
+    std::mutex cacheMutex; // Guards the two caches below
+    QHash<quint64, std::shared_ptr<const Histogram::Counts>> countsCache;
+    QHash<quint64, std::shared_ptr<const Histogram::Tiles>> tilesCache;
+
+    template <typename T>
+    std::shared_ptr<const T> cached(const QHash<quint64, std::shared_ptr<const T>> &cache, quint64 key)
+    {
+        if (key == 0)
+            return nullptr;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return cache.value(key);
+    }
+
+    template <typename T>
+    void remember(QHash<quint64, std::shared_ptr<const T>> &cache, quint64 key, const std::shared_ptr<const T> &value)
+    {
+        if (key == 0)
+            return;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (cache.size() >= MaxEntries)
+            cache.clear();
+        cache.insert(key, value);
+    }
+
+    // Counts one row into bins laid out as in Histogram::Counts
+    void countRow(const uchar *p, int width, int channels, quint64 *bins)
+    {
+        using Histogram::Levels;
+        if (channels == 1)
+        {
+            for (int x = 0; x < width; ++x)
+                ++bins[p[x]];
+            return;
+        }
+
+        quint64 *blue = bins;
+        quint64 *green = bins + Levels;
+        quint64 *red = bins + 2 * Levels;
+        quint64 *luma = bins + 3 * Levels;
+        for (int x = 0; x < width; ++x, p += channels)
+        {
+            if (channels == 4 && p[3] == 0)
+                continue; // Colour under full transparency is arbitrary
+            ++blue[p[0]];
+            ++green[p[1]];
+            ++red[p[2]];
+            ++luma[Histogram::luma(p[0], p[1], p[2])];
+        }
+    }
+}
+
+std::shared_ptr<const Histogram::Counts> Histogram::count(const cv::Mat &image, quint64 key)
+{
+    if (std::shared_ptr<const Counts> hit = cached(countsCache, key))
+        return hit;
+
+    const int channels = image.channels();
+    const size_t tableSize = (channels == 1 ? 1 : 4) * Levels;
+
+    // One partial table per band; bands outnumber threads a little to balance the load
+    const int bands = qMax(1, qMin(image.rows, 4 * cv::getNumThreads()));
+    std::vector<quint64> partials(size_t(bands) * tableSize, 0);
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range)
+                      {
+        for (int band = range.start; band < range.end; ++band)
+        {
+            quint64 *bins = partials.data() + size_t(band) * tableSize;
+            const int yEnd = int(qint64(image.rows) * (band + 1) / bands);
+            for (int y = int(qint64(image.rows) * band / bands); y < yEnd; ++y)
+                countRow(image.ptr<uchar>(y), image.cols, channels, bins);
+        } });
+
+    auto counts = std::make_shared<Counts>();
+    counts->channels = channels == 1 ? 1 : 3;
+    counts->bins.assign(tableSize, 0);
+    for (int band = 0; band < bands; ++band)
+    {
+        const quint64 *bins = partials.data() + size_t(band) * tableSize;
+        for (size_t i = 0; i < tableSize; ++i)
+            counts->bins[i] += bins[i];
+    }
+    const quint64 *luma = counts->luma();
+    for (int v = 0; v < Levels; ++v)
+        counts->pixels += luma[v];
+
+    std::shared_ptr<const Counts> result = counts;
+    remember(countsCache, key, result);
+    return result;
+}
+
+std::shared_ptr<const Histogram::Tiles> Histogram::countTiles(const cv::Mat &image, int columns, int rows, quint64 key)
+{
+    columns = qBound(1, columns, qMax(1, image.cols));
+    rows = qBound(1, rows, qMax(1, image.rows));
+    if (key != 0)
+    {
+        key = ContentHash::combine(ContentHash::string("tiles", key), static_cast<quint64>(columns));
+        key = ContentHash::combine(key, static_cast<quint64>(rows));
+    }
+    if (std::shared_ptr<const Tiles> hit = cached(tilesCache, key))
+        return hit;
+
+    auto tiles = std::make_shared<Tiles>();
+    tiles->columns = columns;
+    tiles->rows = rows;
+    tiles->bins.assign(size_t(columns) * rows * Levels, 0);
+
+    // A row of tiles belongs to one thread, so its counters are never shared
+    const int channels = image.channels();
+    std::vector<int> tileOf(image.cols);
+    for (int i = 0; i < columns; ++i)
+    {
+        const int xEnd = int(qint64(image.cols) * (i + 1) / columns);
+        for (int x = int(qint64(image.cols) * i / columns); x < xEnd; ++x)
+            tileOf[x] = i;
+    }
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+                      {
+        for (int j = range.start; j < range.end; ++j)
+        {
+            quint32 *rowBins = tiles->bins.data() + size_t(j) * columns * Levels;
+            const int yEnd = int(qint64(image.rows) * (j + 1) / rows);
+            for (int y = int(qint64(image.rows) * j / rows); y < yEnd; ++y)
+            {
+                const uchar *p = image.ptr<uchar>(y);
+                for (int x = 0; x < image.cols; ++x, p += channels)
+                {
+                    if (channels == 4 && p[3] == 0)
+                        continue;
+                    int level = channels == 1 ? p[0] : luma(p[0], p[1], p[2]);
+                    ++rowBins[tileOf[x] * Levels + level];
+                }
+            }
+        } });
+
+    std::shared_ptr<const Tiles> result = tiles;
+    remember(tilesCache, key, result);
+    return result;
+}
+
+void Histogram::clearCache()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    countsCache.clear();
+    tilesCache.clear();
+}
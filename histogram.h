@@ -0,0 +1,54 @@
+// histogram.h
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <opencv2/opencv.hpp>
+#include <QtGlobal>
+#include <memory>
+#include <vector>
+
+// Level statistics of 8-bit images for the automatic tone nodes. Each thread counts a
+// band of rows into its own table and the tables are summed afterwards, so no counter is
+// shared between threads. Results are cached by the key of the image they were counted
+// from: changing a node's own parameters, or re-rendering the same input, counts nothing.
+namespace Histogram
+{
+    const int Levels = 256;
+
+    struct Counts
+    {
+        int channels = 0;          // Colour channels counted: 1 (gray) or 3 (B, G, R)
+        quint64 pixels = 0;        // Pixels counted; fully transparent ones are skipped
+        std::vector<quint64> bins; // Levels per colour channel, then Levels of luma for colour
+
+        const quint64 *channel(int c) const { return bins.data() + c * Levels; }
+        const quint64 *luma() const { return channels == 1 ? bins.data() : bins.data() + 3 * Levels; }
+    };
+
+    // Luma counts of a grid of tiles; tile (i, j) covers columns [cols * i / columns,
+    // cols * (i + 1) / columns) and the rows likewise
+    struct Tiles
+    {
+        int columns = 0;
+        int rows = 0;
+        std::vector<quint32> bins; // Levels per tile, row by row
+
+        const quint32 *tile(int column, int row) const { return bins.data() + (row * columns + column) * Levels; }
+    };
+
+    // Rec. 601 luma in 8-bit fixed point; the weights sum to 256
+    inline int luma(int b, int g, int r)
+    {
+        return (29 * b + 150 * g + 77 * r + 128) >> 8;
+    }
+
+    // Histograms of a gray, BGR or BGRA image. key identifies the image's contents;
+    // 0 counts without caching.
+    std::shared_ptr<const Counts> count(const cv::Mat &image, quint64 key = 0);
+    std::shared_ptr<const Tiles> countTiles(const cv::Mat &image, int columns, int rows, quint64 key = 0);
+
+    // Drop every cached histogram
+    void clearCache();
+}
+
+#endif // HISTOGRAM_H
@@ -1,62 +1,395 @@
 // image_processor.cpp
 #include "image_processor.h"
+#include "autotuner.h"
+#include "convolution.h"
+#include "expression.h"
+#include "histogram.h"
+#include "lut3d.h"
+#include "metrics.h"
 #include <QDebug>
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    thread_local bool premultipliedOnThread = false;
+
+    // Halo of nodes that need the whole frame; regions grown by it cover any image
+    const int FullFrameHalo = 1 << 20;
+
+    // Up to this radius a direct bilateral window is cheaper than a grid
+    const int SmallBilateralRadius = 3;
+
+    // OpenCV's constant-time median counts a window in 16-bit histogram bins
+    const int MaxMedianRadius = 127;
+
+    // Gray colour with the input's alpha, for 4-channel inputs
+    cv::Mat withAlpha(const cv::Mat &gray, const cv::Mat &input)
+    {
+        cv::Mat opacity;
+        cv::extractChannel(input, opacity, 3);
+        cv::Mat outputImage;
+        cv::merge(std::vector<cv::Mat>{gray, gray, gray, opacity}, outputImage);
+        return outputImage;
+    }
+}
+
+ImageProcessor::AlphaMode ImageProcessor::alphaMode(Node *sourceNode)
+{
+    NodeProperty *alphaProp = sourceNode ? sourceNode->getProperty("alpha") : nullptr;
+    QString mode = alphaProp ? alphaProp->toString() : QString();
+    if (mode == "Straight")
+        return AlphaMode::Straight;
+    if (mode == "Premultiplied")
+        return AlphaMode::Premultiplied;
+    return AlphaMode::Ignore;
+}
+
+ImageProcessor::PremultipliedScope::PremultipliedScope(bool premultiplied)
+    : m_previous(premultipliedOnThread)
+{
+    premultipliedOnThread = premultiplied;
+}
+
+ImageProcessor::PremultipliedScope::~PremultipliedScope()
+{
+    premultipliedOnThread = m_previous;
+}
+
+bool ImageProcessor::premultipliedAlpha()
+{
+    return premultipliedOnThread;
+}
 
 
-cv::Mat ImageProcessor::processNode(Node *node, const cv::Mat &inputImage)
+cv::Mat ImageProcessor::processNode(Node *node, const cv::Mat &inputImage, double scale, const cv::Mat &gaussian,
+                                    quint64 inputKey, const cv::Point &origin, const cv::Size &frameSize)
 {
     if (!node || inputImage.empty())
         return inputImage;
 
+    const Node::Kind kind = node->kind();
+    Metrics::NodeTimer timer(node->getType(), inputImage.total() * inputImage.elemSize());
+
+    // Geometric nodes; a crop is a view into the input, not a copy
+    if (kind == Node::Kind::Crop)
+    {
+        return applyCrop(inputImage, cropRect(node, inputImage.size(), scale));
+    }
+    else if (kind == Node::Kind::Resize)
+    {
+        QString interpolation = node->getProperty("interpolation")->toString();
+        return applyResize(inputImage, outputSize(node, inputImage.size(), scale), interpolation);
+    }
+    else if (kind == Node::Kind::Rotate)
+    {
+        return applyRotate(inputImage, node->getProperty("angle")->toDouble());
+    }
+
+    // Smoothing filters read the input directly and write a new image
+    if (kind == Node::Kind::Bilateral)
+    {
+        int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+        return applyBilateral(inputImage, radius, node->getProperty("range")->toDouble());
+    }
+    else if (kind == Node::Kind::GuidedFilter)
+    {
+        int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+        return applyGuidedFilter(inputImage, radius, node->getProperty("smoothing")->toDouble());
+    }
+
+    // Rank filters also write a new image
+    if (kind == Node::Kind::Median)
+    {
+        return applyMedian(inputImage, scaledRadius(node->getProperty("radius")->toInt(), scale));
+    }
+    else if (kind == Node::Kind::Morphology)
+    {
+        int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+        return applyMorphology(inputImage, node->getProperty("operation")->toString(), radius);
+    }
+
+    else if (kind == Node::Kind::Lut3D)
+    {
+        QString lutPath = node->getProperty("lutPath")->toString();
+        return applyLut3D(inputImage, lutPath, node->getProperty("interpolation")->toString());
+    }
+
+    else if (kind == Node::Kind::Convolution)
+    {
+        QString kernel = node->getProperty("kernel")->toString();
+        bool normalize = node->getProperty("normalize")->toBool();
+        return applyConvolution(inputImage, kernel, normalize, node->getProperty("offset")->toDouble());
+    }
+    else if (kind == Node::Kind::Expression)
+    {
+        QString expression = node->getProperty("expression")->toString();
+        double p1 = node->getProperty("p1")->toDouble();
+        double p2 = node->getProperty("p2")->toDouble();
+        return applyExpression(inputImage, expression, p1, p2, scale, origin, frameSize);
+    }
+
+    // Automatic tone nodes measure the whole input before mapping it
+    if (kind == Node::Kind::AutoLevels)
+    {
+        bool perChannel = node->getProperty("channels")->toString() == "Per Channel";
+        return applyAutoLevels(inputImage, node->getProperty("clip")->toDouble(), perChannel, inputKey);
+    }
+    else if (kind == Node::Kind::HistogramEqualize)
+    {
+        return applyEqualize(inputImage, node->getProperty("amount")->toInt(), inputKey);
+    }
+    else if (kind == Node::Kind::Clahe)
+    {
+        double clipLimit = node->getProperty("clipLimit")->toDouble();
+        return applyClahe(inputImage, clipLimit, node->getProperty("tiles")->toInt(), inputKey);
+    }
+
     cv::Mat resultImage = inputImage.clone();
-    const QString nodeType = node->getType();
 
-    if (nodeType == "Blur")
+    if (kind == Node::Kind::Blur)
     {
-        int radius = node->getProperty("radius")->getValue().toInt();
-        QString blurType = node->getProperty("blurType")->getValue().toString();
+        int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+        QString blurType = node->getProperty("blurType")->toString();
         return applyBlur(resultImage, radius, blurType);
     }
-    else if (nodeType == "Brightness")
+    else if (kind == Node::Kind::Brightness)
     {
-        int brightness = node->getProperty("brightness")->getValue().toInt();
-        int contrast = node->getProperty("contrast")->getValue().toInt();
+        // Fractional values come from Brightness nodes merged by the graph optimizer
+        double brightness = node->getProperty("brightness")->toDouble();
+        double contrast = node->getProperty("contrast")->toDouble();
         return applyBrightnessContrast(resultImage, brightness, contrast);
     }
-    else if (nodeType == "Grayscale")
+    else if (kind == Node::Kind::Grayscale)
     {
-        QString method = node->getProperty("method")->getValue().toString();
+        QString method = node->getProperty("method")->toString();
         return applyGrayscale(resultImage, method);
     }
-    else if (nodeType == "Sharpen")
+    else if (kind == Node::Kind::Sharpen)
     {
-        int amount = node->getProperty("amount")->getValue().toInt();
-        double contrast = node->getProperty("Contrast")->getValue().toDouble();
-        resultImage = applySharpen(resultImage, amount);
+        int amount = node->getProperty("amount")->toInt();
+        double contrast = node->getProperty("Contrast")->toDouble();
+        QString mode = node->getProperty("mode")->toString();
+        if (mode == "Unsharp Mask")
+        {
+            int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+            cv::Mat blurred = gaussian.empty() ? applyBlur(inputImage, radius, "Uniform") : gaussian;
+            resultImage = applyUnsharpMask(inputImage, blurred, amount);
+        }
+        else
+        {
+            // The 3x3 kernel covers more of the picture at lower resolutions, so weaken it
+            resultImage = applySharpen(resultImage, qRound(amount * scale));
+        }
 
-        // Apply contrast after sharpening
+        // Apply contrast after sharpening; the default 1.0 needs no extra pass
+        if (contrast == 1.0)
+            return resultImage;
         cv::Mat contrastImage;
         resultImage.convertTo(contrastImage, -1, contrast, 0);
         return contrastImage;
     }
     // In the processNode function, add this case:
-    else if (nodeType == "Color Channel Splitter")
+    else if (kind == Node::Kind::ChannelSplitter)
     {
-        int channelIndex = node->getProperty("channelIndex")->getValue().toInt();
-        bool grayscale = node->getProperty("grayscaleOutput")->getValue().toBool();
+        int channelIndex = node->getProperty("channelIndex")->toInt();
+        bool grayscale = node->getProperty("grayscaleOutput")->toBool();
         return applyChannelSplit(resultImage, channelIndex, grayscale);
     }
 
     return resultImage;
 }
 
+int ImageProcessor::scaledRadius(int radius, double scale)
+{
+    return qMax(0, qRound(radius * scale));
+}
+
+int ImageProcessor::nodeHalo(Node *node, double scale)
+{
+    const Node::Kind kind = node->kind();
+
+    if (kind == Node::Kind::Blur)
+    {
+        return scaledRadius(node->getProperty("radius")->toInt(), scale);
+    }
+    else if (kind == Node::Kind::Sharpen)
+    {
+        if (node->getProperty("mode")->toString() == "Unsharp Mask")
+            return scaledRadius(node->getProperty("radius")->toInt(), scale);
+        return 1; // 3x3 kernel
+    }
+    else if (kind == Node::Kind::GuidedFilter)
+    {
+        return 2 * scaledRadius(node->getProperty("radius")->toInt(), scale); // Two box filters
+    }
+    else if (kind == Node::Kind::Median)
+    {
+        return scaledRadius(node->getProperty("radius")->toInt(), scale);
+    }
+    else if (kind == Node::Kind::Morphology)
+    {
+        // Open, Close and the hats chain two passes
+        int radius = scaledRadius(node->getProperty("radius")->toInt(), scale);
+        QString operation = node->getProperty("operation")->toString();
+        return (operation == "Erode" || operation == "Dilate") ? radius : 2 * radius;
+    }
+    else if (kind == Node::Kind::Bilateral)
+    {
+        // The grid is laid out from the image origin, so a region would not line up with it
+        return FullFrameHalo;
+    }
+    else if (kind == Node::Kind::Convolution)
+    {
+        // The kernel is anchored at its centre
+        QString kernel = node->getProperty("kernel")->toString();
+        bool normalize = node->getProperty("normalize")->toBool();
+        std::shared_ptr<const Convolution::Kernel> parsed = Convolution::parse(kernel, normalize);
+        return parsed ? qMax(parsed->weights.cols, parsed->weights.rows) / 2 : 0;
+    }
+    else if (kind == Node::Kind::AutoLevels || kind == Node::Kind::HistogramEqualize || kind == Node::Kind::Clahe)
+    {
+        // Statistics of a region would differ from those of the frame
+        return FullFrameHalo;
+    }
+
+    return 0;
+}
+
+bool ImageProcessor::isGeometric(Node *node)
+{
+    const Node::Kind kind = node->kind();
+    return kind == Node::Kind::Crop || kind == Node::Kind::Resize || kind == Node::Kind::Rotate;
+}
+
+bool ImageProcessor::commutesWithScale(Node *node)
+{
+    const Node::Kind kind = node->kind();
+    if (kind == Node::Kind::Sharpen)
+        return node->getProperty("mode")->toString() == "Unsharp Mask";
+    return kind == Node::Kind::Blur || kind == Node::Kind::Brightness || kind == Node::Kind::Grayscale ||
+           kind == Node::Kind::ChannelSplitter || kind == Node::Kind::Bilateral || kind == Node::Kind::GuidedFilter ||
+           kind == Node::Kind::Median || kind == Node::Kind::Morphology || kind == Node::Kind::Lut3D || kind == Node::Kind::Expression ||
+           kind == Node::Kind::AutoLevels ||
+           kind == Node::Kind::HistogramEqualize || kind == Node::Kind::Clahe || isGeometric(node);
+}
+
+cv::Rect ImageProcessor::cropRect(Node *node, const cv::Size &inputSize, double scale)
+{
+    int x = qRound(node->getProperty("x")->toInt() * scale);
+    int y = qRound(node->getProperty("y")->toInt() * scale);
+    int width = qRound(node->getProperty("width")->toInt() * scale);
+    int height = qRound(node->getProperty("height")->toInt() * scale);
+
+    // A width or height of 0 extends the crop to the image edge
+    cv::Rect rect(x, y, width > 0 ? width : inputSize.width - x, height > 0 ? height : inputSize.height - y);
+    rect &= cv::Rect(0, 0, inputSize.width, inputSize.height);
+    if (rect.area() == 0)
+        return cv::Rect(0, 0, inputSize.width, inputSize.height); // Nothing left: leave the image as is
+    return rect;
+}
+
+cv::Size ImageProcessor::outputSize(Node *node, const cv::Size &inputSize, double scale)
+{
+    const Node::Kind kind = node->kind();
+    if (kind == Node::Kind::Crop)
+    {
+        return cropRect(node, inputSize, scale).size();
+    }
+    else if (kind == Node::Kind::Resize)
+    {
+        int width = qRound(node->getProperty("width")->toInt() * scale);
+        int height = qRound(node->getProperty("height")->toInt() * scale);
+
+        // A width or height of 0 keeps the aspect ratio; both 0 keep the size
+        if (width <= 0 && height <= 0)
+            return inputSize;
+        if (width <= 0)
+            width = qRound(double(height) * inputSize.width / inputSize.height);
+        if (height <= 0)
+            height = qRound(double(width) * inputSize.height / inputSize.width);
+        return cv::Size(qMax(1, width), qMax(1, height));
+    }
+    else if (kind == Node::Kind::Rotate)
+    {
+        double angle = node->getProperty("angle")->toDouble();
+        double radians = angle * CV_PI / 180.0;
+        double c = std::abs(std::cos(radians));
+        double s = std::abs(std::sin(radians));
+        return cv::Size(qMax(1, qRound(inputSize.width * c + inputSize.height * s)),
+                        qMax(1, qRound(inputSize.width * s + inputSize.height * c)));
+    }
+    return inputSize;
+}
+
+cv::Mat ImageProcessor::applyCrop(const cv::Mat &inputImage, const cv::Rect &rect)
+{
+    // Shares the input's pixels; downstream nodes allocate their own output
+    return inputImage(rect & cv::Rect(0, 0, inputImage.cols, inputImage.rows));
+}
+
+cv::Mat ImageProcessor::applyResize(const cv::Mat &inputImage, const cv::Size &size, const QString &interpolation)
+{
+    if (size == inputImage.size())
+        return inputImage;
+
+    int flag = cv::INTER_AREA;
+    if (interpolation == "Linear")
+        flag = cv::INTER_LINEAR;
+    else if (interpolation == "Cubic")
+        flag = cv::INTER_CUBIC;
+    else if (interpolation == "Nearest")
+        flag = cv::INTER_NEAREST;
+    else if (size.width > inputImage.cols || size.height > inputImage.rows)
+        flag = cv::INTER_LINEAR; // Area averaging only makes sense when shrinking
+
+    cv::Mat outputImage;
+    cv::resize(inputImage, outputImage, size, 0, 0, flag);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyRotate(const cv::Mat &inputImage, double angle)
+{
+    // Quarter turns are exact pixel moves
+    double turns = std::fmod(std::fmod(angle, 360.0) + 360.0, 360.0);
+    cv::Mat outputImage;
+    if (turns == 0.0)
+        return inputImage;
+    if (turns == 90.0)
+        cv::rotate(inputImage, outputImage, cv::ROTATE_90_COUNTERCLOCKWISE);
+    else if (turns == 180.0)
+        cv::rotate(inputImage, outputImage, cv::ROTATE_180);
+    else if (turns == 270.0)
+        cv::rotate(inputImage, outputImage, cv::ROTATE_90_CLOCKWISE);
+    else
+    {
+        // Counter-clockwise about the centre, on a canvas large enough for the corners
+        double radians = angle * CV_PI / 180.0;
+        double c = std::abs(std::cos(radians));
+        double s = std::abs(std::sin(radians));
+        cv::Size size(qMax(1, qRound(inputImage.cols * c + inputImage.rows * s)),
+                      qMax(1, qRound(inputImage.cols * s + inputImage.rows * c)));
+
+        cv::Point2f centre((inputImage.cols - 1) / 2.0f, (inputImage.rows - 1) / 2.0f);
+        cv::Mat matrix = cv::getRotationMatrix2D(centre, angle, 1.0);
+        matrix.at<double>(0, 2) += (size.width - inputImage.cols) / 2.0;
+        matrix.at<double>(1, 2) += (size.height - inputImage.rows) / 2.0;
+        cv::warpAffine(inputImage, outputImage, matrix, size, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    }
+    return outputImage;
+}
+
 cv::Mat ImageProcessor::applyBlur(const cv::Mat &inputImage, int radius, const QString &blurType)
 {
     cv::Mat outputImage;
 
     if (blurType == "Uniform")
     {
-        cv::GaussianBlur(inputImage, outputImage, cv::Size(2 * radius + 1, 2 * radius + 1), 0);
+        const char *decision = radius <= 8 ? "blur.gaussian.small" : "blur.gaussian.large";
+        int method = Autotuner::choice(decision, Autotuner::bucket(inputImage.size()), int(GaussianMethod::Library));
+        outputImage = applyGaussian(inputImage, radius, GaussianMethod(method));
     }
     else if (blurType == "Directional")
     {
@@ -69,29 +402,71 @@ cv::Mat ImageProcessor::applyBlur(const cv::Mat &inputImage, int radius, const Q
     return outputImage;
 }
 
-cv::Mat ImageProcessor::applyBrightnessContrast(const cv::Mat &inputImage, int brightness, int contrast)
+cv::Mat ImageProcessor::applyGaussian(const cv::Mat &inputImage, int radius, GaussianMethod method)
+{
+    const int size = 2 * radius + 1;
+    cv::Mat outputImage;
+    if (method == GaussianMethod::Separable)
+    {
+        // Same sigma for the size as GaussianBlur derives
+        cv::Mat kernel = cv::getGaussianKernel(size, 0, CV_32F);
+        cv::sepFilter2D(inputImage, outputImage, -1, kernel, kernel);
+        return outputImage;
+    }
+    cv::GaussianBlur(inputImage, outputImage, cv::Size(size, size), 0);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyBrightnessContrast(const cv::Mat &inputImage, double brightness, double contrast)
 {
     cv::Mat outputImage;
     double alpha = 1.0 + contrast / 100.0; // Contrast factor
     double beta = brightness;              // Brightness offset
 
-    inputImage.convertTo(outputImage, -1, alpha, beta);
+    if (inputImage.channels() != 4)
+    {
+        inputImage.convertTo(outputImage, -1, alpha, beta);
+        return outputImage;
+    }
+
+    // Only the colour changes; opacity is kept
+    cv::Mat opacity;
+    cv::extractChannel(inputImage, opacity, 3);
+    if (premultipliedAlpha())
+    {
+        // Premultiplied colour C = c * A becomes alpha * C + beta * A, and never exceeds A
+        cv::Mat opacity4;
+        cv::merge(std::vector<cv::Mat>(4, opacity), opacity4);
+        cv::Mat colour, offset;
+        inputImage.convertTo(colour, CV_32F, alpha);
+        opacity4.convertTo(offset, CV_32F, beta / 255.0);
+        cv::Mat sum = colour + offset;
+        sum.convertTo(outputImage, CV_8U);
+        cv::min(outputImage, opacity4, outputImage);
+    }
+    else
+    {
+        inputImage.convertTo(outputImage, -1, alpha, beta);
+    }
+    cv::insertChannel(opacity, outputImage, 3);
     return outputImage;
 }
 
 cv::Mat ImageProcessor::applyGrayscale(const cv::Mat &inputImage, const QString &method)
 {
+    // The result stays single-channel; it is expanded only where a consumer needs colour
+    if (inputImage.channels() == 1)
+        return inputImage;
+
     cv::Mat outputImage;
 
     if (method == "Average")
     {
-        cv::cvtColor(inputImage, outputImage, cv::COLOR_BGR2GRAY);
-        cv::cvtColor(outputImage, outputImage, cv::COLOR_GRAY2BGR); // Convert back to 3 channels
+        cv::cvtColor(inputImage, outputImage, inputImage.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
     }
     else if (method == "Luminosity")
     {
-        cv::cvtColor(inputImage, outputImage, cv::COLOR_BGR2GRAY);
-        cv::cvtColor(outputImage, outputImage, cv::COLOR_GRAY2BGR);
+        cv::cvtColor(inputImage, outputImage, inputImage.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
     }
     else if (method == "Lightness")
     {
@@ -106,10 +481,12 @@ cv::Mat ImageProcessor::applyGrayscale(const cv::Mat &inputImage, const QString
         cv::min(channels[0], channels[1], minVal);
         cv::min(minVal, channels[2], minVal);
 
-        cv::Mat lightness = (maxVal + minVal) / 2;
-        cv::cvtColor(lightness, outputImage, cv::COLOR_GRAY2BGR);
+        outputImage = (maxVal + minVal) / 2;
     }
 
+    // Transparency survives; the weights are linear, so this holds for premultiplied colour too
+    if (inputImage.channels() == 4 && !outputImage.empty())
+        return withAlpha(outputImage, inputImage);
     return outputImage;
 }
 
@@ -127,8 +504,656 @@ cv::Mat ImageProcessor::applySharpen(const cv::Mat &inputImage, int amount)
     return outputImage;
 }
 
-cv::Mat ImageProcessor::QImageToCvMat(const QImage &image)
+cv::Mat ImageProcessor::applyUnsharpMask(const cv::Mat &inputImage, const cv::Mat &blurredImage, int amount)
 {
+    cv::Mat outputImage;
+
+    // output = input + k * (input - blurred), with the same amount scale as the kernel mode
+    double k = amount / 50.0;
+    cv::addWeighted(inputImage, 1.0 + k, blurredImage, -k, 0, outputImage);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyGuidedFilter(const cv::Mat &inputImage, int radius, double smoothing)
+{
+    if (radius <= 0 || smoothing <= 0.0)
+        return inputImage;
+
+    // Self-guided filter (He et al.): every step is a box filter or pointwise, so the cost
+    // per pixel does not depend on the radius. Each channel guides itself.
+    const double eps = smoothing * smoothing;
+    const cv::Size box(2 * radius + 1, 2 * radius + 1);
+
+    // Two chained box filters read 2 * radius rows around each output row, so strips with
+    // that much overlap are independent and produce the same pixels as one pass
+    const int halo = 2 * radius;
+    const int stripRows = qMax(qMax(32, halo), inputImage.rows / qMax(1, 4 * cv::getNumThreads()));
+    const int strips = (inputImage.rows + stripRows - 1) / stripRows;
+
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range)
+                      {
+        for (int s = range.start; s < range.end; ++s)
+        {
+            const int y0 = s * stripRows;
+            const int y1 = qMin(inputImage.rows, y0 + stripRows);
+            const int top = qMax(0, y0 - halo);
+            const int bottom = qMin(inputImage.rows, y1 + halo);
+
+            cv::Mat guide;
+            inputImage.rowRange(top, bottom).convertTo(guide, CV_32F);
+
+            cv::Mat mean, meanSquare;
+            cv::boxFilter(guide, mean, CV_32F, box);
+            cv::boxFilter(guide.mul(guide), meanSquare, CV_32F, box);
+
+            // Flat areas (variance well below eps) take the local mean; edges keep the input
+            cv::Mat variance = meanSquare - mean.mul(mean);
+            cv::Mat a, b;
+            cv::divide(variance, variance + cv::Scalar::all(eps), a);
+            b = mean - a.mul(mean);
+            cv::boxFilter(a, a, CV_32F, box);
+            cv::boxFilter(b, b, CV_32F, box);
+
+            cv::Mat result = a.mul(guide) + b;
+            cv::Mat target = outputImage.rowRange(y0, y1);
+            result.rowRange(y0 - top, y1 - top).convertTo(target, inputImage.depth());
+        } });
+
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyBilateral(const cv::Mat &inputImage, int radius, double range)
+{
+    if (radius <= 0 || range <= 0.0)
+        return inputImage;
+
+    const int channels = inputImage.channels();
+    if (radius <= SmallBilateralRadius)
+    {
+        // A 7x7 window is cheaper than building a grid with one cell per pixel
+        if (channels != 4)
+        {
+            cv::Mat outputImage;
+            cv::bilateralFilter(inputImage, outputImage, 2 * radius + 1, range, radius);
+            return outputImage;
+        }
+        cv::Mat bgr, smoothed, opacity, outputImage;
+        cv::cvtColor(inputImage, bgr, cv::COLOR_BGRA2BGR);
+        cv::bilateralFilter(bgr, smoothed, 2 * radius + 1, range, radius);
+        cv::extractChannel(inputImage, opacity, 3);
+        cv::merge(std::vector<cv::Mat>{smoothed, opacity}, outputImage);
+        return outputImage;
+    }
+
+    // Bilateral grid (Chen, Paris and Durand): pixels are splatted into a coarse
+    // (y, x, intensity) grid with one cell per radius and per range, the grid is blurred,
+    // and each pixel reads its value back by trilinear interpolation. The grid shrinks as
+    // the radius grows, so the cost per pixel stays constant.
+    cv::Mat guide;
+    if (channels == 1)
+        guide = inputImage;
+    else
+        cv::cvtColor(inputImage, guide, channels == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+
+    const double cell = radius;
+    const double depthCell = range;
+    const int pad = 2; // Room for the 5-tap blur at the x and intensity edges
+    const int stride = channels + 1; // Channel sums, then the pixel count
+    const int gridWidth = int((inputImage.cols - 1) / cell) + 2 + 2 * pad;
+    const int gridDepth = int(255.0 / depthCell) + 2 + 2 * pad;
+    const int gridRows = int((inputImage.rows - 1) / cell) + 1;
+    const float weights[5] = {1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16};
+
+    std::vector<int> columnCell(inputImage.cols);
+    for (int x = 0; x < inputImage.cols; ++x)
+        columnCell[x] = int(x / cell + 0.5) + pad;
+
+    // Bands of grid rows are independent once they carry the two rows of blur support
+    // above and below plus one for interpolation; this also bounds memory per thread
+    const int bandCells = qMax(4, gridRows / qMax(1, 4 * cv::getNumThreads()));
+    const int bands = (gridRows + bandCells - 1) / bandCells;
+
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &bandRange)
+                      {
+        for (int band = bandRange.start; band < bandRange.end; ++band)
+        {
+            const int k0 = band * bandCells;
+            const int k1 = qMin(gridRows, k0 + bandCells);
+            const int first = k0 - 2;                // Grid row of local row 0
+            const int height = k1 - k0 + 5;
+            const size_t rowFloats = size_t(gridWidth) * gridDepth * stride;
+            std::vector<float> grid(size_t(height) * rowFloats, 0.0f);
+            std::vector<float> temp(grid.size());
+
+            // Splat every pixel whose nearest grid row falls in the band
+            const int yFrom = qMax(0, int((first - 0.5) * cell) - 1);
+            const int yTo = qMin(inputImage.rows, int((first + height - 0.5) * cell) + 2);
+            for (int y = yFrom; y < yTo; ++y)
+            {
+                const int gy = int(y / cell + 0.5) - first;
+                if (gy < 0 || gy >= height)
+                    continue;
+                const uchar *src = inputImage.ptr<uchar>(y);
+                const uchar *g = guide.ptr<uchar>(y);
+                float *row = &grid[size_t(gy) * rowFloats];
+                for (int x = 0; x < inputImage.cols; ++x)
+                {
+                    const int gz = int(g[x] / depthCell + 0.5) + pad;
+                    float *c = row + (size_t(columnCell[x]) * gridDepth + gz) * stride;
+                    for (int ch = 0; ch < channels; ++ch)
+                        c[ch] += src[x * channels + ch];
+                    c[channels] += 1.0f;
+                }
+            }
+
+            // Separable [1 4 6 4 1] / 16 blur along intensity, x and y (in cells)
+            auto blurAxis = [&](const std::vector<float> &from, std::vector<float> &to, int axisStride, int axisLength)
+            {
+                const ptrdiff_t cells = ptrdiff_t(height) * gridWidth * gridDepth;
+                for (ptrdiff_t i = 0; i < cells; ++i)
+                {
+                    const int c = int((i / axisStride) % axisLength);
+                    float *out = &to[i * stride];
+                    std::fill(out, out + stride, 0.0f);
+                    for (int k = -2; k <= 2; ++k)
+                    {
+                        if (c + k < 0 || c + k >= axisLength)
+                            continue;
+                        const float *in = &from[(i + ptrdiff_t(k) * axisStride) * stride];
+                        for (int ch = 0; ch < stride; ++ch)
+                            out[ch] += weights[k + 2] * in[ch];
+                    }
+                }
+            };
+            blurAxis(grid, temp, 1, gridDepth);
+            blurAxis(temp, grid, gridDepth, gridWidth);
+            blurAxis(grid, temp, gridWidth * gridDepth, height);
+
+            // Slice: rows whose grid coordinate lies in [k0, k1)
+            const int sliceFrom = qMax(0, int(k0 * cell) - 1);
+            const int sliceTo = qMin(inputImage.rows, int(k1 * cell) + 2);
+            std::vector<float> acc(stride);
+            for (int y = sliceFrom; y < sliceTo; ++y)
+            {
+                const double fy = y / cell;
+                if (int(fy) < k0 || int(fy) >= k1)
+                    continue;
+                const int y0 = int(fy) - first;
+                const float wy = float(fy - int(fy));
+                const uchar *src = inputImage.ptr<uchar>(y);
+                const uchar *g = guide.ptr<uchar>(y);
+                uchar *dst = outputImage.ptr<uchar>(y);
+
+                for (int x = 0; x < inputImage.cols; ++x)
+                {
+                    const double fx = x / cell + pad;
+                    const double fz = g[x] / depthCell + pad;
+                    const int x0 = int(fx);
+                    const int z0 = int(fz);
+                    const float wx = float(fx - x0);
+                    const float wz = float(fz - z0);
+
+                    std::fill(acc.begin(), acc.end(), 0.0f);
+                    for (int dy = 0; dy < 2; ++dy)
+                    {
+                        for (int dx = 0; dx < 2; ++dx)
+                        {
+                            for (int dz = 0; dz < 2; ++dz)
+                            {
+                                const float w = (dy ? wy : 1.0f - wy) * (dx ? wx : 1.0f - wx) * (dz ? wz : 1.0f - wz);
+                                const float *c = &temp[size_t(y0 + dy) * rowFloats +
+                                                       (size_t(x0 + dx) * gridDepth + z0 + dz) * stride];
+                                for (int ch = 0; ch < stride; ++ch)
+                                    acc[ch] += w * c[ch];
+                            }
+                        }
+                    }
+
+                    for (int ch = 0; ch < channels; ++ch)
+                    {
+                        dst[x * channels + ch] = acc[channels] > 1e-6f ? cv::saturate_cast<uchar>(acc[ch] / acc[channels])
+                                                                       : src[x * channels + ch];
+                    }
+                }
+            }
+        } });
+
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyMedian(const cv::Mat &inputImage, int radius)
+{
+    if (radius <= 0)
+        return inputImage;
+    radius = qMin(radius, MaxMedianRadius);
+
+    // For apertures above 5, OpenCV's 8-bit median keeps per-column histograms and
+    // slides a window histogram across them (Perreault and Hebert), so the cost per
+    // pixel is flat in the radius. Bands overlapping by the radius run in parallel.
+    const int stripRows = qMax(qMax(64, 2 * radius), inputImage.rows / qMax(1, 4 * cv::getNumThreads()));
+    const int strips = (inputImage.rows + stripRows - 1) / stripRows;
+
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range)
+                      {
+        for (int s = range.start; s < range.end; ++s)
+        {
+            const int y0 = s * stripRows;
+            const int y1 = qMin(inputImage.rows, y0 + stripRows);
+            const int top = qMax(0, y0 - radius);
+            const int bottom = qMin(inputImage.rows, y1 + radius);
+
+            cv::Mat band = inputImage.rowRange(top, bottom).clone();
+            cv::Mat filtered;
+            cv::medianBlur(band, filtered, 2 * radius + 1);
+            filtered.rowRange(y0 - top, y1 - top).copyTo(outputImage.rowRange(y0, y1));
+        } });
+
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyMorphology(const cv::Mat &inputImage, const QString &operation, int radius)
+{
+    if (radius <= 0)
+        return inputImage;
+
+    if (operation == "Erode")
+        return rankFilter(inputImage, radius, false);
+    if (operation == "Dilate")
+        return rankFilter(inputImage, radius, true);
+
+    cv::Mat opened = rankFilter(rankFilter(inputImage, radius, false), radius, true);
+    if (operation == "Open")
+        return opened;
+    cv::Mat closed = rankFilter(rankFilter(inputImage, radius, true), radius, false);
+    if (operation == "Close")
+        return closed;
+
+    cv::Mat outputImage;
+    if (operation == "Top-hat")
+        cv::subtract(inputImage, opened, outputImage); // Bright details smaller than the window
+    else
+        cv::subtract(closed, inputImage, outputImage); // Black-hat: dark details
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::rankFilter(const cv::Mat &inputImage, int radius, bool maximum)
+{
+    // The square window is separable: filter rows, then the rows of the transpose
+    cv::Mat rows = rankFilterRows(inputImage, radius, maximum);
+    cv::Mat transposed;
+    cv::transpose(rows, transposed);
+    cv::Mat columns = rankFilterRows(transposed, radius, maximum);
+    cv::Mat outputImage;
+    cv::transpose(columns, outputImage);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::rankFilterRows(const cv::Mat &inputImage, int radius, bool maximum)
+{
+    // van Herk/Gil-Werman: split each padded line into blocks of one window width and
+    // take running extremes forwards (g) and backwards (h) within each block. Any window
+    // then spans the end of one block and the start of the next, so its extreme is
+    // max(h[x], g[x + 2r]): three comparisons per sample whatever the radius.
+    // Outside the image the line is padded with the neutral value, as cv::erode/dilate do.
+    const int width = 2 * radius + 1;
+    const int channels = inputImage.channels();
+    const int n = inputImage.cols;
+    const int padded = ((n + 2 * radius + width - 1) / width) * width;
+    const uchar neutral = maximum ? 0 : 255;
+
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, inputImage.rows), [&](const cv::Range &range)
+                      {
+        std::vector<uchar> line(padded), g(padded), h(padded);
+        auto pick = [maximum](uchar a, uchar b) { return maximum ? std::max(a, b) : std::min(a, b); };
+
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const uchar *src = inputImage.ptr<uchar>(y);
+            uchar *dst = outputImage.ptr<uchar>(y);
+            for (int c = 0; c < channels; ++c)
+            {
+                for (int i = 0; i < padded; ++i)
+                {
+                    const int x = i - radius;
+                    line[i] = (x >= 0 && x < n) ? src[x * channels + c] : neutral;
+                }
+                for (int i = 0; i < padded; ++i)
+                    g[i] = i % width == 0 ? line[i] : pick(g[i - 1], line[i]);
+                for (int i = padded - 1; i >= 0; --i)
+                    h[i] = (i % width == width - 1) ? line[i] : pick(h[i + 1], line[i]);
+                for (int x = 0; x < n; ++x)
+                    dst[x * channels + c] = pick(h[x], g[x + 2 * radius]);
+            }
+        } });
+
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::applyLut3D(const cv::Mat &inputImage, const QString &lutPath, const QString &interpolation)
+{
+    if (lutPath.isEmpty())
+        return inputImage;
+
+    QString error;
+    std::shared_ptr<const Lut3D::Lattice> lattice = Lut3D::load(lutPath, &error);
+    if (!lattice)
+    {
+        qDebug() << error;
+        return inputImage; // Return original image if the LUT can't be used
+    }
+
+    // A grade applies to colour, not to colour already multiplied by opacity
+    bool tetrahedral = interpolation != "Trilinear";
+    if (inputImage.channels() == 4 && premultipliedAlpha())
+        return premultiply(Lut3D::apply(unpremultiply(inputImage), *lattice, tetrahedral));
+    return Lut3D::apply(inputImage, *lattice, tetrahedral);
+}
+
+cv::Mat ImageProcessor::applyConvolution(const cv::Mat &inputImage, const QString &kernel, bool normalize, double offset)
+{
+    if (kernel.trimmed().isEmpty())
+        return inputImage;
+
+    QString error;
+    std::shared_ptr<const Convolution::Kernel> parsed = Convolution::parse(kernel, normalize, &error);
+    if (!parsed)
+    {
+        qDebug() << "Convolution:" << error;
+        return inputImage; // Return original image if the kernel can't be used
+    }
+
+    Convolution::Strategy strategy = Convolution::choose(*parsed, inputImage.size(), inputImage.isSubmatrix());
+    return Convolution::apply(inputImage, *parsed, offset, strategy);
+}
+
+cv::Mat ImageProcessor::applyExpression(const cv::Mat &inputImage, const QString &expression, double p1, double p2,
+                                        double scale, const cv::Point &origin, const cv::Size &frameSize)
+{
+    if (expression.trimmed().isEmpty())
+        return inputImage;
+
+    QString error;
+    std::shared_ptr<const Expression::Program> program = Expression::compile(expression, &error);
+    if (!program)
+    {
+        qDebug() << "Expression:" << error;
+        return inputImage; // Return original image if the expression can't be used
+    }
+
+    // Formulas see straight colour, as the user would write them
+    if (inputImage.channels() == 4 && premultipliedAlpha())
+        return premultiply(Expression::apply(unpremultiply(inputImage), *program, p1, p2, scale, origin, frameSize));
+    return Expression::apply(inputImage, *program, p1, p2, scale, origin, frameSize);
+}
+
+cv::Mat ImageProcessor::applyAutoLevels(const cv::Mat &inputImage, double clip, bool perChannel, quint64 inputKey)
+{
+    // Levels are measured and mapped on colour, not on colour multiplied by opacity
+    if (inputImage.channels() == 4 && premultipliedAlpha())
+    {
+        PremultipliedScope straight(false);
+        return premultiply(applyAutoLevels(unpremultiply(inputImage), clip, perChannel, inputKey));
+    }
+
+    std::shared_ptr<const Histogram::Counts> counts = Histogram::count(inputImage, inputKey);
+    if (counts->pixels == 0)
+        return inputImage;
+
+    // Darkest and brightest levels left after clipping that many pixels at each end
+    const quint64 clipped = quint64(counts->pixels * qBound(0.0, clip, 50.0) / 100.0);
+    int low[3];
+    int high[3];
+    for (int c = 0; c < counts->channels; ++c)
+    {
+        const quint64 *bins = counts->channel(c);
+        quint64 sum = 0;
+        low[c] = 0;
+        while (low[c] < 255 && (sum += bins[low[c]]) <= clipped)
+            ++low[c];
+        sum = 0;
+        high[c] = 255;
+        while (high[c] > 0 && (sum += bins[high[c]]) <= clipped)
+            --high[c];
+    }
+    if (!perChannel)
+    {
+        // One range for all channels stretches contrast without shifting the colour balance
+        for (int c = 1; c < counts->channels; ++c)
+        {
+            low[0] = qMin(low[0], low[c]);
+            high[0] = qMax(high[0], high[c]);
+        }
+        for (int c = 1; c < counts->channels; ++c)
+        {
+            low[c] = low[0];
+            high[c] = high[0];
+        }
+    }
+
+    uchar luts[3][256];
+    for (int c = 0; c < 3; ++c)
+    {
+        const int k = qMin(c, counts->channels - 1);
+        for (int v = 0; v < 256; ++v)
+            luts[c][v] = high[k] > low[k] ? cv::saturate_cast<uchar>((v - low[k]) * 255.0 / (high[k] - low[k])) : uchar(v);
+    }
+    return mapChannels(inputImage, luts);
+}
+
+cv::Mat ImageProcessor::applyEqualize(const cv::Mat &inputImage, int amount, quint64 inputKey)
+{
+    if (inputImage.channels() == 4 && premultipliedAlpha())
+    {
+        PremultipliedScope straight(false);
+        return premultiply(applyEqualize(unpremultiply(inputImage), amount, inputKey));
+    }
+
+    std::shared_ptr<const Histogram::Counts> counts = Histogram::count(inputImage, inputKey);
+    const quint64 *bins = counts->luma();
+
+    // The first occupied level maps to 0 and the rest spread by their cumulative share
+    quint64 first = 0;
+    for (int v = 0; v < 256 && first == 0; ++v)
+        first = bins[v];
+    if (counts->pixels <= first)
+        return inputImage; // A single level: nothing to spread
+
+    const double weight = qBound(0, amount, 100) / 100.0;
+    uchar lut[256];
+    quint64 sum = 0;
+    for (int v = 0; v < 256; ++v)
+    {
+        sum += bins[v];
+        double equalized = sum < first ? 0.0 : (sum - first) * 255.0 / (counts->pixels - first);
+        lut[v] = cv::saturate_cast<uchar>(v + weight * (equalized - v));
+    }
+    return mapLuma(inputImage, lut);
+}
+
+cv::Mat ImageProcessor::applyClahe(const cv::Mat &inputImage, double clipLimit, int tiles, quint64 inputKey)
+{
+    if (inputImage.channels() == 4 && premultipliedAlpha())
+    {
+        PremultipliedScope straight(false);
+        return premultiply(applyClahe(unpremultiply(inputImage), clipLimit, tiles, inputKey));
+    }
+
+    std::shared_ptr<const Histogram::Tiles> grid = Histogram::countTiles(inputImage, tiles, tiles, inputKey);
+    const int columns = grid->columns;
+    const int rows = grid->rows;
+
+    // Each tile's equalizing table, with counts above the limit spread over all levels
+    // so no level gains more than clipLimit times the mean share of contrast
+    std::vector<uchar> luts(size_t(columns) * rows * 256);
+    cv::parallel_for_(cv::Range(0, columns * rows), [&](const cv::Range &range)
+                      {
+        for (int t = range.start; t < range.end; ++t)
+        {
+            const quint32 *counts = grid->tile(t % columns, t / columns);
+            uchar *lut = luts.data() + size_t(t) * 256;
+            quint64 total = 0;
+            for (int v = 0; v < 256; ++v)
+                total += counts[v];
+            if (total == 0)
+            {
+                for (int v = 0; v < 256; ++v)
+                    lut[v] = uchar(v);
+                continue;
+            }
+
+            quint64 bins[256];
+            std::copy(counts, counts + 256, bins);
+            if (clipLimit > 0.0)
+            {
+                const quint64 limit = qMax<quint64>(1, quint64(clipLimit * total / 256.0));
+                quint64 excess = 0;
+                for (quint64 &bin : bins)
+                {
+                    if (bin > limit)
+                    {
+                        excess += bin - limit;
+                        bin = limit;
+                    }
+                }
+                const quint64 share = excess / 256;
+                quint64 remainder = excess % 256;
+                for (quint64 &bin : bins)
+                    bin += share;
+                const int step = remainder > 0 ? qMax<int>(1, int(256 / remainder)) : 256;
+                for (int v = 0; v < 256 && remainder > 0; v += step, --remainder)
+                    ++bins[v];
+            }
+
+            quint64 sum = 0;
+            for (int v = 0; v < 256; ++v)
+            {
+                sum += bins[v];
+                lut[v] = cv::saturate_cast<uchar>(sum * 255.0 / total);
+            }
+        } });
+
+    // Neighbouring tile centres and the weight of the second, per column and per row
+    struct Neighbours
+    {
+        int first;
+        int second;
+        float weight;
+    };
+    auto neighbours = [](int length, int count)
+    {
+        std::vector<Neighbours> result(length);
+        for (int i = 0; i < length; ++i)
+        {
+            float position = (i + 0.5f) * count / length - 0.5f;
+            int first = qBound(0, int(std::floor(position)), count - 1);
+            result[i] = {first, qMin(first + 1, count - 1), qBound(0.0f, position - first, 1.0f)};
+        }
+        return result;
+    };
+    const std::vector<Neighbours> across = neighbours(inputImage.cols, columns);
+    const std::vector<Neighbours> down = neighbours(inputImage.rows, rows);
+
+    const int channels = inputImage.channels();
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, inputImage.rows), [&](const cv::Range &range)
+                      {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const Neighbours &dy = down[y];
+            const uchar *top = luts.data() + size_t(dy.first) * columns * 256;
+            const uchar *bottom = luts.data() + size_t(dy.second) * columns * 256;
+            const uchar *src = inputImage.ptr<uchar>(y);
+            uchar *dst = outputImage.ptr<uchar>(y);
+            for (int x = 0; x < inputImage.cols; ++x)
+            {
+                const Neighbours &dx = across[x];
+                const uchar *p = src + x * channels;
+                const int level = channels == 1 ? p[0] : Histogram::luma(p[0], p[1], p[2]);
+                float upper = top[dx.first * 256 + level] + dx.weight * (top[dx.second * 256 + level] - top[dx.first * 256 + level]);
+                float lower = bottom[dx.first * 256 + level] + dx.weight * (bottom[dx.second * 256 + level] - bottom[dx.first * 256 + level]);
+                const int mapped = cvRound(upper + dy.weight * (lower - upper));
+
+                uchar *q = dst + x * channels;
+                if (channels == 1)
+                {
+                    q[0] = cv::saturate_cast<uchar>(mapped);
+                    continue;
+                }
+                const int delta = mapped - level;
+                q[0] = cv::saturate_cast<uchar>(p[0] + delta);
+                q[1] = cv::saturate_cast<uchar>(p[1] + delta);
+                q[2] = cv::saturate_cast<uchar>(p[2] + delta);
+                if (channels == 4)
+                    q[3] = p[3];
+            }
+        } });
+
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::mapChannels(const cv::Mat &inputImage, const uchar luts[3][256])
+{
+    const int channels = inputImage.channels();
+    cv::Mat table(1, 256, CV_8UC(channels));
+    for (int v = 0; v < 256; ++v)
+    {
+        uchar *entry = table.ptr<uchar>(0) + v * channels;
+        for (int c = 0; c < channels; ++c)
+            entry[c] = c < 3 ? luts[c][v] : uchar(v); // Alpha passes through
+    }
+    cv::Mat outputImage;
+    cv::LUT(inputImage, table, outputImage);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::mapLuma(const cv::Mat &inputImage, const uchar lut[256])
+{
+    const int channels = inputImage.channels();
+    if (channels == 1)
+    {
+        cv::Mat outputImage;
+        cv::LUT(inputImage, cv::Mat(1, 256, CV_8U, const_cast<uchar *>(lut)), outputImage);
+        return outputImage;
+    }
+
+    // Moving every channel by the luma change keeps B - Y and R - Y, i.e. Cb and Cr
+    cv::Mat outputImage(inputImage.size(), inputImage.type());
+    cv::parallel_for_(cv::Range(0, inputImage.rows), [&](const cv::Range &range)
+                      {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const uchar *p = inputImage.ptr<uchar>(y);
+            uchar *q = outputImage.ptr<uchar>(y);
+            for (int x = 0; x < inputImage.cols; ++x, p += channels, q += channels)
+            {
+                const int level = Histogram::luma(p[0], p[1], p[2]);
+                const int delta = lut[level] - level;
+                q[0] = cv::saturate_cast<uchar>(p[0] + delta);
+                q[1] = cv::saturate_cast<uchar>(p[1] + delta);
+                q[2] = cv::saturate_cast<uchar>(p[2] + delta);
+                if (channels == 4)
+                    q[3] = p[3];
+            }
+        } });
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::QImageToCvMat(const QImage &image, AlphaMode alpha)
+{
+    if (alpha != AlphaMode::Ignore && image.format() != QImage::Format_Grayscale8)
+    {
+        // ARGB32 words are B, G, R, A bytes in memory: wrap them as BGRA, copying once
+        QImage::Format format = alpha == AlphaMode::Premultiplied ? QImage::Format_ARGB32_Premultiplied
+                                                                  : QImage::Format_ARGB32;
+        QImage converted = image.format() == format ? image : image.convertToFormat(format);
+        cv::Mat mat(converted.height(), converted.width(), CV_8UC4, (void *)converted.constBits(), converted.bytesPerLine());
+        return mat.clone();
+    }
+
     switch (image.format())
     {
     case QImage::Format_RGB32:
@@ -140,6 +1165,12 @@ cv::Mat ImageProcessor::QImageToCvMat(const QImage &image)
         cv::cvtColor(mat, matRGB, cv::COLOR_BGRA2BGR);
         return matRGB;
     }
+    case QImage::Format_Grayscale8:
+    {
+        // Gray sources stay single-channel through the whole chain
+        cv::Mat mat(image.height(), image.width(), CV_8UC1, (void *)image.constBits(), image.bytesPerLine());
+        return mat.clone();
+    }
     case QImage::Format_RGB888:
     {
         cv::Mat mat(image.height(), image.width(), CV_8UC3, (void *)image.constBits(), image.bytesPerLine());
@@ -176,21 +1207,54 @@ QImage ImageProcessor::CvMatToQImage(const cv::Mat &mat)
     }
     else if (mat.type() == CV_8UC4)
     {
-        // BGRA image
-        cv::Mat rgbaMat;
-        cv::cvtColor(mat, rgbaMat, cv::COLOR_BGRA2RGBA);
-        QImage image(rgbaMat.data, rgbaMat.cols, rgbaMat.rows, rgbaMat.step, QImage::Format_RGBA8888);
+        // Straight BGRA is QImage's ARGB32 layout already
+        QImage image(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_ARGB32);
         return image.copy();
     }
     
 
     return QImage(); // Return empty image if format not supported
 }
+cv::Mat ImageProcessor::premultiply(const cv::Mat &image)
+{
+    if (image.channels() != 4)
+        return image;
+
+    // The conversion only reads channel 3 as alpha, so the BGRA order is fine
+    cv::Mat outputImage;
+    cv::cvtColor(image, outputImage, cv::COLOR_RGBA2mRGBA);
+    return outputImage;
+}
+
+cv::Mat ImageProcessor::unpremultiply(const cv::Mat &image)
+{
+    if (image.channels() != 4)
+        return image;
+
+    cv::Mat outputImage;
+    cv::cvtColor(image, outputImage, cv::COLOR_mRGBA2RGBA);
+    return outputImage;
+}
+
+bool ImageProcessor::writeImage(const cv::Mat &image, const QString &path, const QString &format, int quality)
+{
+    // QSaveFile writes to a temporary file and renames it into place on commit
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    if (!CvMatToQImage(image).save(&file, format.toUtf8().constData(), quality))
+        return false;
+    return file.commit();
+}
+
 cv::Mat ImageProcessor::applyChannelSplit(const cv::Mat &inputImage, int channelIndex, bool grayscale)
 {
-    // Split the image into its color channels
+    // Split the image into its color channels; a gray image has the same value in each
     std::vector<cv::Mat> channels;
-    cv::split(inputImage, channels);
+    if (inputImage.channels() == 1)
+        channels.assign(3, inputImage);
+    else
+        cv::split(inputImage, channels);
 
     // Convert combobox selection to appropriate channel index
     // This assumes channelIndex is 0 for Red, 1 for Green, 2 for Blue
@@ -212,14 +1276,14 @@ cv::Mat ImageProcessor::applyChannelSplit(const cv::Mat &inputImage, int channel
     }
 
     // Extract the specified channel
-    cv::Mat outputImage = channels[cvChannelIndex].clone();
+    cv::Mat outputImage = channels[cvChannelIndex];
 
     if (grayscale)
     {
-        // The channel is already single-channel, just return it
-        cv::Mat grayscaleOutput;
-        cv::cvtColor(outputImage, grayscaleOutput, cv::COLOR_GRAY2BGR); // Ensure 3-channel output
-        return grayscaleOutput;
+        // The channel is already single-channel, just return it (with the alpha, if any)
+        if (inputImage.channels() == 4)
+            return withAlpha(outputImage, inputImage);
+        return outputImage;
     }
     else
     {
@@ -252,6 +1316,13 @@ cv::Mat ImageProcessor::applyChannelSplit(const cv::Mat &inputImage, int channel
             cv::merge(bgrChannels, bgrImage);
         }
 
+        if (inputImage.channels() == 4)
+        {
+            // Keep the opacity as the fourth channel
+            cv::Mat bgraImage;
+            cv::merge(std::vector<cv::Mat>{bgrImage, channels[3]}, bgraImage);
+            return bgraImage;
+        }
         return bgrImage;
     }
 }
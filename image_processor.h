@@ -9,26 +9,159 @@
 class ImageProcessor
 {
 public:
-    // Apply image processing based on the node type and properties
-    static cv::Mat processNode(Node *node, const cv::Mat &inputImage);
+    // How a source's alpha enters the chain: dropped (BGR), or kept as 32-bit BGRA with
+    // straight or premultiplied colour. Premultiplied colour blurs and resamples
+    // transparent edges without dark fringes; results always leave the executor straight.
+    enum class AlphaMode
+    {
+        Ignore,
+        Straight,
+        Premultiplied
+    };
+    static AlphaMode alphaMode(Node *sourceNode);
 
-    // Convert between Qt and OpenCV image formats
-    static cv::Mat QImageToCvMat(const QImage &image);
+    // Marks 4-channel images processed on this thread as premultiplied while it lives;
+    // the executor holds one for each evaluation of a premultiplied source
+    class PremultipliedScope
+    {
+    public:
+        explicit PremultipliedScope(bool premultiplied);
+        ~PremultipliedScope();
+        PremultipliedScope(const PremultipliedScope &) = delete;
+        PremultipliedScope &operator=(const PremultipliedScope &) = delete;
+
+    private:
+        bool m_previous;
+    };
+    static bool premultipliedAlpha();
+
+    // Apply image processing based on the node type and properties.
+    // scale is the resolution of inputImage relative to the full-size source; spatial
+    // parameters are rescaled by it so a preview looks like the full render.
+    // gaussian may hold a precomputed Uniform blur of inputImage at the node's radius,
+    // which unsharp masking reuses instead of blurring again.
+    // inputKey, if non-zero, identifies inputImage's contents; nodes that measure their
+    // input cache the measurements under it.
+    // When inputImage is only a region of the frame, origin is its top-left corner in the
+    // frame and frameSize the frame's size (both at the given scale), for nodes that read
+    // pixel positions; an empty frameSize means inputImage is the whole frame.
+    static cv::Mat processNode(Node *node, const cv::Mat &inputImage, double scale = 1.0,
+                               const cv::Mat &gaussian = cv::Mat(), quint64 inputKey = 0,
+                               const cv::Point &origin = cv::Point(), const cv::Size &frameSize = cv::Size());
+
+    // Radius in pixels at the given render scale
+    static int scaledRadius(int radius, double scale);
+
+    // How far (in pixels at the given scale) a node reads around each output pixel;
+    // 0 for pointwise nodes
+    static int nodeHalo(Node *node, double scale);
+
+    // Crop, Resize and Rotate change the image size or coordinate frame, so the executor
+    // plans around them instead of growing regions through them
+    static bool isGeometric(Node *node);
+
+    // True if running the node at a lower resolution approximates running it at full
+    // resolution and then downscaling (pointwise nodes and kernels that follow the scale)
+    static bool commutesWithScale(Node *node);
+
+    // Crop rectangle in input pixels at the given scale, clamped to the input
+    static cv::Rect cropRect(Node *node, const cv::Size &inputSize, double scale);
+
+    // Size a node's output has for an input of inputSize at the given scale
+    static cv::Size outputSize(Node *node, const cv::Size &inputSize, double scale);
+
+    // Convert between Qt and OpenCV image formats. BGRA maps onto QImage's ARGB32
+    // layout byte for byte (on little-endian hosts), so no channel swizzling is needed
+    static cv::Mat QImageToCvMat(const QImage &image, AlphaMode alpha = AlphaMode::Ignore);
     static QImage CvMatToQImage(const cv::Mat &mat);
 
-    // Process blur operation
+    // Convert 4-channel images between straight and premultiplied colour
+    static cv::Mat premultiply(const cv::Mat &image);
+    static cv::Mat unpremultiply(const cv::Mat &image);
+
+    // Encode and write an image atomically (readers never see a partial file)
+    static bool writeImage(const cv::Mat &image, const QString &path, const QString &format, int quality);
+
+    // Process blur operation; Uniform runs the Gaussian method the kernel profile picked
     static cv::Mat applyBlur(const cv::Mat &inputImage, int radius, const QString &blurType);
 
-    // Process brightness/contrast adjustment
-    static cv::Mat applyBrightnessContrast(const cv::Mat &inputImage, int brightness, int contrast);
+    // Gaussian blur implementations that agree up to rounding: OpenCV's GaussianBlur
+    // (fixed-point for 8-bit images) or two separable float passes
+    enum class GaussianMethod
+    {
+        Library,
+        Separable
+    };
+    static cv::Mat applyGaussian(const cv::Mat &inputImage, int radius, GaussianMethod method);
+
+    // Process brightness/contrast adjustment; alpha, if present, is kept
+    static cv::Mat applyBrightnessContrast(const cv::Mat &inputImage, double brightness, double contrast);
 
-    // Process grayscale conversion
+    // Process grayscale conversion; single-channel, or gray BGR plus alpha for BGRA input
     static cv::Mat applyGrayscale(const cv::Mat &inputImage, const QString &method);
 
     // Process sharpen operation
     static cv::Mat applySharpen(const cv::Mat &inputImage, int amount);
+
+    // Process unsharp masking from an already blurred copy of the input
+    static cv::Mat applyUnsharpMask(const cv::Mat &inputImage, const cv::Mat &blurredImage, int amount);
+
+    // Edge-preserving smoothing with a cost per pixel independent of the radius, split
+    // into row bands across threads. range and smoothing are in intensity levels:
+    // differences well below them are smoothed away, larger ones are kept as edges.
+    static cv::Mat applyBilateral(const cv::Mat &inputImage, int radius, double range);
+    static cv::Mat applyGuidedFilter(const cv::Mat &inputImage, int radius, double smoothing);
+
+    // Rank filters over a (2 * radius + 1) square window, with a cost per pixel that does
+    // not grow with the radius. operation is Erode (min), Dilate (max), Open, Close,
+    // Top-hat or Black-hat.
+    static cv::Mat applyMedian(const cv::Mat &inputImage, int radius);
+    static cv::Mat applyMorphology(const cv::Mat &inputImage, const QString &operation, int radius);
+
+    // Colour grade through a .cube 3D LUT; interpolation is Tetrahedral or Trilinear.
+    // The image is returned unchanged if the file can't be used.
+    static cv::Mat applyLut3D(const cv::Mat &inputImage, const QString &lutPath, const QString &interpolation);
+
+    // Correlate with a user kernel ("1 2 1; 2 4 2; 1 2 1"), optionally normalised to sum 1,
+    // and add offset; runs as separable passes, filter2D or a tiled FFT, whichever is
+    // cheapest for this kernel and image size
+    static cv::Mat applyConvolution(const cv::Mat &inputImage, const QString &kernel, bool normalize, double offset);
+
+    // Per-pixel formula over r, g, b, a, x, y, w, h and the parameters p1 and p2 (see
+    // expression.h); x, y, w and h are in full-resolution pixels at any scale, with the
+    // input placed at origin in a frame of frameSize as for processNode. The image is
+    // returned unchanged if the expression doesn't compile.
+    static cv::Mat applyExpression(const cv::Mat &inputImage, const QString &expression, double p1, double p2,
+                                   double scale = 1.0, const cv::Point &origin = cv::Point(),
+                                   const cv::Size &frameSize = cv::Size());
+
+    // Automatic tone from the input's own histograms, counted once per inputKey.
+    // Auto Levels stretches the levels between the clip percentiles (percent of pixels
+    // at each end) to the full range, with one range for all channels or one per channel.
+    // Equalize flattens the luma histogram, blended in by amount (0-100); CLAHE does so
+    // per tile of a tiles x tiles grid, with each level's share capped at clipLimit times
+    // the mean. Luma changes keep the colour difference channels (Cb, Cr) as they were.
+    static cv::Mat applyAutoLevels(const cv::Mat &inputImage, double clip, bool perChannel, quint64 inputKey = 0);
+    static cv::Mat applyEqualize(const cv::Mat &inputImage, int amount, quint64 inputKey = 0);
+    static cv::Mat applyClahe(const cv::Mat &inputImage, double clipLimit, int tiles, quint64 inputKey = 0);
+
+    // Geometric operations; a crop returns a view sharing the input's pixels
+    static cv::Mat applyCrop(const cv::Mat &inputImage, const cv::Rect &rect);
+    static cv::Mat applyResize(const cv::Mat &inputImage, const cv::Size &size, const QString &interpolation);
+    // Counter-clockwise, in degrees; the canvas grows to fit the rotated corners
+    static cv::Mat applyRotate(const cv::Mat &inputImage, double angle);
+
     // Process color channel splitting operation
     static cv::Mat applyChannelSplit(const cv::Mat &inputImage, int channelIndex, bool grayscale);
+
+private:
+    // Each channel, or the luma of colour images, through 256-entry tables
+    static cv::Mat mapChannels(const cv::Mat &inputImage, const uchar luts[3][256]);
+    static cv::Mat mapLuma(const cv::Mat &inputImage, const uchar lut[256]);
+
+    // Windowed minimum or maximum: over a square, and along each row
+    static cv::Mat rankFilter(const cv::Mat &inputImage, int radius, bool maximum);
+    static cv::Mat rankFilterRows(const cv::Mat &inputImage, int radius, bool maximum);
 };
 
 #endif // IMAGE_PROCESSOR_H
@@ -0,0 +1,302 @@
+// lut3d.cpp
+#include "lut3d.h"
+#include "content_hash.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QStringList>
+#include <QTextStream>
+#include <algorithm>
+#include <mutex>
+
+namespace
+{
+    const int MaxSize = 256;
+
+    // Content hash of a file, valid while its size and mtime are unchanged
+    struct FileStamp
+    {
+        qint64 modified = 0;
+        qint64 size = 0;
+        quint64 contentKey = 0;
+    };
+
+    std::mutex cacheMutex; // Guards the two caches below
+    QHash<QString, FileStamp> stamps;
+    QHash<quint64, std::shared_ptr<const Lut3D::Lattice>> lattices;
+
+    bool parseTriplet(const QStringList &fields, int first, float *values)
+    {
+        if (fields.size() < first + 3)
+            return false;
+        bool ok = true;
+        for (int i = 0; i < 3 && ok; ++i)
+            values[i] = fields[first + i].toFloat(&ok);
+        return ok;
+    }
+
+    std::shared_ptr<Lut3D::Lattice> parse(const QString &path, QString *error)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            *error = "Cannot open LUT file: " + path;
+            return nullptr;
+        }
+
+        auto lattice = std::make_shared<Lut3D::Lattice>();
+        size_t expected = 0;
+        QTextStream stream(&file);
+        QString line;
+        while (stream.readLineInto(&line))
+        {
+            QStringList fields = line.simplified().split(' ', Qt::SkipEmptyParts);
+            if (fields.isEmpty() || fields[0].startsWith('#'))
+                continue;
+
+            const QString &keyword = fields[0];
+            float values[3];
+            if (keyword == "LUT_3D_SIZE")
+            {
+                lattice->size = fields.value(1).toInt();
+                if (lattice->size < 2 || lattice->size > MaxSize)
+                {
+                    *error = "Unsupported LUT_3D_SIZE in " + path;
+                    return nullptr;
+                }
+                expected = size_t(lattice->size) * lattice->size * lattice->size;
+                lattice->table.reserve(expected * 3);
+            }
+            else if (keyword == "LUT_1D_SIZE")
+            {
+                *error = "1D LUTs are not supported: " + path;
+                return nullptr;
+            }
+            else if (keyword == "DOMAIN_MIN" && parseTriplet(fields, 1, values))
+            {
+                std::copy(values, values + 3, lattice->domainMin);
+            }
+            else if (keyword == "DOMAIN_MAX" && parseTriplet(fields, 1, values))
+            {
+                std::copy(values, values + 3, lattice->domainMax);
+            }
+            else if (keyword == "LUT_3D_INPUT_RANGE" && fields.size() >= 3)
+            {
+                // Resolve's form: one minimum and maximum for all channels
+                std::fill(lattice->domainMin, lattice->domainMin + 3, fields[1].toFloat());
+                std::fill(lattice->domainMax, lattice->domainMax + 3, fields[2].toFloat());
+            }
+            else if (parseTriplet(fields, 0, values))
+            {
+                if (expected == 0 || lattice->table.size() >= expected * 3)
+                {
+                    *error = "LUT data without a matching LUT_3D_SIZE in " + path;
+                    return nullptr;
+                }
+                for (float value : values)
+                    lattice->table.push_back(value * 255.0f);
+            }
+            // TITLE and other keywords are ignored
+        }
+
+        if (expected == 0 || lattice->table.size() != expected * 3)
+        {
+            *error = "Incomplete LUT data in " + path;
+            return nullptr;
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            if (!(lattice->domainMax[c] > lattice->domainMin[c]))
+            {
+                *error = "Invalid LUT domain in " + path;
+                return nullptr;
+            }
+        }
+        return lattice;
+    }
+}
+
+quint64 Lut3D::fileKey(const QString &path)
+{
+    QFileInfo info(path);
+    if (path.isEmpty() || !info.exists())
+        return 0;
+
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = stamps.constFind(path);
+        if (it != stamps.constEnd() && it->modified == modified && it->size == info.size())
+            return it->contentKey;
+    }
+
+    FileStamp stamp;
+    stamp.modified = modified;
+    stamp.size = info.size();
+    stamp.contentKey = ContentHash::file(path);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    stamps.insert(path, stamp);
+    return stamp.contentKey;
+}
+
+std::shared_ptr<const Lut3D::Lattice> Lut3D::load(const QString &path, QString *error)
+{
+    QString message;
+    quint64 key = fileKey(path);
+    if (key == 0)
+    {
+        if (error)
+            *error = "LUT file not found: " + path;
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = lattices.constFind(key);
+        if (it != lattices.constEnd())
+            return it.value();
+    }
+
+    // Parsed outside the lock; two threads racing on a new file just parse it twice
+    std::shared_ptr<const Lattice> lattice = parse(path, &message);
+    if (!lattice)
+    {
+        if (error)
+            *error = message;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    lattices.insert(key, lattice);
+    return lattice;
+}
+
+cv::Mat Lut3D::apply(const cv::Mat &image, const Lattice &lattice, bool tetrahedral)
+{
+    const int n = lattice.size;
+
+    // Lower lattice index and fraction for every 8-bit level, per axis (R, G, B), so the
+    // per-pixel work is table reads and the interpolation itself
+    struct Axis
+    {
+        int offset[256];
+        float fraction[256];
+    };
+    Axis axes[3];
+    const int strides[3] = {3, 3 * n, 3 * n * n}; // Floats between neighbours along R, G, B
+    for (int c = 0; c < 3; ++c)
+    {
+        const float range = lattice.domainMax[c] - lattice.domainMin[c];
+        for (int v = 0; v < 256; ++v)
+        {
+            float x = (v / 255.0f - lattice.domainMin[c]) / range;
+            x = std::min(std::max(x, 0.0f), 1.0f) * (n - 1);
+            int index = std::min(int(x), n - 2);
+            axes[c].offset[v] = index * strides[c];
+            axes[c].fraction[v] = x - index;
+        }
+    }
+
+    const int channels = image.channels();
+    const int outputChannels = channels == 1 ? 3 : channels;
+    cv::Mat output(image.size(), CV_8UC(outputChannels));
+    const float *table = lattice.table.data();
+    const int dr = strides[0];
+    const int dg = strides[1];
+    const int db = strides[2];
+
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range &rows)
+                      {
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            const uchar *src = image.ptr<uchar>(y);
+            uchar *dst = output.ptr<uchar>(y);
+            for (int x = 0; x < image.cols; ++x)
+            {
+                const uchar *p = src + x * channels;
+                const int b = p[0];
+                const int g = channels == 1 ? p[0] : p[1];
+                const int r = channels == 1 ? p[0] : p[2];
+
+                const float *c000 = table + axes[0].offset[r] + axes[1].offset[g] + axes[2].offset[b];
+                const float fr = axes[0].fraction[r];
+                const float fg = axes[1].fraction[g];
+                const float fb = axes[2].fraction[b];
+                float out[3];
+
+                if (tetrahedral)
+                {
+                    // The unit cube splits into six tetrahedra along its main diagonal;
+                    // the order of the fractions picks the one containing the point
+                    const float *c111 = c000 + dr + dg + db;
+                    const float *c1;
+                    const float *c2;
+                    float w0, w1, w2, w3;
+                    if (fr > fg)
+                    {
+                        if (fg > fb)
+                        {
+                            c1 = c000 + dr; c2 = c000 + dr + dg;
+                            w0 = 1.0f - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb;
+                        }
+                        else if (fr > fb)
+                        {
+                            c1 = c000 + dr; c2 = c000 + dr + db;
+                            w0 = 1.0f - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg;
+                        }
+                        else
+                        {
+                            c1 = c000 + db; c2 = c000 + dr + db;
+                            w0 = 1.0f - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg;
+                        }
+                    }
+                    else
+                    {
+                        if (fb > fg)
+                        {
+                            c1 = c000 + db; c2 = c000 + dg + db;
+                            w0 = 1.0f - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr;
+                        }
+                        else if (fb > fr)
+                        {
+                            c1 = c000 + dg; c2 = c000 + dg + db;
+                            w0 = 1.0f - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr;
+                        }
+                        else
+                        {
+                            c1 = c000 + dg; c2 = c000 + dr + dg;
+                            w0 = 1.0f - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb;
+                        }
+                    }
+                    for (int k = 0; k < 3; ++k)
+                        out[k] = w0 * c000[k] + w1 * c1[k] + w2 * c2[k] + w3 * c111[k];
+                }
+                else
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const float *c = c000 + k;
+                        float x00 = c[0] + fr * (c[dr] - c[0]);
+                        float x10 = c[dg] + fr * (c[dg + dr] - c[dg]);
+                        float x01 = c[db] + fr * (c[db + dr] - c[db]);
+                        float x11 = c[db + dg] + fr * (c[db + dg + dr] - c[db + dg]);
+                        float y0 = x00 + fg * (x10 - x00);
+                        float y1 = x01 + fg * (x11 - x01);
+                        out[k] = y0 + fb * (y1 - y0);
+                    }
+                }
+
+                uchar *q = dst + x * outputChannels;
+                q[0] = cv::saturate_cast<uchar>(out[2]);
+                q[1] = cv::saturate_cast<uchar>(out[1]);
+                q[2] = cv::saturate_cast<uchar>(out[0]);
+                if (channels == 4)
+                    q[3] = p[3];
+            }
+        } });
+
+    return output;
+}
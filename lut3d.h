@@ -0,0 +1,35 @@
+// lut3d.h
+#ifndef LUT3D_H
+#define LUT3D_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <memory>
+#include <vector>
+
+// 3D colour lookup tables in the .cube format (Adobe/Resolve). A file is parsed once;
+// the lattice is cached by the hash of the file contents, and the hash by the file's
+// size and modification time, so repeated renders neither re-read nor re-parse it.
+namespace Lut3D
+{
+    struct Lattice
+    {
+        int size = 0; // Points per axis
+        float domainMin[3] = {0.0f, 0.0f, 0.0f}; // Input range, R G B
+        float domainMax[3] = {1.0f, 1.0f, 1.0f};
+        std::vector<float> table; // R G B outputs in 8-bit units, red varying fastest
+    };
+
+    // Parsed lattice of a .cube file, or null (with error set) if it can't be used
+    std::shared_ptr<const Lattice> load(const QString &path, QString *error = nullptr);
+
+    // Hash of the file contents, 0 if it can't be read; part of a LUT node's cache key
+    quint64 fileKey(const QString &path);
+
+    // Map the colour of 8-bit BGR(A) or gray pixels through the lattice, in parallel
+    // row bands. Tetrahedral interpolation reads 4 lattice points per pixel, trilinear 8.
+    // Alpha is kept; gray input gives BGR output.
+    cv::Mat apply(const cv::Mat &image, const Lattice &lattice, bool tetrahedral);
+}
+
+#endif // LUT3D_H
@@ -1,12 +1,153 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCoreApplication>
 #include <QStyleFactory>
+#include <cstring>
 #include "mainwindow.h"
 #include "node.h"
 #include "node_property.h"
+#include "watch_daemon.h"
+#include "render_server.h"
+#include "thread_budget.h"
+#include "autotuner.h"
+
+namespace
+{
+    bool hasArgument(int argc, char *argv[], const char *name)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Size the thread budget from --threads, or else from the kernel profile. A missing
+    // profile, or one tuned on another CPU, is re-tuned in the background.
+    void installThreadBudget(int threads)
+    {
+        bool profiled = Autotuner::load();
+        ThreadBudget::install(threads > 0 ? threads : Autotuner::choice("threads", 0));
+        if (!profiled)
+            Autotuner::tuneInBackground();
+    }
+
+    // Time kernel implementations on this machine and save the winners: NodeImageEditor --autotune
+    int runAutotune(int argc, char *argv[])
+    {
+        QCoreApplication app(argc, argv);
+        QCoreApplication::setApplicationName("NodeImageEditor");
+
+        QCommandLineParser parser;
+        parser.setApplicationDescription("Time kernel implementations on this machine and save the fastest.");
+        parser.addHelpOption();
+        QCommandLineOption autotuneOption("autotune", "Tune now, even if the saved profile matches this CPU.");
+        QCommandLineOption threadsOption("threads", "Threads to tune with (default: one per core).", "count", "0");
+        parser.addOptions({autotuneOption, threadsOption});
+        parser.process(app);
+        ThreadBudget::install(parser.value(threadsOption).toInt());
+
+        QStringList report;
+        if (!Autotuner::tune(&report))
+        {
+            qCritical().noquote() << "Cannot save the kernel profile to" << Autotuner::profilePath();
+            return 1;
+        }
+        qInfo().noquote() << "Kernel profile for" << Autotuner::cpuModel() << "saved to" << Autotuner::profilePath();
+        for (const QString &line : report)
+            qInfo().noquote() << " " << line;
+        return 0;
+    }
+
+    // Headless watch-folder mode: NodeImageEditor --watch <dir> --graph <file> --out <dir>
+    int runWatchDaemon(int argc, char *argv[])
+    {
+        QCoreApplication app(argc, argv);
+        QCoreApplication::setApplicationName("NodeImageEditor");
+
+        QCommandLineParser parser;
+        parser.setApplicationDescription("Process images dropped into watched folders with a saved graph.");
+        parser.addHelpOption();
+        QCommandLineOption watchOption("watch", "Folder to watch; may be repeated.", "dir");
+        QCommandLineOption graphOption("graph", "Graph exported from the editor (File > Export Graph).", "file");
+        QCommandLineOption outOption("out", "Folder that receives the results.", "dir");
+        QCommandLineOption workersOption("workers", "Number of worker threads (default: the thread budget).", "count", "0");
+        QCommandLineOption threadsOption("threads", "Threads shared by workers and OpenCV (default: one per core).", "count", "0");
+        QCommandLineOption statsOption("stats", "File rewritten with queue and latency metrics.", "file");
+        QCommandLineOption metricsOption("metrics", "File rewritten with engine metrics in Prometheus text format.", "file");
+        parser.addOptions({watchOption, graphOption, outOption, workersOption, statsOption, metricsOption, threadsOption});
+        parser.process(app);
+        installThreadBudget(parser.value(threadsOption).toInt());
+
+        WatchDaemon::Options options;
+        options.watchDirs = parser.values(watchOption);
+        options.graphPath = parser.value(graphOption);
+        options.outputDir = parser.value(outOption);
+        options.workers = parser.value(workersOption).toInt();
+        options.statsPath = parser.value(statsOption);
+        options.metricsPath = parser.value(metricsOption);
+
+        WatchDaemon daemon(options);
+        QString error;
+        if (!daemon.start(&error))
+        {
+            qCritical().noquote() << error;
+            return 1;
+        }
+        return app.exec();
+    }
+
+    // Headless render server: NodeImageEditor --serve <socket> --graphs <dir>
+    int runRenderServer(int argc, char *argv[])
+    {
+        QCoreApplication app(argc, argv);
+        QCoreApplication::setApplicationName("NodeImageEditor");
+
+        QCommandLineParser parser;
+        parser.setApplicationDescription("Serve render requests for saved graphs over a local socket.");
+        parser.addHelpOption();
+        QCommandLineOption serveOption("serve", "Local socket name or path to listen on.", "socket");
+        QCommandLineOption graphsOption("graphs", "Folder of graphs exported from the editor; <id>.json is graph <id>.", "dir");
+        QCommandLineOption workersOption("workers", "Concurrent renders (default: the thread budget).", "count", "0");
+        QCommandLineOption threadsOption("threads", "Threads shared by workers and OpenCV (default: one per core).", "count", "0");
+        QCommandLineOption queueOption("max-queue", "Waiting requests before new ones are rejected as busy.", "count", "64");
+        QCommandLineOption metricsOption("metrics", "File rewritten with engine metrics in Prometheus text format.", "file");
+        parser.addOptions({serveOption, graphsOption, workersOption, queueOption, metricsOption, threadsOption});
+        parser.process(app);
+        installThreadBudget(parser.value(threadsOption).toInt());
+
+        RenderServer::Options options;
+        options.socketName = parser.value(serveOption);
+        options.graphDir = parser.value(graphsOption);
+        options.workers = parser.value(workersOption).toInt();
+        options.maxQueued = qMax(1, parser.value(queueOption).toInt());
+        options.metricsPath = parser.value(metricsOption);
+
+        RenderServer server(options);
+        QString error;
+        if (!server.start(&error))
+        {
+            qCritical().noquote() << error;
+            return 1;
+        }
+        return app.exec();
+    }
+}
 
 int main(int argc, char *argv[])
 {
+    if (hasArgument(argc, argv, "--watch"))
+        return runWatchDaemon(argc, argv);
+    if (hasArgument(argc, argv, "--serve"))
+        return runRenderServer(argc, argv);
+    if (hasArgument(argc, argv, "--autotune"))
+        return runAutotune(argc, argv);
+
     QApplication app(argc, argv);
+    // Also names the cache directory and kernel profile shared with headless runs
+    QApplication::setApplicationName("NodeImageEditor");
+    installThreadBudget(0);
 
     // Optional: Set a clean modern style (Fusion is cross-platform)
     QApplication::setStyle(QStyleFactory::create("Fusion"));
@@ -1,5 +1,7 @@
 #include "mainwindow.h"
 #include "canvaswidget.h"
+#include "previewwidget.h"
+#include "node_graph.h"
 #include <QFileDialog>
 #include <QImage>
 #include <QMenuBar>
@@ -18,6 +20,7 @@
 #include <QComboBox>
 #include <QMimeData>
 #include <QSlider>
+#include <QSpinBox>
 #include <QLineEdit>
 #include <QCheckBox>
 #include <QPainter>
@@ -47,6 +50,7 @@ MainWindow::MainWindow(QWidget *parent)
     fileMenu2->addAction("Open")->setShortcut(QKeySequence::Open);
     fileMenu2->addAction("Save")->setShortcut(QKeySequence::Save);
     fileMenu2->addAction("Save As")->setShortcut(QKeySequence::SaveAs);
+    fileMenu2->addAction("Export Graph...");
     fileMenu2->addSeparator();
     fileMenu2->addAction("Exit")->setShortcut(QKeySequence::Quit);
 
@@ -95,6 +99,15 @@ MainWindow::MainWindow(QWidget *parent)
             }
         }
 
+    } else if (action->text() == "Export Graph...") {
+        // Save the graph so it can be run headless (e.g. --watch mode)
+        QString fileName = QFileDialog::getSaveFileName(this, "Export Graph", "", "Graphs (*.json)");
+        CanvasWidget *canvas = findChild<CanvasWidget *>();
+        if (!fileName.isEmpty() && canvas) {
+            if (!NodeGraph::save(canvas->getAllNodes(), fileName)) {
+                QMessageBox::warning(this, "Export Graph", "Failed to write the graph.");
+            }
+        }
     }
             });
     // Create Edit menu actions
@@ -309,7 +322,22 @@ MainWindow::MainWindow(QWidget *parent)
     nodeList->addItem("Grayscale");
     nodeList->addItem("Brightness");
     nodeList->addItem("Color Channel Splitter");
+    nodeList->addItem("Bilateral");
+    nodeList->addItem("Guided Filter");
+    nodeList->addItem("Median");
+    nodeList->addItem("Morphology");
+    nodeList->addItem("3D LUT");
+    nodeList->addItem("Convolution");
+    nodeList->addItem("Expression");
+    nodeList->addItem("Auto Levels");
+    nodeList->addItem("Histogram Equalize");
+    nodeList->addItem("CLAHE");
+    nodeList->addItem("Crop");
+    nodeList->addItem("Resize");
+    nodeList->addItem("Rotate");
     nodeList->addItem("Output");
+    nodeList->addItem("Sequence Source");
+    nodeList->addItem("Sequence Output");
 
     nodeList->setMaximumWidth(180);
 
@@ -360,6 +388,11 @@ MainWindow::MainWindow(QWidget *parent)
     canvas->setMinimumSize(2000, 2000);
     // Connect the nodeSelected signal so that when a node is clicked or dragged, adjustments update.
     connect(canvas, &CanvasWidget::nodeSelected, this, &MainWindow::handleNodeSelected);
+    // Saves finish in the background
+    connect(canvas, &CanvasWidget::outputSaved, this, [this](const QString &filePath, bool ok)
+            {
+        if (!ok)
+            QMessageBox::warning(this, "Save Image", "Failed to save the image to " + filePath); });
     QScrollArea *canvasScroll = new QScrollArea();
     canvasScroll->setWidget(canvas);
     canvasScroll->setWidgetResizable(true);
@@ -385,6 +418,11 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // Let a running sequence render finish the frames in flight before exiting
+    if (m_sequenceJob)
+        m_sequenceJob->cancel();
+    if (m_sequenceThread.joinable())
+        m_sequenceThread.join();
 }
 
 // ---------------------------------------------------------------------
@@ -492,7 +530,7 @@ void MainWindow::setupAdjustmentPanel(Node *node)
                 {
                     comboBox->addItem(childNode->getName());
                 }
-                comboBox->setCurrentText(prop->getValue().toString());
+                comboBox->setCurrentText(prop->toString());
                 scrollLayout->addWidget(comboBox);
                 connect(comboBox, &QComboBox::currentTextChanged, this, [this, prop](const QString &text)
                         { updateNodeProperty(prop->getName(), text); });
@@ -504,8 +542,8 @@ void MainWindow::setupAdjustmentPanel(Node *node)
             // Implement Gaussian blur with configurable radius (1-20px)
             QSlider *slider = new QSlider(Qt::Horizontal);
             slider->setRange(1, 20);
-            slider->setValue(prop->getValue().toInt());
-            QLabel *valueLabel = new QLabel(QString::number(prop->getValue().toInt()));
+            slider->setValue(prop->toInt());
+            QLabel *valueLabel = new QLabel(QString::number(prop->toInt()));
             QHBoxLayout *sliderLayout = new QHBoxLayout();
             sliderLayout->addWidget(slider);
             sliderLayout->addWidget(valueLabel);
@@ -526,8 +564,8 @@ void MainWindow::setupAdjustmentPanel(Node *node)
             // Adjust image contrast with a slider (0 to 3)
             QSlider *slider = new QSlider(Qt::Horizontal);
             slider->setRange(0, 300);
-            slider->setValue(static_cast<int>(prop->getValue().toDouble() * 100));
-            QLabel *valueLabel = new QLabel(QString::number(prop->getValue().toDouble(), 'f', 2));
+            slider->setValue(static_cast<int>(prop->toDouble() * 100));
+            QLabel *valueLabel = new QLabel(QString::number(prop->toDouble(), 'f', 2));
             QHBoxLayout *sliderLayout = new QHBoxLayout();
             sliderLayout->addWidget(slider);
             sliderLayout->addWidget(valueLabel);
@@ -545,9 +583,9 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         {
             QSlider *slider = new QSlider(Qt::Horizontal);
             slider->setRange(-100, 100);
-            slider->setValue(prop->getValue().toInt());
+            slider->setValue(prop->toInt());
 
-            QLabel *valueLabel = new QLabel(QString::number(prop->getValue().toInt()));
+            QLabel *valueLabel = new QLabel(QString::number(prop->toInt()));
             QHBoxLayout *sliderLayout = new QHBoxLayout();
             sliderLayout->addWidget(slider);
             sliderLayout->addWidget(valueLabel);
@@ -563,13 +601,33 @@ void MainWindow::setupAdjustmentPanel(Node *node)
 
             break;
         }
+        case NodeProperty::Pixels:
+        case NodeProperty::Angle:
+        {
+            QSpinBox *spinBox = new QSpinBox();
+            if (prop->getType() == NodeProperty::Pixels)
+            {
+                spinBox->setRange(0, 100000);
+                spinBox->setSuffix(" px");
+            }
+            else
+            {
+                spinBox->setRange(-360, 360);
+                spinBox->setSuffix(QString::fromUtf8(" \u00B0"));
+            }
+            spinBox->setValue(prop->toInt());
+            scrollLayout->addWidget(spinBox);
+            connect(spinBox, &QSpinBox::editingFinished, this, [this, spinBox, prop]()
+                    { updateNodeProperty(prop->getName(), spinBox->value()); });
+            break;
+        }
         case NodeProperty::ChannelIndex:
         {
             QComboBox *comboBox = new QComboBox();
             comboBox->addItem("Red");
             comboBox->addItem("Green");
             comboBox->addItem("Blue");
-            comboBox->setCurrentText(prop->getValue().toString());
+            comboBox->setCurrentText(prop->toString());
             scrollLayout->addWidget(comboBox);
             connect(comboBox, &QComboBox::currentTextChanged, this, [this, prop](const QString &text)
                     { updateNodeProperty(prop->getName(), text); });
@@ -579,9 +637,9 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         {
             QSlider *slider = new QSlider(Qt::Horizontal);
             slider->setRange(0, 100);
-            slider->setValue(static_cast<int>(prop->getValue().toDouble() * 100));
+            slider->setValue(static_cast<int>(prop->toDouble() * 100));
 
-            QLabel *valueLabel = new QLabel(QString::number(prop->getValue().toDouble(), 'f', 2));
+            QLabel *valueLabel = new QLabel(QString::number(prop->toDouble(), 'f', 2));
             QHBoxLayout *sliderLayout = new QHBoxLayout();
             sliderLayout->addWidget(slider);
             sliderLayout->addWidget(valueLabel);
@@ -598,7 +656,7 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         }
         case NodeProperty::String:
         {
-            QLineEdit *lineEdit = new QLineEdit(prop->getValue().toString());
+            QLineEdit *lineEdit = new QLineEdit(prop->toString());
             scrollLayout->addWidget(lineEdit);
             connect(lineEdit, &QLineEdit::editingFinished, this, [this, lineEdit, prop]()
                     { updateNodeProperty(prop->getName(), lineEdit->text()); });
@@ -607,7 +665,7 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         case NodeProperty::Boolean:
         {
             QCheckBox *checkBox = new QCheckBox("Enabled");
-            checkBox->setChecked(prop->getValue().toBool());
+            checkBox->setChecked(prop->toBool());
             scrollLayout->addWidget(checkBox);
             connect(checkBox, &QCheckBox::toggled, this, [this, prop](bool checked)
                     { updateNodeProperty(prop->getName(), checked); });
@@ -617,7 +675,7 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         {
             QComboBox *comboBox = new QComboBox();
             comboBox->addItems(prop->getEnumValues());
-            comboBox->setCurrentText(prop->getValue().toString());
+            comboBox->setCurrentText(prop->toString());
             scrollLayout->addWidget(comboBox);
             connect(comboBox, &QComboBox::currentTextChanged, this, [this, prop](const QString &text)
                     { updateNodeProperty(prop->getName(), text); });
@@ -631,36 +689,41 @@ void MainWindow::setupAdjustmentPanel(Node *node)
         QLabel *previewLabel = new QLabel("Preview:");
         scrollLayout->addWidget(previewLabel);
 
-        QLabel *imagePreview = new QLabel();
+        // Zoomable preview; it only asks for the tiles currently visible
+        PreviewWidget *imagePreview = new PreviewWidget();
         imagePreview->setMinimumSize(300, 200);
-        imagePreview->setAlignment(Qt::AlignCenter);
-        imagePreview->setStyleSheet("background-color: #333333; border: 1px solid #555555;");
+        CanvasWidget *previewCanvas = findChild<CanvasWidget *>();
+        if (previewCanvas)
+            imagePreview->setRenderer(previewCanvas->previewRenderer(node));
+        imagePreview->setImageSize(GraphExecutor::outputSize(node));
         scrollLayout->addWidget(imagePreview);
 
+        // What the optimizer removed, merged or reordered before rendering
+        QLabel *rewritesLabel = new QLabel();
+        rewritesLabel->setWordWrap(true);
+        auto showRewrites = [this, node, rewritesLabel]()
+        {
+            CanvasWidget *canvas = findChild<CanvasWidget *>();
+            QStringList rewrites = canvas ? canvas->graphRewrites(node) : QStringList();
+            rewritesLabel->setText(rewrites.isEmpty() ? QString() : "Optimized: " + rewrites.join(", "));
+            rewritesLabel->setVisible(!rewrites.isEmpty());
+        };
+        showRewrites();
+        scrollLayout->addWidget(rewritesLabel);
+
         // Add a refresh preview button
         QPushButton *refreshButton = new QPushButton("Refresh Preview");
         scrollLayout->addWidget(refreshButton);
-        connect(refreshButton, &QPushButton::clicked, this, [this, node, imagePreview]()
+        connect(refreshButton, &QPushButton::clicked, this, [this, node, imagePreview, showRewrites]()
                 {
-            CanvasWidget *canvas = findChild<CanvasWidget *>();
-            if (!canvas) return;
-            
-            QImage previewImage = canvas->processNodeGraph(node);
-            if (!previewImage.isNull()) {
-                // Scale down for preview if needed
-                QImage scaledImage = previewImage;
-                if (previewImage.width() > imagePreview->width() || 
-                    previewImage.height() > imagePreview->height()) {
-                    scaledImage = previewImage.scaled(
-                        imagePreview->width(), 
-                        imagePreview->height(),
-                        Qt::KeepAspectRatio, 
-                        Qt::SmoothTransformation
-                    );
-                }
-                imagePreview->setPixmap(QPixmap::fromImage(scaledImage));
-            } else {
-                imagePreview->setText("No preview available");
+            // Full resolution is only computed for the tiles being inspected, or on save
+            imagePreview->setImageSize(GraphExecutor::outputSize(node));
+            showRewrites();
+            if (CanvasWidget *canvas = findChild<CanvasWidget *>())
+            {
+                // A new copy of the chain, with the current parameters
+                imagePreview->setRenderer(canvas->previewRenderer(node));
+                canvas->updateThumbnail(node);
             } });
 
         // Add a save button
@@ -670,7 +733,7 @@ void MainWindow::setupAdjustmentPanel(Node *node)
                 {
             QString format = "PNG";
             if (node->hasProperty("outputFormat")) {
-                format = node->getProperty("outputFormat")->getValue().toString();
+                format = node->getProperty("outputFormat")->toString();
             }
             
             QString fileName = QFileDialog::getSaveFileName(
@@ -687,9 +750,46 @@ void MainWindow::setupAdjustmentPanel(Node *node)
                 }
             } });
     }
+    if (node->getType() == "Sequence Output")
+    {
+        QPushButton *renderButton = new QPushButton("Render Sequence");
+        scrollLayout->addWidget(renderButton);
+        connect(renderButton, &QPushButton::clicked, this, [this, node]()
+                { renderSequence(node); });
+    }
     scrollLayout->addStretch(); // Make sure content scrolls properly
 }
 
+void MainWindow::renderSequence(Node *outputNode)
+{
+    if (m_sequenceJob)
+    {
+        QMessageBox::information(this, "Render Sequence", "A sequence is already rendering.");
+        return;
+    }
+    if (m_sequenceThread.joinable())
+        m_sequenceThread.join();
+
+    // Frames stream through decode, evaluation and encode threads in the background
+    m_sequenceJob = std::make_shared<SequencePipeline>(outputNode);
+    std::shared_ptr<SequencePipeline> job = m_sequenceJob;
+    m_sequenceThread = std::thread([this, job]()
+                                   {
+        SequencePipeline::Stats stats = job->run();
+        QMetaObject::invokeMethod(this, [this, stats]()
+                                  {
+            m_sequenceJob.reset();
+            if (stats.ok) {
+                QMessageBox::information(this, "Render Sequence",
+                    QString("Rendered %1 frames in %2 s (%3 fps).")
+                        .arg(stats.frames)
+                        .arg(stats.seconds, 0, 'f', 1)
+                        .arg(stats.frames / qMax(stats.seconds, 0.001), 0, 'f', 1));
+            } else {
+                QMessageBox::warning(this, "Render Sequence", stats.error);
+            } }, Qt::QueuedConnection); });
+}
+
 void MainWindow::clearAdjustmentPanel()
 {
     QWidget *adjustmentsPanel = findChild<QWidget *>("adjustmentsPanel");
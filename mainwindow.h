@@ -8,7 +8,10 @@
 #include <QString>
 #include <QWidget>
 #include <QMap>
+#include <memory>
+#include <thread>
 #include "node.h"
+#include "sequence_pipeline.h"
 
 class MainWindow : public QMainWindow
 {
@@ -28,6 +31,9 @@ private:
     void setupAdjustmentPanel(Node *node);
     void clearAdjustmentPanel();
     void updateCombinedGroupProperties(int value);
+    void renderSequence(Node *outputNode);
         QWidget *m_adjustmentsPanel = nullptr;
     Node *m_selectedNode = nullptr;
+    std::shared_ptr<SequencePipeline> m_sequenceJob; // Sequence render in progress, if any
+    std::thread m_sequenceThread;
 };
@@ -0,0 +1,280 @@
+// metrics.cpp
+#include "metrics.h"
+#include <QHash>
+#include <QMap>
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    const int MaxKinds = 64; // Node kinds beyond this are reported as "other"
+    const double BucketBounds[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+    const int BucketCount = sizeof(BucketBounds) / sizeof(BucketBounds[0]) + 1; // Last one is +Inf
+
+    struct KindStats
+    {
+        std::atomic<quint64> count{0};
+        std::atomic<quint64> bytes{0};
+        std::atomic<quint64> nanos{0};
+        std::atomic<quint64> buckets[BucketCount]{};
+    };
+
+    struct Shard
+    {
+        KindStats kinds[MaxKinds];
+        std::atomic<quint64> cache[2][2]{}; // [level][hit]
+    };
+
+    struct Gauge
+    {
+        QString name;
+        QString help;
+        std::function<double()> sample;
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<Shard *> shards;
+        Shard retired; // Totals of threads that have exited
+        QHash<QString, int> kindIds;
+        QStringList kindNames;
+        QMap<int, Gauge> gauges;
+        int nextGaugeId = 1;
+    };
+
+    Registry &registry()
+    {
+        // Never destroyed, so threads exiting during shutdown can still retire their shards
+        static Registry *instance = new Registry;
+        return *instance;
+    }
+
+    // Only the owning thread writes a shard, so a relaxed load + store is enough
+    inline void bump(std::atomic<quint64> &counter, quint64 amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    inline quint64 read(const std::atomic<quint64> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    void mergeInto(Shard &target, const Shard &source)
+    {
+        for (int k = 0; k < MaxKinds; ++k)
+        {
+            bump(target.kinds[k].count, read(source.kinds[k].count));
+            bump(target.kinds[k].bytes, read(source.kinds[k].bytes));
+            bump(target.kinds[k].nanos, read(source.kinds[k].nanos));
+            for (int b = 0; b < BucketCount; ++b)
+                bump(target.kinds[k].buckets[b], read(source.kinds[k].buckets[b]));
+        }
+        for (int level = 0; level < 2; ++level)
+        {
+            for (int hit = 0; hit < 2; ++hit)
+                bump(target.cache[level][hit], read(source.cache[level][hit]));
+        }
+    }
+
+    class ShardHandle
+    {
+    public:
+        ShardHandle()
+        {
+            Registry &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.shards.push_back(&shard);
+        }
+
+        ~ShardHandle()
+        {
+            Registry &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            mergeInto(r.retired, shard);
+            for (size_t i = 0; i < r.shards.size(); ++i)
+            {
+                if (r.shards[i] == &shard)
+                {
+                    r.shards.erase(r.shards.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        Shard shard;
+        QHash<QString, int> kindIds; // Thread-local copy of the interned kind ids
+    };
+
+    ShardHandle &localShard()
+    {
+        thread_local ShardHandle handle;
+        return handle;
+    }
+
+    int kindId(ShardHandle &handle, const QString &kind)
+    {
+        auto it = handle.kindIds.constFind(kind);
+        if (it != handle.kindIds.constEnd())
+            return it.value();
+
+        // First time this thread sees the kind: intern it globally
+        Registry &r = registry();
+        int id;
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            id = r.kindIds.value(kind, -1);
+            if (id < 0)
+            {
+                if (r.kindNames.size() < MaxKinds - 1)
+                {
+                    id = r.kindNames.size();
+                    r.kindNames.append(kind);
+                }
+                else
+                {
+                    id = MaxKinds - 1;
+                }
+                r.kindIds.insert(kind, id);
+            }
+        }
+        handle.kindIds.insert(kind, id);
+        return id;
+    }
+
+    QString label(const QString &value)
+    {
+        QString escaped = value;
+        escaped.replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n");
+        return escaped;
+    }
+}
+
+namespace Metrics
+{
+    void recordNode(const QString &kind, double seconds, quint64 bytes)
+    {
+        ShardHandle &handle = localShard();
+        KindStats &stats = handle.shard.kinds[kindId(handle, kind)];
+
+        int bucket = 0;
+        while (bucket < BucketCount - 1 && seconds > BucketBounds[bucket])
+            ++bucket;
+
+        bump(stats.count, 1);
+        bump(stats.bytes, bytes);
+        bump(stats.nanos, static_cast<quint64>(seconds * 1e9));
+        bump(stats.buckets[bucket], 1);
+    }
+
+    void recordCacheLookup(CacheLevel level, bool hit)
+    {
+        bump(localShard().shard.cache[static_cast<int>(level)][hit ? 1 : 0], 1);
+    }
+
+    int addGauge(const QString &name, const QString &help, std::function<double()> sample)
+    {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        int id = r.nextGaugeId++;
+        r.gauges.insert(id, Gauge{name, help, std::move(sample)});
+        return id;
+    }
+
+    void removeGauge(int id)
+    {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.gauges.remove(id);
+    }
+
+    QString prometheusText()
+    {
+        Registry &r = registry();
+        Shard total;
+        QStringList kindNames;
+        QMap<QString, QPair<QString, double>> gauges; // name -> (help, summed value)
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            mergeInto(total, r.retired);
+            for (Shard *shard : r.shards)
+                mergeInto(total, *shard);
+            kindNames = r.kindNames;
+
+            for (const Gauge &gauge : r.gauges)
+            {
+                QPair<QString, double> &entry = gauges[gauge.name];
+                entry.first = gauge.help;
+                entry.second += gauge.sample();
+            }
+        }
+        kindNames.append("other");
+
+        QString text;
+        QTextStream out(&text);
+
+        out << "# HELP nie_node_seconds Node execution time by node kind.\n"
+            << "# TYPE nie_node_seconds histogram\n";
+        for (int k = 0; k < MaxKinds; ++k)
+        {
+            const KindStats &stats = total.kinds[k];
+            if (read(stats.count) == 0)
+                continue;
+            QString kind = label(k < kindNames.size() - 1 ? kindNames[k] : kindNames.last());
+            quint64 cumulative = 0;
+            for (int b = 0; b < BucketCount; ++b)
+            {
+                cumulative += read(stats.buckets[b]);
+                QString bound = b < BucketCount - 1 ? QString::number(BucketBounds[b]) : QString("+Inf");
+                out << "nie_node_seconds_bucket{kind=\"" << kind << "\",le=\"" << bound << "\"} " << cumulative << "\n";
+            }
+            out << "nie_node_seconds_sum{kind=\"" << kind << "\"} " << read(stats.nanos) / 1e9 << "\n"
+                << "nie_node_seconds_count{kind=\"" << kind << "\"} " << read(stats.count) << "\n";
+        }
+
+        out << "# HELP nie_node_input_bytes_total Bytes of input processed by node kind.\n"
+            << "# TYPE nie_node_input_bytes_total counter\n";
+        for (int k = 0; k < MaxKinds; ++k)
+        {
+            if (read(total.kinds[k].count) == 0)
+                continue;
+            QString kind = label(k < kindNames.size() - 1 ? kindNames[k] : kindNames.last());
+            out << "nie_node_input_bytes_total{kind=\"" << kind << "\"} " << read(total.kinds[k].bytes) << "\n";
+        }
+
+        out << "# HELP nie_cache_lookups_total Result cache lookups by cache level and outcome.\n"
+            << "# TYPE nie_cache_lookups_total counter\n";
+        const char *levels[] = {"memory", "disk"};
+        for (int level = 0; level < 2; ++level)
+        {
+            out << "nie_cache_lookups_total{cache=\"" << levels[level] << "\",result=\"hit\"} "
+                << read(total.cache[level][1]) << "\n"
+                << "nie_cache_lookups_total{cache=\"" << levels[level] << "\",result=\"miss\"} "
+                << read(total.cache[level][0]) << "\n";
+        }
+
+        for (auto it = gauges.constBegin(); it != gauges.constEnd(); ++it)
+        {
+            out << "# HELP " << it.key() << " " << it.value().first << "\n"
+                << "# TYPE " << it.key() << " gauge\n"
+                << it.key() << " " << it.value().second << "\n";
+        }
+
+        out.flush();
+        return text;
+    }
+
+    bool writeFile(const QString &path)
+    {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        file.write(prometheusText().toUtf8());
+        return file.commit();
+    }
+}
@@ -0,0 +1,54 @@
+// metrics.h
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QString>
+#include <chrono>
+#include <functional>
+
+// Low-overhead counters and histograms published in Prometheus text format.
+// Every thread records into its own shard with relaxed atomic stores, so the hot
+// path never locks or contends on a cache line; shards are only summed when scraped.
+namespace Metrics
+{
+    enum class CacheLevel
+    {
+        Memory,
+        Disk,
+    };
+
+    // One execution of a node kind: wall time and bytes of input processed
+    void recordNode(const QString &kind, double seconds, quint64 bytes);
+
+    void recordCacheLookup(CacheLevel level, bool hit);
+
+    // Gauges (queue depths, cache sizes) are sampled when scraped. Gauges registered
+    // under the same name are summed. Returns an id for removeGauge().
+    int addGauge(const QString &name, const QString &help, std::function<double()> sample);
+    void removeGauge(int id);
+
+    QString prometheusText();
+
+    // Atomically replace path with the current metrics
+    bool writeFile(const QString &path);
+
+    // Records a node execution when it goes out of scope
+    class NodeTimer
+    {
+    public:
+        NodeTimer(const QString &kind, quint64 bytes)
+            : m_kind(kind), m_bytes(bytes), m_start(std::chrono::steady_clock::now()) {}
+        ~NodeTimer()
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+            recordNode(m_kind, elapsed.count(), m_bytes);
+        }
+
+    private:
+        QString m_kind;
+        quint64 m_bytes;
+        std::chrono::steady_clock::time_point m_start;
+    };
+}
+
+#endif // METRICS_H
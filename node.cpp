@@ -1,12 +1,101 @@
 #include "node.h"
+#include "content_hash.h"
+#include <QtAlgorithms>
+#include <QHash>
+#include <algorithm>
+
+namespace
+{
+    Node::Kind kindOf(const QString &type)
+    {
+        static const QHash<QString, Node::Kind> kinds = {
+            {"Output", Node::Kind::Output},
+            {"Load Image", Node::Kind::LoadImage},
+            {"Sequence Source", Node::Kind::SequenceSource},
+            {"Sequence Output", Node::Kind::SequenceOutput},
+            {"Blur", Node::Kind::Blur},
+            {"Sharpen", Node::Kind::Sharpen},
+            {"Grayscale", Node::Kind::Grayscale},
+            {"Brightness", Node::Kind::Brightness},
+            {"Color Channel Splitter", Node::Kind::ChannelSplitter},
+            {"Bilateral", Node::Kind::Bilateral},
+            {"Guided Filter", Node::Kind::GuidedFilter},
+            {"Median", Node::Kind::Median},
+            {"Morphology", Node::Kind::Morphology},
+            {"3D LUT", Node::Kind::Lut3D},
+            {"Convolution", Node::Kind::Convolution},
+            {"Expression", Node::Kind::Expression},
+            {"Auto Levels", Node::Kind::AutoLevels},
+            {"Histogram Equalize", Node::Kind::HistogramEqualize},
+            {"CLAHE", Node::Kind::Clahe},
+            {"Crop", Node::Kind::Crop},
+            {"Resize", Node::Kind::Resize},
+            {"Rotate", Node::Kind::Rotate}};
+        return kinds.value(type, Node::Kind::Other);
+    }
+}
 
 Node::Node(const QImage &image, const QPoint &position, const QString &type, const QString &name)
     : m_image(image), m_position(position), m_dragging(false), m_selected(false),
-      m_type(type), m_name(name.isEmpty() ? type : name)
+      m_type(type), m_name(name.isEmpty() ? type : name), m_typeKey(ContentHash::string(type)),
+      m_kind(kindOf(type))
 {
     initializeDefaultProperties();
 }
 
+Node::Node(const Node &other)
+    : m_image(other.m_image), m_position(other.m_position), m_dragging(other.m_dragging),
+      m_selected(other.m_selected), m_type(other.m_type), m_name(other.m_name), m_typeKey(other.m_typeKey),
+      m_kind(other.m_kind), m_children(other.m_children)
+{
+    for (auto it = other.m_properties.constBegin(); it != other.m_properties.constEnd(); ++it)
+        m_properties.insert(it.key(), new NodeProperty(*it.value()));
+}
+
+Node::Node(Node &&other) noexcept
+    : m_image(std::move(other.m_image)), m_position(other.m_position), m_dragging(other.m_dragging),
+      m_selected(other.m_selected), m_type(std::move(other.m_type)), m_name(std::move(other.m_name)),
+      m_typeKey(other.m_typeKey), m_kind(other.m_kind), m_children(std::move(other.m_children)),
+      m_properties(std::move(other.m_properties))
+{
+    other.m_properties.clear();
+}
+
+Node &Node::operator=(const Node &other)
+{
+    if (this != &other)
+    {
+        Node copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Node &Node::operator=(Node &&other) noexcept
+{
+    if (this != &other)
+    {
+        qDeleteAll(m_properties);
+        m_image = std::move(other.m_image);
+        m_position = other.m_position;
+        m_dragging = other.m_dragging;
+        m_selected = other.m_selected;
+        m_type = std::move(other.m_type);
+        m_name = std::move(other.m_name);
+        m_typeKey = other.m_typeKey;
+        m_kind = other.m_kind;
+        m_children = std::move(other.m_children);
+        m_properties = std::move(other.m_properties);
+        other.m_properties.clear();
+    }
+    return *this;
+}
+
+Node::~Node()
+{
+    qDeleteAll(m_properties);
+}
+
 QImage Node::getImage() const
 {
     return m_image;
@@ -50,6 +139,13 @@ QString Node::getType() const
 void Node::setType(const QString &type)
 {
     m_type = type;
+    m_typeKey = ContentHash::string(type);
+    m_kind = kindOf(type);
+}
+
+Node::Kind Node::kind() const
+{
+    return m_kind;
 }
 
 QString Node::getName() const
@@ -76,6 +172,11 @@ NodeProperty *Node::getProperty(const QString &name)
     return m_properties.value(name, nullptr);
 }
 
+const NodeProperty *Node::getProperty(const QString &name) const
+{
+    return m_properties.value(name, nullptr);
+}
+
 QList<NodeProperty *> Node::getAllProperties() const
 {
     return m_properties.values();
@@ -86,13 +187,28 @@ bool Node::hasProperty(const QString &name) const
     return m_properties.contains(name);
 }
 
+quint64 Node::version() const
+{
+    quint64 version = 0;
+    for (const NodeProperty *prop : m_properties)
+        version = std::max(version, prop->version());
+    return version;
+}
+
+quint64 Node::contentKey() const
+{
+    quint64 h = m_typeKey;
+    for (const NodeProperty *prop : m_properties)
+        h = ContentHash::combine(h, prop->hash());
+    return h;
+}
+
 void Node::initializeDefaultProperties()
 {
     if (m_type == "Blur")
     {
         addProperty("radius", 5, NodeProperty::Blur_Radius);
         addProperty("blurType", "Uniform", NodeProperty::Enum);
-        addProperty("kernel", QImage(), NodeProperty::String); // You may want to make a custom type later
 
         NodeProperty *blurTypeProp = getProperty("blurType");
         if (blurTypeProp)
@@ -104,6 +220,14 @@ void Node::initializeDefaultProperties()
     {
         addProperty("amount", 50, NodeProperty::Integer);
         addProperty("Contrast", 2, NodeProperty::Image_contrast);
+        addProperty("mode", "Kernel", NodeProperty::Enum);
+        addProperty("radius", 3, NodeProperty::Blur_Radius); // Gaussian radius for Unsharp Mask
+
+        NodeProperty *modeProp = getProperty("mode");
+        if (modeProp)
+        {
+            modeProp->setEnumValues({"Kernel", "Unsharp Mask"});
+        }
     }
     else if (m_type == "Grayscale")
     {
@@ -120,12 +244,132 @@ void Node::initializeDefaultProperties()
         addProperty("brightness", 0, NodeProperty::Integer);
         addProperty("contrast", 0, NodeProperty::Integer);
     }
+    else if (m_type == "Bilateral")
+    {
+        // Spatial radius in full-resolution pixels, range in intensity levels
+        addProperty("radius", 16, NodeProperty::Pixels);
+        addProperty("range", 20, NodeProperty::Integer);
+    }
+    else if (m_type == "Guided Filter")
+    {
+        // Variations below about `smoothing` intensity levels are flattened
+        addProperty("radius", 8, NodeProperty::Pixels);
+        addProperty("smoothing", 20, NodeProperty::Integer);
+    }
+    else if (m_type == "Median")
+    {
+        addProperty("radius", 3, NodeProperty::Pixels);
+    }
+    else if (m_type == "Morphology")
+    {
+        addProperty("operation", "Erode", NodeProperty::Enum);
+        addProperty("radius", 3, NodeProperty::Pixels);
+
+        NodeProperty *operationProp = getProperty("operation");
+        if (operationProp)
+        {
+            operationProp->setEnumValues({"Erode", "Dilate", "Open", "Close", "Top-hat", "Black-hat"});
+        }
+    }
+    else if (m_type == "3D LUT")
+    {
+        // A .cube file, parsed once and cached by its contents
+        addProperty("lutPath", "", NodeProperty::String);
+        addProperty("interpolation", "Tetrahedral", NodeProperty::Enum);
+
+        NodeProperty *interpolationProp = getProperty("interpolation");
+        if (interpolationProp)
+        {
+            interpolationProp->setEnumValues({"Tetrahedral", "Trilinear"});
+        }
+    }
+    else if (m_type == "Convolution")
+    {
+        // Rows separated by ';', values by spaces or commas; anchored at the centre
+        addProperty("kernel", "1 2 1; 2 4 2; 1 2 1", NodeProperty::String);
+        addProperty("normalize", true, NodeProperty::Boolean);
+        addProperty("offset", 0, NodeProperty::Integer);
+    }
+    else if (m_type == "Expression")
+    {
+        // Per-pixel formula, e.g. "r = mix(r, (r + g + b) / 3, p1)"; p1 and p2 are free
+        // parameters it can read. Empty leaves the image unchanged.
+        addProperty("expression", "", NodeProperty::String);
+        addProperty("p1", 0.5, NodeProperty::Double);
+        addProperty("p2", 0.5, NodeProperty::Double);
+    }
+    else if (m_type == "Auto Levels")
+    {
+        // Percent of pixels allowed to clip at each end of the range
+        addProperty("clip", 0.1, NodeProperty::Double);
+        addProperty("channels", "Linked", NodeProperty::Enum);
+
+        NodeProperty *channelsProp = getProperty("channels");
+        if (channelsProp)
+        {
+            channelsProp->setEnumValues({"Linked", "Per Channel"});
+        }
+    }
+    else if (m_type == "Histogram Equalize")
+    {
+        addProperty("amount", 100, NodeProperty::Integer);
+    }
+    else if (m_type == "CLAHE")
+    {
+        // Contrast limit as a multiple of the mean histogram share, and tiles per side
+        addProperty("clipLimit", 3, NodeProperty::Integer);
+        addProperty("tiles", 8, NodeProperty::Integer);
+    }
+    else if (m_type == "Crop")
+    {
+        // Full-resolution pixels; a width or height of 0 extends to the image edge
+        addProperty("x", 0, NodeProperty::Pixels);
+        addProperty("y", 0, NodeProperty::Pixels);
+        addProperty("width", 0, NodeProperty::Pixels);
+        addProperty("height", 0, NodeProperty::Pixels);
+    }
+    else if (m_type == "Resize")
+    {
+        // Target size in pixels; 0 keeps the aspect ratio
+        addProperty("width", 1200, NodeProperty::Pixels);
+        addProperty("height", 0, NodeProperty::Pixels);
+        addProperty("interpolation", "Area", NodeProperty::Enum);
+
+        NodeProperty *interpolationProp = getProperty("interpolation");
+        if (interpolationProp)
+        {
+            interpolationProp->setEnumValues({"Area", "Linear", "Cubic", "Nearest"});
+        }
+    }
+    else if (m_type == "Rotate")
+    {
+        addProperty("angle", 90, NodeProperty::Angle);
+    }
     else if (m_type == "Load Image")
     {
         addProperty("filePath", "", NodeProperty::String);
         addProperty("originalWidth", 0, NodeProperty::Integer);
         addProperty("originalHeight", 0, NodeProperty::Integer);
         addProperty("children", QStringList{}, NodeProperty::CustomList);
+
+        // Ignore drops transparency; Straight and Premultiplied keep it as BGRA
+        addProperty("alpha", "Ignore", NodeProperty::Enum);
+        NodeProperty *alphaProp = getProperty("alpha");
+        if (alphaProp)
+        {
+            alphaProp->setEnumValues({"Ignore", "Straight", "Premultiplied"});
+        }
+    }
+    else if (m_type == "Sequence Source")
+    {
+        // Video file or numbered-file pattern such as /shots/frame_%04d.png
+        addProperty("sourcePath", "", NodeProperty::String);
+    }
+    else if (m_type == "Sequence Output")
+    {
+        // Video file (.mp4/.avi) or numbered-file pattern such as /out/frame_%04d.png
+        addProperty("outputPath", "", NodeProperty::String);
+        addProperty("fps", 25, NodeProperty::Integer);
     }
     else if (m_type == "Color Channel Splitter")
     {
@@ -140,6 +384,8 @@ void Node::initializeDefaultProperties()
         addProperty("quality", 90, NodeProperty::Integer);
         addProperty("outputPath", "", NodeProperty::String);
         addProperty("previewScale", 0.5, NodeProperty::Double);
+        // Optional list of sizes/formats written from one render, e.g. "2400:JPG, 1200:JPG, 200:PNG"
+        addProperty("renditions", "", NodeProperty::String);
 
         // Add a property to store the preview image
         addProperty("preview", QVariant::fromValue(QImage()), NodeProperty::String);
@@ -12,9 +12,46 @@
 class Node
 {
 public:
+    // Node type resolved when the type is set, so render code switches on it instead of
+    // comparing type names
+    enum class Kind
+    {
+        Other,
+        Output,
+        LoadImage,
+        SequenceSource,
+        SequenceOutput,
+        Blur,
+        Sharpen,
+        Grayscale,
+        Brightness,
+        ChannelSplitter,
+        Bilateral,
+        GuidedFilter,
+        Median,
+        Morphology,
+        Lut3D,
+        Convolution,
+        Expression,
+        AutoLevels,
+        HistogramEqualize,
+        Clahe,
+        Crop,
+        Resize,
+        Rotate
+    };
+
     // Constructor
     Node(const QImage &image, const QPoint &position, const QString &type = "default", const QString &name = "");
 
+    // Copies own their properties, so a copy (an undo snapshot, a render's private
+    // chain) never sees later edits to the original
+    Node(const Node &other);
+    Node(Node &&other) noexcept;
+    Node &operator=(const Node &other);
+    Node &operator=(Node &&other) noexcept;
+    ~Node();
+
     // Getter/Setter for node properties
     QImage getImage() const;
     QPoint getPosition() const;
@@ -28,6 +65,7 @@ public:
 
     QString getType() const;
     void setType(const QString &type);
+    Kind kind() const;
 
     QString getName() const;
     void setName(const QString &name);
@@ -35,9 +73,17 @@ public:
     // Node properties management
     void addProperty(const QString &name, const QVariant &value, NodeProperty::Type type);
     NodeProperty *getProperty(const QString &name);
+    const NodeProperty *getProperty(const QString &name) const;
     QList<NodeProperty *> getAllProperties() const;
     bool hasProperty(const QString &name) const;
 
+    // Highest version stamp of the node's properties; unchanged means no parameter
+    // has been edited since it was last read
+    quint64 version() const;
+    // Hash of the type and every property value, combined from the hashes each
+    // property keeps, so it costs no string hashing or variant conversion
+    quint64 contentKey() const;
+
     // Create default properties based on node type
     void initializeDefaultProperties();
 
@@ -54,6 +100,8 @@ private:
     bool m_selected;
     QString m_type;
     QString m_name;
+    quint64 m_typeKey;
+    Kind m_kind;
     QList<Node *> m_children;                   // List of child nodes
     QMap<QString, NodeProperty *> m_properties; // Properties for this node
 };
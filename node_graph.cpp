@@ -0,0 +1,149 @@
+// node_graph.cpp
+#include "node_graph.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+NodeGraph::~NodeGraph()
+{
+    qDeleteAll(m_nodes);
+}
+
+bool NodeGraph::load(const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        if (error)
+            *error = "Failed to open graph: " + path;
+        return false;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (document.isNull())
+    {
+        if (error)
+            *error = "Invalid graph file " + path + ": " + parseError.errorString();
+        return false;
+    }
+
+    qDeleteAll(m_nodes);
+    m_nodes.clear();
+
+    // Create every node first, then connect them by index
+    const QJsonArray nodeArray = document.object().value("nodes").toArray();
+    for (const QJsonValue &value : nodeArray)
+    {
+        QJsonObject object = value.toObject();
+        QPoint position(object.value("x").toInt(), object.value("y").toInt());
+        Node *node = new Node(QImage(), position, object.value("type").toString(), object.value("name").toString());
+
+        // Only properties the node type knows about are restored, keeping their types
+        QJsonObject properties = object.value("properties").toObject();
+        for (auto it = properties.begin(); it != properties.end(); ++it)
+        {
+            if (node->hasProperty(it.key()))
+                node->getProperty(it.key())->setValue(it.value().toVariant());
+        }
+        m_nodes.append(node);
+    }
+
+    for (int i = 0; i < nodeArray.size(); ++i)
+    {
+        for (const QJsonValue &child : nodeArray.at(i).toObject().value("children").toArray())
+        {
+            int index = child.toInt(-1);
+            if (index >= 0 && index < m_nodes.size())
+                m_nodes[i]->addChildNode(m_nodes[index]);
+        }
+    }
+
+    return true;
+}
+
+Node *NodeGraph::copyChain(Node *outputNode)
+{
+    qDeleteAll(m_nodes);
+    m_nodes.clear();
+    if (!outputNode)
+        return nullptr;
+
+    auto copy = [this](Node *original)
+    {
+        Node *node = new Node(QImage(), original->getPosition(), original->getType(), original->getName());
+        for (NodeProperty *prop : original->getAllProperties())
+        {
+            if (node->hasProperty(prop->getName()))
+                node->getProperty(prop->getName())->setValue(prop->getValue());
+        }
+        m_nodes.append(node);
+        return node;
+    };
+
+    Node *output = copy(outputNode);
+    QList<Node *> children = outputNode->getChildren();
+    if (!children.isEmpty() && children.first())
+    {
+        Node *source = copy(children.first());
+        output->addChildNode(source);
+        for (Node *effectNode : children.first()->getChildren())
+        {
+            if (effectNode)
+                source->addChildNode(copy(effectNode));
+        }
+    }
+    return output;
+}
+
+bool NodeGraph::save(const QList<Node *> &nodes, const QString &path)
+{
+    QJsonArray nodeArray;
+    for (Node *node : nodes)
+    {
+        QJsonObject properties;
+        for (NodeProperty *prop : node->getAllProperties())
+        {
+            // Images (previews, placeholders) are runtime state and not saved
+            QJsonValue value = QJsonValue::fromVariant(prop->getValue());
+            if (!value.isNull() && !value.isUndefined())
+                properties.insert(prop->getName(), value);
+        }
+
+        QJsonArray children;
+        for (Node *child : node->getChildren())
+        {
+            children.append(nodes.indexOf(child));
+        }
+
+        QJsonObject object;
+        object.insert("name", node->getName());
+        object.insert("type", node->getType());
+        object.insert("x", node->getPosition().x());
+        object.insert("y", node->getPosition().y());
+        object.insert("properties", properties);
+        object.insert("children", children);
+        nodeArray.append(object);
+    }
+
+    QJsonObject root;
+    root.insert("nodes", nodeArray);
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument(root).toJson());
+    return file.commit();
+}
+
+Node *NodeGraph::findFirst(const QString &type) const
+{
+    for (Node *node : m_nodes)
+    {
+        if (node->getType() == type)
+            return node;
+    }
+    return nullptr;
+}
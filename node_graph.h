@@ -0,0 +1,39 @@
+// node_graph.h
+#ifndef NODE_GRAPH_H
+#define NODE_GRAPH_H
+
+#include <QList>
+#include <QString>
+#include "node.h"
+
+// A node graph stored as JSON, so it can be built in the editor and then run headless.
+// Loaded graphs own their nodes.
+class NodeGraph
+{
+public:
+    NodeGraph() = default;
+    ~NodeGraph();
+    NodeGraph(const NodeGraph &) = delete;
+    NodeGraph &operator=(const NodeGraph &) = delete;
+
+    // Replace the current nodes with the graph stored at path
+    bool load(const QString &path, QString *error = nullptr);
+
+    // Replace the current nodes with a copy of the chain feeding outputNode (the Output,
+    // its source and the source's effects), so it can be rendered on another thread
+    // while the originals are edited. Returns the copied Output node.
+    Node *copyChain(Node *outputNode);
+
+    // Write nodes, their properties and connections to path
+    static bool save(const QList<Node *> &nodes, const QString &path);
+
+    QList<Node *> nodes() const { return m_nodes; }
+
+    // First node of the given type, or nullptr
+    Node *findFirst(const QString &type) const;
+
+private:
+    QList<Node *> m_nodes;
+};
+
+#endif // NODE_GRAPH_H
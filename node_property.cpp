@@ -0,0 +1,143 @@
+// node_property.cpp
+#include "node_property.h"
+#include "content_hash.h"
+#include <QLocale>
+#include <atomic>
+#include <limits>
+
+namespace
+{
+    std::atomic<quint64> versionCounter{0};
+
+    quint64 nextVersion()
+    {
+        return ++versionCounter;
+    }
+
+    bool fitsInt(qint64 value)
+    {
+        return value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max();
+    }
+}
+
+NodeProperty::NodeProperty(const QString &name, const QVariant &value, Type type)
+    : m_name(name), m_type(type)
+{
+    setValue(value);
+}
+
+QVariant NodeProperty::getValue() const
+{
+    switch (m_storage)
+    {
+    case Storage::Int: return QVariant(static_cast<int>(m_number));
+    case Storage::Double: return QVariant(m_number);
+    case Storage::Bool: return QVariant(m_number != 0.0);
+    case Storage::Text: return QVariant(m_text);
+    case Storage::Variant: return m_variant;
+    }
+    return QVariant();
+}
+
+void NodeProperty::setValue(const QVariant &value)
+{
+    Storage storage = Storage::Variant;
+    double number = 0.0;
+    QString text;
+    switch (value.typeId())
+    {
+    case QMetaType::Int:
+    case QMetaType::Short:
+    case QMetaType::Char:
+        storage = Storage::Int;
+        number = value.toInt();
+        break;
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        // JSON documents load whole numbers as 64-bit integers
+        storage = fitsInt(value.toLongLong()) ? Storage::Int : Storage::Double;
+        number = value.toDouble();
+        break;
+    case QMetaType::Double:
+    case QMetaType::Float:
+        storage = Storage::Double;
+        number = value.toDouble();
+        break;
+    case QMetaType::Bool:
+        storage = Storage::Bool;
+        number = value.toBool() ? 1.0 : 0.0;
+        break;
+    case QMetaType::QString:
+        storage = Storage::Text;
+        text = value.toString();
+        break;
+    default:
+        break;
+    }
+
+    // Unchanged scalars keep their stamp; boxed values are too costly to compare (a
+    // preview image) and always count as changed
+    if (m_version != 0 && storage == m_storage && storage != Storage::Variant &&
+        (storage == Storage::Text ? text == m_text : number == m_number))
+        return;
+
+    m_storage = storage;
+    m_number = number;
+    m_text = text;
+    m_variant = storage == Storage::Variant ? value : QVariant();
+    m_hash = ContentHash::string(toString(), ContentHash::string(m_name));
+    m_version = nextVersion();
+}
+
+int NodeProperty::toInt() const
+{
+    switch (m_storage)
+    {
+    case Storage::Int:
+    case Storage::Bool: return static_cast<int>(m_number);
+    case Storage::Double: return qRound(m_number);
+    case Storage::Text: return m_text.toInt();
+    case Storage::Variant: return m_variant.toInt();
+    }
+    return 0;
+}
+
+double NodeProperty::toDouble() const
+{
+    switch (m_storage)
+    {
+    case Storage::Int:
+    case Storage::Double:
+    case Storage::Bool: return m_number;
+    case Storage::Text: return m_text.toDouble();
+    case Storage::Variant: return m_variant.toDouble();
+    }
+    return 0.0;
+}
+
+bool NodeProperty::toBool() const
+{
+    switch (m_storage)
+    {
+    case Storage::Int:
+    case Storage::Double:
+    case Storage::Bool: return m_number != 0.0;
+    case Storage::Text: return !(m_text.isEmpty() || m_text == "0" || m_text.compare("false", Qt::CaseInsensitive) == 0);
+    case Storage::Variant: return m_variant.toBool();
+    }
+    return false;
+}
+
+QString NodeProperty::toString() const
+{
+    switch (m_storage)
+    {
+    case Storage::Int: return QString::number(static_cast<int>(m_number));
+    case Storage::Double: return QString::number(m_number, 'g', QLocale::FloatingPointShortest);
+    case Storage::Bool: return m_number != 0.0 ? "true" : "false";
+    case Storage::Text: return m_text;
+    case Storage::Variant: return m_variant.toString();
+    }
+    return QString();
+}
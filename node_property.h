@@ -2,6 +2,7 @@
 #define NODE_PROPERTY_H
 
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 
 class NodeProperty
@@ -18,26 +19,54 @@ public:
         Enum,
         CustomList,
         ChannelIndex,
+        Pixels, // Image coordinates and sizes
+        Angle,  // Degrees
     };
 
     // Constructor
-    NodeProperty(const QString &name, const QVariant &value, Type type)
-        : m_name(name), m_value(value), m_type(type) {}
+    NodeProperty(const QString &name, const QVariant &value, Type type);
 
     // Getter/Setter for property
     QString getName() const { return m_name; }
-    QVariant getValue() const { return m_value; }
-    void setValue(const QVariant &value) { m_value = value; }
+    QVariant getValue() const;
+    void setValue(const QVariant &value);
     Type getType() const { return m_type; }
     // For enum types
     void setEnumValues(const QStringList &values) { m_enumValues = values; }
     QStringList getEnumValues() const { return m_enumValues; }
+
+    // Typed reads for kernels; numbers and text are stored unboxed, so these convert
+    // the way QVariant would without building one
+    int toInt() const;
+    double toDouble() const;
+    bool toBool() const;
+    QString toString() const;
+
+    // Content hash of the name and value, updated when the value changes
+    quint64 hash() const { return m_hash; }
+    // Stamp from a process-wide counter, renewed whenever the value changes; equal
+    // stamps mean equal values, so change checks are one integer compare
+    quint64 version() const { return m_version; }
+
 private:
+    enum class Storage : quint8
+    {
+        Int,
+        Double,
+        Bool,
+        Text,
+        Variant // Lists, images and anything else stay boxed
+    };
+
     QString m_name;
-    QVariant m_value;
     Type m_type;
+    Storage m_storage = Storage::Int;
+    double m_number = 0.0; // Int, Double and Bool storage
+    QString m_text;        // Text storage
+    QVariant m_variant;    // Variant storage
+    quint64 m_hash = 0;
+    quint64 m_version = 0;
     QStringList m_enumValues; // For enum types
-    // List of child nodes
 };
 
 #endif // NODE_PROPERTY_H
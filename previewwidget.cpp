@@ -0,0 +1,241 @@
+// previewwidget.cpp
+#include "previewwidget.h"
+#include <QPainter>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QResizeEvent>
+#include <QTimer>
+#include <QtMath>
+#include <cmath>
+
+namespace
+{
+    const int TileSize = 256;
+    const double MaxZoom = 32.0;
+
+    quint64 tileKey(int level, int tx, int ty)
+    {
+        return (quint64(level) << 48) | (quint64(tx) << 24) | quint64(ty);
+    }
+}
+
+PreviewWidget::PreviewWidget(QWidget *parent)
+    : QWidget(parent)
+{
+    m_tiles.setMaxCost(256 * 1024 * 1024); // Cost is the tile's size in bytes
+    m_renderPool.setMaxThreadCount(1);      // Each kernel already spreads over the thread budget
+    setMouseTracking(false);
+    setCursor(Qt::OpenHandCursor);
+}
+
+void PreviewWidget::setRenderer(const Renderer &renderer)
+{
+    m_renderer = renderer;
+    refresh();
+}
+
+void PreviewWidget::setImageSize(const QSize &size)
+{
+    if (size == m_imageSize)
+        return;
+
+    m_imageSize = size;
+    fitToView();
+}
+
+void PreviewWidget::refresh()
+{
+    ++m_generation;
+    m_tiles.clear();
+    m_pending.clear();
+    m_rendering = false;
+    m_failed = false;
+    update();
+}
+
+void PreviewWidget::fitToView()
+{
+    m_userAdjusted = false;
+    if (m_imageSize.isEmpty() || width() <= 0 || height() <= 0)
+        return;
+
+    m_zoom = qMin(1.0, qMin(double(width()) / m_imageSize.width(), double(height()) / m_imageSize.height()));
+    m_offset = QPointF((width() - m_imageSize.width() * m_zoom) / 2.0,
+                       (height() - m_imageSize.height() * m_zoom) / 2.0);
+    update();
+}
+
+int PreviewWidget::levelForZoom(double zoom)
+{
+    // Level L renders at scale 2^-L; pick the smallest one that is still at least the zoom
+    if (zoom >= 1.0)
+        return 0;
+    return static_cast<int>(std::floor(std::log2(1.0 / zoom)));
+}
+
+QSize PreviewWidget::levelSize(int level) const
+{
+    // Must match the executor's rounding of the scaled source size
+    double scale = std::ldexp(1.0, -level);
+    return QSize(qMax(1, qRound(m_imageSize.width() * scale)), qMax(1, qRound(m_imageSize.height() * scale)));
+}
+
+void PreviewWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor("#333333"));
+
+    if (!m_renderer || m_imageSize.isEmpty())
+    {
+        painter.setPen(Qt::lightGray);
+        painter.drawText(rect(), Qt::AlignCenter, "No preview available");
+        return;
+    }
+
+    const int level = levelForZoom(m_zoom);
+    const QSize size = levelSize(level);
+    const double drawScale = m_zoom / std::ldexp(1.0, -level); // Screen pixels per level pixel
+
+    // Visible part of the image in level pixels
+    QRectF visible(-m_offset.x() / drawScale, -m_offset.y() / drawScale, width() / drawScale, height() / drawScale);
+    visible &= QRectF(0, 0, size.width(), size.height());
+
+    m_pending.clear();
+    if (visible.isEmpty())
+        return;
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, drawScale < 1.0);
+
+    const int tx0 = static_cast<int>(visible.left()) / TileSize;
+    const int ty0 = static_cast<int>(visible.top()) / TileSize;
+    const int tx1 = (static_cast<int>(std::ceil(visible.right())) - 1) / TileSize;
+    const int ty1 = (static_cast<int>(std::ceil(visible.bottom())) - 1) / TileSize;
+
+    for (int ty = ty0; ty <= ty1; ++ty)
+    {
+        for (int tx = tx0; tx <= tx1; ++tx)
+        {
+            QRect tileRect = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize) & QRect(QPoint(0, 0), size);
+            QRectF target(m_offset.x() + tileRect.x() * drawScale, m_offset.y() + tileRect.y() * drawScale,
+                          tileRect.width() * drawScale, tileRect.height() * drawScale);
+
+            quint64 key = tileKey(level, tx, ty);
+            if (QImage *tile = m_tiles.object(key))
+            {
+                painter.drawImage(target, *tile);
+            }
+            else
+            {
+                painter.fillRect(target, QColor("#444444"));
+                m_pending.append(key);
+            }
+        }
+    }
+
+    if (!m_pending.isEmpty() && !m_rendering && !m_failed && !m_renderScheduled)
+    {
+        m_renderScheduled = true;
+        QTimer::singleShot(0, this, &PreviewWidget::renderPendingTiles);
+    }
+}
+
+void PreviewWidget::renderPendingTiles()
+{
+    m_renderScheduled = false;
+    if (m_pending.isEmpty() || m_rendering || m_failed)
+        return;
+
+    // Only the first missing tile goes to the worker; by the time it is done the view may
+    // have moved, and the next repaint lists what is visible then
+    quint64 key = m_pending.takeFirst();
+    int level = static_cast<int>(key >> 48);
+    int tx = static_cast<int>((key >> 24) & 0xFFFFFF);
+    int ty = static_cast<int>(key & 0xFFFFFF);
+    QRect roi = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize) & QRect(QPoint(0, 0), levelSize(level));
+
+    m_rendering = true;
+    Renderer renderer = m_renderer;
+    int generation = m_generation;
+    m_renderPool.start([this, renderer, generation, key, level, roi]()
+                       {
+        QImage tile = renderer(std::ldexp(1.0, -level), roi);
+        QMetaObject::invokeMethod(this, [this, generation, key, tile]()
+                                  { tileRendered(generation, key, tile); }, Qt::QueuedConnection); });
+}
+
+void PreviewWidget::tileRendered(int generation, quint64 key, const QImage &tile)
+{
+    if (generation != m_generation)
+        return; // Rendered before a refresh; whatever replaced it is already queued
+
+    m_rendering = false;
+    if (tile.isNull())
+    {
+        // Nothing to show; stop instead of retrying every tile
+        m_failed = true;
+        m_pending.clear();
+        return;
+    }
+    m_tiles.insert(key, new QImage(tile), tile.sizeInBytes());
+
+    // Repainting queues whatever is still missing
+    update();
+}
+
+void PreviewWidget::wheelEvent(QWheelEvent *event)
+{
+    if (m_imageSize.isEmpty())
+        return;
+
+    // Zoom around the cursor
+    double fitZoom = qMin(double(width()) / m_imageSize.width(), double(height()) / m_imageSize.height());
+    double newZoom = qBound(qMin(fitZoom, 1.0) / 2.0, m_zoom * std::pow(1.0015, event->angleDelta().y()), MaxZoom);
+    QPointF pos = event->position();
+    m_offset = pos - (pos - m_offset) * (newZoom / m_zoom);
+    m_zoom = newZoom;
+    m_userAdjusted = true;
+    update();
+    event->accept();
+}
+
+void PreviewWidget::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton)
+    {
+        m_panning = true;
+        m_lastMousePos = event->pos();
+        setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void PreviewWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (m_panning)
+    {
+        m_offset += event->pos() - m_lastMousePos;
+        m_lastMousePos = event->pos();
+        m_userAdjusted = true;
+        update();
+    }
+}
+
+void PreviewWidget::mouseReleaseEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    m_panning = false;
+    setCursor(Qt::OpenHandCursor);
+}
+
+void PreviewWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    fitToView();
+}
+
+void PreviewWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (!m_userAdjusted)
+        fitToView();
+}
@@ -0,0 +1,70 @@
+// previewwidget.h
+#ifndef PREVIEWWIDGET_H
+#define PREVIEWWIDGET_H
+
+#include <QWidget>
+#include <QImage>
+#include <QCache>
+#include <QList>
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QSize>
+#include <QThreadPool>
+#include <functional>
+
+// Zoomable, pannable view of an Output node's result.
+// The image is split into tiles per zoom level and only the visible tiles are
+// requested from the renderer, so inspecting a corner of a huge output only
+// costs as much as that corner. Tiles render on a worker thread, one at a time, and
+// are shown as they arrive.
+class PreviewWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    // Renders roi (in pixels of the scaled image) of the output at the given scale. Runs
+    // on a worker thread, so it must not read nodes the GUI can edit meanwhile.
+    using Renderer = std::function<QImage(double scale, const QRect &roi)>;
+
+    explicit PreviewWidget(QWidget *parent = nullptr);
+
+    void setRenderer(const Renderer &renderer);
+    // Full-resolution size of the output; refits the view when it changes
+    void setImageSize(const QSize &size);
+    // Drop every rendered tile, e.g. after node parameters changed; a tile still
+    // rendering is discarded when it arrives
+    void refresh();
+    void fitToView();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    static int levelForZoom(double zoom);
+    QSize levelSize(int level) const;
+    void renderPendingTiles();
+    void tileRendered(int generation, quint64 key, const QImage &tile);
+
+    Renderer m_renderer;
+    QSize m_imageSize;
+    double m_zoom = 1.0;          // Screen pixels per full-resolution pixel
+    QPointF m_offset;             // Screen position of the image's top-left corner
+    QPoint m_lastMousePos;
+    bool m_panning = false;
+    bool m_userAdjusted = false;  // Keep the view on resize once the user zoomed or panned
+    QCache<quint64, QImage> m_tiles; // Rendered tiles keyed by level and position
+    QList<quint64> m_pending;        // Visible tiles still to render
+    bool m_renderScheduled = false;
+    bool m_rendering = false;        // A tile is on the worker
+    bool m_failed = false;           // The renderer gave nothing; don't retry until refresh()
+    int m_generation = 0;            // Renewed by refresh(), so stale tiles are dropped
+    QThreadPool m_renderPool;        // Declared last, so it is drained before the members above go
+};
+
+#endif // PREVIEWWIDGET_H
@@ -0,0 +1,63 @@
+// priority_gate.cpp
+#include "priority_gate.h"
+#include "thread_budget.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace
+{
+    std::mutex gateMutex;
+    std::condition_variable interactiveDone;
+    int interactiveActive = 0;
+
+    // Threads run at interactive priority unless they say otherwise, so
+    // unmarked work is never held back
+    thread_local PriorityGate::Priority threadPriority = PriorityGate::Interactive;
+    thread_local int interactiveDepth = 0; // Nested interactive scopes count once
+}
+
+PriorityGate::Scope::Scope(Priority priority)
+    : m_previous(threadPriority)
+{
+    threadPriority = priority;
+    if (priority == Interactive && interactiveDepth++ == 0)
+    {
+        std::lock_guard<std::mutex> lock(gateMutex);
+        ++interactiveActive;
+    }
+}
+
+PriorityGate::Scope::~Scope()
+{
+    if (threadPriority == Interactive && --interactiveDepth == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(gateMutex);
+            --interactiveActive;
+        }
+        interactiveDone.notify_all();
+    }
+    threadPriority = m_previous;
+}
+
+void PriorityGate::checkpoint()
+{
+    if (threadPriority != Background)
+        return;
+
+    std::unique_lock<std::mutex> lock(gateMutex);
+    if (interactiveActive == 0)
+        return;
+
+    // Hand our slots to the interactive work while parked, then take them back
+    int held = ThreadBudget::heldByCurrentThread();
+    ThreadBudget::release(held);
+    interactiveDone.wait(lock, []() { return interactiveActive == 0; });
+    lock.unlock();
+    ThreadBudget::acquire(held);
+}
+
+PriorityGate::Priority PriorityGate::current()
+{
+    return threadPriority;
+}
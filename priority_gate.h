@@ -0,0 +1,39 @@
+// priority_gate.h
+#ifndef PRIORITY_GATE_H
+#define PRIORITY_GATE_H
+
+// Lets interactive work (previews of the selected Output node) preempt background
+// work (exports, sequence renders). Background work calls checkpoint() between
+// nodes and tiles; while any interactive work is running, it parks there, gives
+// its thread-budget slots to the interactive work, and later resumes at the same
+// point instead of starting over.
+class PriorityGate
+{
+public:
+    enum Priority
+    {
+        Interactive,
+        Background,
+    };
+
+    // Runs the calling thread's work at the given priority for the scope's lifetime
+    class Scope
+    {
+    public:
+        explicit Scope(Priority priority);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Priority m_previous;
+    };
+
+    // Wait here if the calling thread is running background work and interactive
+    // work is in progress; returns immediately otherwise
+    static void checkpoint();
+
+    static Priority current();
+};
+
+#endif // PRIORITY_GATE_H
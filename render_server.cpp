@@ -0,0 +1,341 @@
+// render_server.cpp
+#include "render_server.h"
+#include "image_processor.h"
+#include "metrics.h"
+#include "node_graph.h"
+#include "renditions.h"
+#include "thread_budget.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QRegularExpression>
+#include <QSharedMemory>
+#include <QThread>
+
+namespace
+{
+    const qint64 MaxRequestBytes = 64 * 1024; // A request line longer than this is dropped
+    const int MetricsIntervalMs = 10000;
+
+    QJsonObject errorResponse(const QString &message)
+    {
+        QJsonObject response;
+        response.insert("ok", false);
+        response.insert("error", message);
+        return response;
+    }
+
+    // Copy an image handed over in shared memory
+    cv::Mat readSharedMemory(const QJsonObject &request, QString *error)
+    {
+        int width = request.value("width").toInt();
+        int height = request.value("height").toInt();
+        int channels = request.value("channels").toInt(3);
+        int stride = request.value("stride").toInt(width * channels);
+        if (width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4) || stride < width * channels)
+        {
+            *error = "Invalid shared-memory image description";
+            return cv::Mat();
+        }
+
+        QSharedMemory memory;
+        memory.setNativeKey(request.value("shm").toString());
+        if (!memory.attach(QSharedMemory::ReadOnly))
+        {
+            *error = "Cannot attach shared memory: " + memory.errorString();
+            return cv::Mat();
+        }
+        if (static_cast<qint64>(stride) * height > memory.size())
+        {
+            *error = "Shared memory segment is smaller than the described image";
+            return cv::Mat();
+        }
+
+        memory.lock();
+        cv::Mat image = cv::Mat(height, width, CV_8UC(channels), const_cast<void *>(memory.constData()), stride).clone();
+        memory.unlock();
+        return image;
+    }
+}
+
+struct RenderServer::GraphInstance
+{
+    NodeGraph graph;
+    Node *outputNode = nullptr;
+    Node *sourceNode = nullptr;
+};
+
+RenderServer::RenderServer(const Options &options, QObject *parent)
+    : QObject(parent), m_options(options), m_executor(nullptr)
+{
+    m_pool.setMaxThreadCount(options.workers > 0 ? options.workers : ThreadBudget::total());
+    connect(&m_server, &QLocalServer::newConnection, this, &RenderServer::acceptConnection);
+
+    m_metricsTimer.setInterval(MetricsIntervalMs);
+    connect(&m_metricsTimer, &QTimer::timeout, this, [this]()
+            {
+        if (!Metrics::writeFile(m_options.metricsPath))
+            qWarning() << "Cannot write metrics file:" << m_options.metricsPath; });
+}
+
+RenderServer::~RenderServer()
+{
+    for (int id : m_gaugeIds)
+        Metrics::removeGauge(id);
+    m_server.close();
+    m_pool.waitForDone();
+    for (const QList<GraphInstance *> &instances : m_idleGraphs)
+    {
+        qDeleteAll(instances);
+    }
+}
+
+bool RenderServer::start(QString *error)
+{
+    if (!QDir(m_options.graphDir).exists())
+    {
+        if (error)
+            *error = "Graph folder does not exist: " + m_options.graphDir;
+        return false;
+    }
+
+    // A socket left behind by a crashed server would make listen() fail
+    QLocalServer::removeServer(m_options.socketName);
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_server.listen(m_options.socketName))
+    {
+        if (error)
+            *error = "Cannot listen on " + m_options.socketName + ": " + m_server.errorString();
+        return false;
+    }
+
+    m_gaugeIds.append(Metrics::addGauge("nie_server_queued_requests", "Render requests waiting for a worker.",
+                                        [this]() { return double(m_queued.load()); }));
+    m_gaugeIds.append(Metrics::addGauge("nie_server_active_requests", "Render requests being processed.",
+                                        [this]() { return double(m_active.load()); }));
+    if (!m_options.metricsPath.isEmpty())
+        m_metricsTimer.start();
+
+    qInfo() << "Render server listening on" << m_server.fullServerName() << "with"
+            << m_pool.maxThreadCount() << "workers";
+    return true;
+}
+
+void RenderServer::acceptConnection()
+{
+    while (QLocalSocket *socket = m_server.nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]()
+                {
+            while (socket->canReadLine())
+            {
+                QByteArray line = socket->readLine().trimmed();
+                if (!line.isEmpty())
+                    handleLine(socket, line);
+            }
+            if (socket->bytesAvailable() > MaxRequestBytes)
+                socket->abort(); });
+    }
+}
+
+void RenderServer::handleLine(QLocalSocket *socket, const QByteArray &line)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    auto reply = [](QLocalSocket *target, QJsonObject response, const QJsonValue &id)
+    {
+        if (!id.isUndefined())
+            response.insert("id", id);
+        target->write(QJsonDocument(response).toJson(QJsonDocument::Compact) + "\n");
+    };
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+    if (!document.isObject())
+    {
+        reply(socket, errorResponse("Invalid request: " + parseError.errorString()), QJsonValue::Undefined);
+        return;
+    }
+
+    const QJsonObject request = document.object();
+    const QJsonValue id = request.value("id");
+    if (request.value("cmd").toString() == "stats")
+    {
+        reply(socket, stats(), id);
+        return;
+    }
+    if (request.value("cmd").toString() == "metrics")
+    {
+        QJsonObject response;
+        response.insert("ok", true);
+        response.insert("metrics", Metrics::prometheusText());
+        reply(socket, response, id);
+        return;
+    }
+
+    // Admission control: refuse work rather than let the queue grow without bound
+    if (m_queued >= m_options.maxQueued)
+    {
+        ++m_rejected;
+        reply(socket, errorResponse("busy"), id);
+        return;
+    }
+
+    ++m_queued;
+    QPointer<QLocalSocket> target(socket);
+    m_pool.start([this, request, id, target, timer, reply]()
+                 {
+        --m_queued;
+        QJsonObject response;
+        {
+            ThreadBudget::Slot slot;
+            ++m_active;
+            response = render(request);
+            --m_active;
+        }
+        response.insert("ms", timer.nsecsElapsed() / 1e6);
+
+        // Sockets belong to the server thread, so the reply is written from there
+        QMetaObject::invokeMethod(this, [target, response, id, reply]()
+                                  {
+            if (target)
+                reply(target, response, id); }, Qt::QueuedConnection); });
+}
+
+QJsonObject RenderServer::render(const QJsonObject &request)
+{
+    const QString graphId = request.value("graph").toString();
+    const QString outputPath = request.value("output").toString();
+    if (outputPath.isEmpty())
+    {
+        ++m_failed;
+        return errorResponse("Missing output path");
+    }
+
+    QString error;
+    GraphInstance *instance = acquireGraph(graphId, &error);
+    if (!instance)
+    {
+        ++m_failed;
+        return errorResponse(error);
+    }
+
+    QString format = request.value("format").toString(instance->outputNode->getProperty("outputFormat")->toString());
+    int quality = request.value("quality").toInt(instance->outputNode->getProperty("quality")->toInt());
+    QList<Renditions::Rendition> renditions = Renditions::parse(
+        request.value("renditions").toString(instance->outputNode->getProperty("renditions")->toString()), format);
+
+    cv::Mat result;
+    try
+    {
+        if (request.contains("shm"))
+        {
+            cv::Mat source = readSharedMemory(request, &error);
+            if (!source.empty())
+                result = m_executor.evaluateImage(instance->outputNode, source);
+        }
+        else
+        {
+            instance->sourceNode->getProperty("filePath")->setValue(request.value("input").toString());
+            result = m_executor.evaluate(instance->outputNode);
+        }
+    }
+    catch (const cv::Exception &e)
+    {
+        error = e.what();
+    }
+    releaseGraph(graphId, instance);
+
+    if (result.empty())
+    {
+        ++m_failed;
+        return errorResponse(error.isEmpty() ? "Render failed" : error);
+    }
+    QJsonObject response;
+    if (renditions.isEmpty())
+    {
+        if (!ImageProcessor::writeImage(result, outputPath, format, quality))
+        {
+            ++m_failed;
+            return errorResponse("Failed to write " + outputPath);
+        }
+        response.insert("output", outputPath);
+    }
+    else
+    {
+        QStringList written = Renditions::write(result, renditions, outputPath, quality);
+        if (written.size() != renditions.size())
+        {
+            ++m_failed;
+            return errorResponse("Failed to write renditions of " + outputPath);
+        }
+        response.insert("outputs", QJsonArray::fromStringList(written));
+    }
+
+    ++m_served;
+    response.insert("ok", true);
+    response.insert("width", result.cols);
+    response.insert("height", result.rows);
+    return response;
+}
+
+RenderServer::GraphInstance *RenderServer::acquireGraph(const QString &id, QString *error)
+{
+    // Graph ids are plain file names inside the graph folder
+    static const QRegularExpression validId("^[A-Za-z0-9_.-]+$");
+    if (!validId.match(id).hasMatch() || id.startsWith('.'))
+    {
+        *error = "Invalid graph id: " + id;
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_graphMutex);
+        QList<GraphInstance *> &idle = m_idleGraphs[id];
+        if (!idle.isEmpty())
+            return idle.takeLast();
+    }
+
+    // No idle copy: load another one, which then stays resident
+    GraphInstance *instance = new GraphInstance;
+    if (!instance->graph.load(QDir(m_options.graphDir).filePath(id + ".json"), error))
+    {
+        delete instance;
+        return nullptr;
+    }
+
+    instance->outputNode = instance->graph.findFirst("Output");
+    if (!instance->outputNode || instance->outputNode->getChildren().isEmpty() ||
+        instance->outputNode->getChildren().first()->getType() != "Load Image")
+    {
+        *error = "Graph " + id + " needs an Output node connected to a Load Image node";
+        delete instance;
+        return nullptr;
+    }
+    instance->sourceNode = instance->outputNode->getChildren().first();
+    return instance;
+}
+
+void RenderServer::releaseGraph(const QString &id, GraphInstance *instance)
+{
+    std::lock_guard<std::mutex> lock(m_graphMutex);
+    m_idleGraphs[id].append(instance);
+}
+
+QJsonObject RenderServer::stats() const
+{
+    QJsonObject response;
+    response.insert("ok", true);
+    response.insert("active", m_active.load());
+    response.insert("queued", m_queued.load());
+    response.insert("served", static_cast<qint64>(m_served.load()));
+    response.insert("rejected", static_cast<qint64>(m_rejected.load()));
+    response.insert("failed", static_cast<qint64>(m_failed.load()));
+    return response;
+}
@@ -0,0 +1,77 @@
+// render_server.h
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QLocalServer>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <atomic>
+#include <mutex>
+#include "graph_executor.h"
+
+class QLocalSocket;
+
+// Local render service on a Unix domain socket. Clients send one JSON request per line:
+//   {"id": 1, "graph": "retouch", "input": "/in/a.png", "output": "/out/a.jpg"}
+//   {"id": 2, "graph": "retouch", "shm": "<native key>", "width": 640, "height": 480,
+//    "channels": 3, "stride": 1920, "output": "/out/b.png", "format": "PNG", "quality": 90}
+//   {"id": 3, "cmd": "stats"}
+//   {"id": 4, "cmd": "metrics"}   (engine metrics in Prometheus text format)
+// and receive one JSON line per request. Shared-memory pixels are 8-bit BGR, BGRA or gray.
+// Graphs (<graphDir>/<graph>.json), the executor's source cache and the worker pool stay
+// resident, so a request costs only its own rendering.
+class RenderServer : public QObject
+{
+    Q_OBJECT
+public:
+    struct Options
+    {
+        QString socketName;
+        QString graphDir;
+        int workers = 0;     // Concurrent renders; <= 0 uses the thread budget
+        int maxQueued = 64;  // Requests beyond this many waiting are rejected as busy
+        QString metricsPath; // Optional file rewritten with engine metrics in Prometheus format
+    };
+
+    explicit RenderServer(const Options &options, QObject *parent = nullptr);
+    ~RenderServer();
+
+    bool start(QString *error = nullptr);
+
+private slots:
+    void acceptConnection();
+
+private:
+    struct GraphInstance;
+
+    void handleLine(QLocalSocket *socket, const QByteArray &line);
+    QJsonObject render(const QJsonObject &request);
+    GraphInstance *acquireGraph(const QString &id, QString *error);
+    void releaseGraph(const QString &id, GraphInstance *instance);
+    QJsonObject stats() const;
+
+    Options m_options;
+    QLocalServer m_server;
+    QThreadPool m_pool;
+    GraphExecutor m_executor;
+    QTimer m_metricsTimer;
+    QList<int> m_gaugeIds;
+
+    // Idle loaded graphs per id; a render borrows one so concurrent requests never share nodes
+    std::mutex m_graphMutex;
+    QHash<QString, QList<GraphInstance *>> m_idleGraphs;
+
+    std::atomic<int> m_queued{0};
+    std::atomic<int> m_active{0};
+    std::atomic<quint64> m_served{0};
+    std::atomic<quint64> m_rejected{0};
+    std::atomic<quint64> m_failed{0};
+};
+
+#endif // RENDER_SERVER_H
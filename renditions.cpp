@@ -0,0 +1,117 @@
+// renditions.cpp
+#include "renditions.h"
+#include "image_processor.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QDir>
+#include <QMap>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace
+{
+    bool contains(const QList<Renditions::Rendition> &renditions, const Renditions::Rendition &rendition)
+    {
+        for (const Renditions::Rendition &other : renditions)
+        {
+            if (other.longEdge == rendition.longEdge && other.format == rendition.format)
+                return true;
+        }
+        return false;
+    }
+}
+
+namespace Renditions
+{
+    QList<Rendition> parse(const QString &spec, const QString &defaultFormat)
+    {
+        QList<Rendition> renditions;
+        for (const QString &entry : spec.split(',', Qt::SkipEmptyParts))
+        {
+            QStringList parts = entry.trimmed().split(':');
+            bool ok = false;
+            Rendition rendition;
+            rendition.longEdge = parts[0].trimmed().toInt(&ok);
+            rendition.format = parts.size() > 1 ? parts[1].trimmed().toUpper() : defaultFormat.toUpper();
+            if (!ok || rendition.longEdge <= 0 || rendition.format.isEmpty())
+            {
+                qDebug() << "Ignoring invalid rendition:" << entry;
+                continue;
+            }
+            if (contains(renditions, rendition))
+                continue;
+            renditions.append(rendition);
+        }
+        return renditions;
+    }
+
+    QString path(const QString &basePath, const Rendition &rendition)
+    {
+        QFileInfo info(basePath);
+        return info.dir().filePath(QString("%1_%2.%3")
+                                       .arg(info.completeBaseName())
+                                       .arg(rendition.longEdge)
+                                       .arg(rendition.format.toLower()));
+    }
+
+    QStringList write(const cv::Mat &result, const QList<Rendition> &requested,
+                      const QString &basePath, int quality)
+    {
+        if (result.empty() || requested.isEmpty())
+            return QStringList();
+
+        // Two encodes of the same size and format would race on one file
+        QList<Rendition> renditions;
+        for (const Rendition &rendition : requested)
+        {
+            if (!contains(renditions, rendition))
+                renditions.append(rendition);
+        }
+
+        // One image per distinct size, largest first, each resized from the previous one
+        std::vector<int> sizes;
+        for (const Rendition &rendition : renditions)
+            sizes.push_back(rendition.longEdge);
+        std::sort(sizes.begin(), sizes.end(), std::greater<int>());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+        QMap<int, cv::Mat> scaled;
+        cv::Mat previous = result;
+        for (int size : sizes)
+        {
+            int longEdge = qMax(previous.cols, previous.rows);
+            if (size < longEdge)
+            {
+                double factor = double(size) / longEdge;
+                cv::Size target(qMax(1, qRound(previous.cols * factor)), qMax(1, qRound(previous.rows * factor)));
+                cv::Mat resized;
+                cv::resize(previous, resized, target, 0, 0, cv::INTER_AREA);
+                previous = resized;
+            }
+            scaled.insert(size, previous);
+        }
+
+        // Encoding dominates now, so every rendition is encoded at once
+        std::vector<char> written(renditions.size(), 0);
+        cv::parallel_for_(cv::Range(0, static_cast<int>(renditions.size())), [&](const cv::Range &range)
+                          {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                const Rendition &rendition = renditions[i];
+                QString outputPath = path(basePath, rendition);
+                written[i] = ImageProcessor::writeImage(scaled.value(rendition.longEdge), outputPath,
+                                                        rendition.format, quality);
+                if (!written[i])
+                    qDebug() << "Failed to write rendition:" << outputPath;
+            } });
+
+        QStringList paths;
+        for (int i = 0; i < renditions.size(); ++i)
+        {
+            if (written[i])
+                paths.append(path(basePath, renditions[i]));
+        }
+        return paths;
+    }
+}
@@ -0,0 +1,36 @@
+// renditions.h
+#ifndef RENDITIONS_H
+#define RENDITIONS_H
+
+#include <opencv2/opencv.hpp>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// Several sizes and formats written from one evaluation of an Output node.
+// A rendition list such as "2400:JPG, 2400:PNG, 1200, 600, 200" names the longest
+// edge in pixels and optionally the format (the Output's format otherwise).
+namespace Renditions
+{
+    struct Rendition
+    {
+        int longEdge = 0;
+        QString format;
+    };
+
+    // Entries that don't parse are skipped, and repeats of a size and format keep only
+    // the first; an empty spec gives an empty list
+    QList<Rendition> parse(const QString &spec, const QString &defaultFormat);
+
+    // <dir>/<name>_<size>.<ext> for basePath <dir>/<name>.<anything>
+    QString path(const QString &basePath, const Rendition &rendition);
+
+    // Downscale in a chain (each size is made from the next larger one, never from
+    // the full result) and encode every distinct rendition in parallel. Renditions
+    // larger than the result are written at full size. Returns the paths written;
+    // failures are logged and left out.
+    QStringList write(const cv::Mat &result, const QList<Rendition> &renditions,
+                      const QString &basePath, int quality);
+}
+
+#endif // RENDITIONS_H
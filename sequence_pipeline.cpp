@@ -0,0 +1,198 @@
+// sequence_pipeline.cpp
+#include "sequence_pipeline.h"
+#include "bounded_queue.h"
+#include "image_processor.h"
+#include "priority_gate.h"
+#include "thread_budget.h"
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QDebug>
+#include <map>
+#include <thread>
+
+namespace
+{
+    struct Frame
+    {
+        int index = 0;
+        cv::Mat image;
+    };
+}
+
+SequencePipeline::SequencePipeline(Node *outputNode)
+{
+    if (!outputNode)
+        return;
+
+    if (outputNode->hasProperty("outputPath"))
+        m_outputPath = outputNode->getProperty("outputPath")->toString();
+    if (outputNode->hasProperty("fps"))
+        m_fps = qMax(1, outputNode->getProperty("fps")->toInt());
+
+    QList<Node *> children = outputNode->getChildren();
+    if (children.isEmpty() || children.first()->getType() != "Sequence Source")
+        return;
+
+    Node *sourceNode = children.first();
+    m_sourcePath = sourceNode->getProperty("sourcePath")->toString();
+
+    for (Node *effectNode : sourceNode->getChildren())
+    {
+        if (!effectNode)
+            continue;
+
+        // A copy owns its properties, so edits in the GUI can't race with the worker threads
+        m_steps.push_back(*effectNode);
+    }
+}
+
+SequencePipeline::Stats SequencePipeline::run(int workerCount)
+{
+    Stats stats;
+    if (m_sourcePath.isEmpty())
+    {
+        stats.error = "Sequence Output must be connected to a Sequence Source with a path";
+        return stats;
+    }
+    if (m_outputPath.isEmpty())
+    {
+        stats.error = "Sequence Output has no output path";
+        return stats;
+    }
+
+    // Handles both video files and numbered-file patterns such as frame_%04d.png
+    cv::VideoCapture capture(m_sourcePath.toStdString());
+    if (!capture.isOpened())
+    {
+        stats.error = "Failed to open sequence: " + m_sourcePath;
+        return stats;
+    }
+
+    if (workerCount <= 0)
+        workerCount = ThreadBudget::total();
+
+    BoundedQueue<Frame> decoded(workerCount * 2);
+    BoundedQueue<Frame> processed(workerCount * 2);
+    std::atomic<int> activeWorkers{workerCount};
+    bool writeFailed = false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Decode stage
+    std::thread decoder([&]()
+                        {
+        int index = 0;
+        cv::Mat image;
+        while (!m_cancelled && capture.read(image))
+        {
+            if (!decoded.push(Frame{index++, image}))
+                break;
+            image = cv::Mat(); // The queued frame owns the buffer now
+        }
+        decoded.close(); });
+
+    // Evaluation stage
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back([&]()
+                             {
+            // Sequence renders give way to interactive previews between nodes
+            PriorityGate::Scope background(PriorityGate::Background);
+            Frame frame;
+            while (decoded.pop(frame))
+            {
+                {
+                    ThreadBudget::Slot slot;
+                    for (Node &step : m_steps)
+                    {
+                        PriorityGate::checkpoint();
+                        frame.image = ImageProcessor::processNode(&step, frame.image);
+                    }
+                }
+                if (!processed.push(std::move(frame)))
+                    break;
+            }
+            if (--activeWorkers == 0)
+                processed.close(); });
+    }
+
+    // Encode stage; workers finish out of order, so frames are written by index
+    std::thread encoder([&]()
+                        {
+        std::map<int, cv::Mat> reorder;
+        int next = 0;
+        cv::VideoWriter writer;
+        Frame frame;
+        while (processed.pop(frame))
+        {
+            reorder.emplace(frame.index, std::move(frame.image));
+            for (auto it = reorder.find(next); it != reorder.end(); it = reorder.find(next))
+            {
+                if (!writeFailed && !writeFrame(writer, it->first, it->second))
+                {
+                    writeFailed = true;
+                    m_cancelled = true;
+                }
+                reorder.erase(it);
+                ++next;
+                if (!writeFailed && ++m_framesDone % 100 == 0)
+                    qDebug() << "Sequence frames written:" << m_framesDone;
+            }
+        } });
+
+    decoder.join();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    encoder.join();
+
+    stats.frames = m_framesDone;
+    stats.seconds = timer.elapsed() / 1000.0;
+    if (writeFailed)
+        stats.error = "Failed to write frame to: " + m_outputPath;
+    else if (stats.frames == 0)
+        stats.error = "No frames could be decoded from: " + m_sourcePath;
+    stats.ok = stats.error.isEmpty();
+    return stats;
+}
+
+bool SequencePipeline::writeFrame(cv::VideoWriter &writer, int index, const cv::Mat &image)
+{
+    // Numbered files keep the frame as is
+    if (m_outputPath.contains('%'))
+        return cv::imwrite(framePath(m_outputPath, index).toStdString(), image);
+
+    // Video encoders expect 3-channel BGR
+    cv::Mat bgr = image;
+    if (image.channels() == 1)
+        cv::cvtColor(image, bgr, cv::COLOR_GRAY2BGR);
+    else if (image.channels() == 4)
+        cv::cvtColor(image, bgr, cv::COLOR_BGRA2BGR);
+
+    if (!writer.isOpened())
+    {
+        int fourcc = m_outputPath.endsWith(".avi", Qt::CaseInsensitive)
+                         ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G')
+                         : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+        if (!writer.open(m_outputPath.toStdString(), fourcc, m_fps, bgr.size(), true))
+            return false;
+    }
+    writer.write(bgr);
+    return true;
+}
+
+QString SequencePipeline::framePath(const QString &pattern, int index)
+{
+    static const QRegularExpression placeholder("%(0?)(\\d*)d");
+    QRegularExpressionMatch match = placeholder.match(pattern);
+    if (!match.hasMatch())
+        return pattern;
+
+    QChar fill = match.captured(1).isEmpty() ? QChar(' ') : QChar('0');
+    QString number = QString::number(index).rightJustified(match.captured(2).toInt(), fill);
+    QString path = pattern;
+    return path.replace(match.capturedStart(), match.capturedLength(), number);
+}
@@ -0,0 +1,49 @@
+// sequence_pipeline.h
+#ifndef SEQUENCE_PIPELINE_H
+#define SEQUENCE_PIPELINE_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <atomic>
+#include <vector>
+#include "node.h"
+
+// Streams an image sequence or video through the chain feeding a Sequence Output node.
+// Decoding, graph evaluation and encoding run on their own threads connected by
+// bounded queues, so throughput approaches the slowest stage instead of their sum.
+class SequencePipeline
+{
+public:
+    struct Stats
+    {
+        int frames = 0;
+        double seconds = 0.0;
+        bool ok = false;
+        QString error;
+    };
+
+    // Snapshots the chain so the GUI can keep editing nodes while frames render
+    explicit SequencePipeline(Node *outputNode);
+
+    // Run to completion; workerCount <= 0 uses one evaluation thread per spare core
+    Stats run(int workerCount = 0);
+
+    // Stop decoding; frames already in flight are still written
+    void cancel() { m_cancelled = true; }
+    int framesDone() const { return m_framesDone; }
+
+    // Expand the %d / %0Nd placeholder of a numbered-file pattern
+    static QString framePath(const QString &pattern, int index);
+
+private:
+    bool writeFrame(cv::VideoWriter &writer, int index, const cv::Mat &image);
+
+    QString m_sourcePath;
+    QString m_outputPath;
+    double m_fps = 25.0;
+    std::vector<Node> m_steps;
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<int> m_framesDone{0};
+};
+
+#endif // SEQUENCE_PIPELINE_H
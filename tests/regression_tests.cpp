@@ -0,0 +1,1091 @@
+// regression_tests.cpp
+// Regression cases for the image kernels and reference graphs.
+// Each case runs on a fixed synthetic input and is compared with PSNR/SSIM
+// tolerances against a reference computed another way: the formula written out per
+// pixel, OpenCV's own filter, or a graph run node by node without planning or caches.
+// A case without a reference is compared against a golden image <data>/<case>.png
+// instead. With a non-negative --margin, a case also fails if its median time exceeds
+// the budget recorded in <data>/<case>.budget by more than that fraction.
+// A golden or budget that is needed but missing is a failure; run with --update (or
+// NIE_UPDATE_GOLDENS=1) to record them, and to re-record after an intended change.
+// Outputs that differ from what they are compared with are written to --output.
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "convolution.h"
+#include "graph_executor.h"
+#include "histogram.h"
+#include "image_processor.h"
+#include "node.h"
+#include "renditions.h"
+
+namespace
+{
+    const int Repetitions = 5;
+
+    struct TestCase
+    {
+        const char *name;
+        std::function<cv::Mat()> run;
+        double minPsnr = 45.0;
+        double minSsim = 0.995;
+        // If set, the result is compared with this instead of a golden image: an
+        // independent way of computing what the case must produce
+        std::function<cv::Mat()> reference;
+        // Further assertions; returns what failed, or an empty string
+        std::function<QString()> check;
+    };
+
+    // Gradients, a checkerboard, anti-aliased shapes and fixed-seed noise, so
+    // every kernel has edges, flat areas and texture to work on
+    cv::Mat syntheticInput()
+    {
+        const int width = 640;
+        const int height = 480;
+        cv::Mat image(height, width, CV_8UC3);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                bool checker = ((x / 32) + (y / 32)) % 2 == 0;
+                image.at<cv::Vec3b>(y, x) = cv::Vec3b(static_cast<uchar>(x * 255 / (width - 1)),
+                                                      static_cast<uchar>(y * 255 / (height - 1)),
+                                                      checker ? 200 : 55);
+            }
+        }
+        cv::circle(image, cv::Point(width / 3, height / 2), height / 4, cv::Scalar(30, 180, 240), -1, cv::LINE_AA);
+        cv::rectangle(image, cv::Rect(width / 2, height / 5, width / 3, height / 3), cv::Scalar(240, 40, 90), -1);
+        cv::line(image, cv::Point(0, height - 1), cv::Point(width - 1, 0), cv::Scalar(255, 255, 255), 3, cv::LINE_AA);
+
+        cv::RNG rng(0x5EED);
+        cv::Mat noise(height, width, CV_8UC3);
+        rng.fill(noise, cv::RNG::UNIFORM, 0, 24);
+        cv::addWeighted(image, 1.0, noise, 1.0, -12.0, image);
+        return image;
+    }
+
+    const cv::Mat &input()
+    {
+        static const cv::Mat image = syntheticInput();
+        return image;
+    }
+
+    // An Output node's chain, owning its nodes: Load Image, then steps in order
+    struct Chain
+    {
+        std::vector<std::unique_ptr<Node>> nodes;
+        Node *source = nullptr;
+        Node *output = nullptr;
+        QList<Node *> steps;
+    };
+
+    // A step of a chain: node type and the properties it differs from its defaults in
+    struct Step
+    {
+        QString type;
+        QList<QPair<QString, QVariant>> settings;
+    };
+
+    Chain buildChain(const QString &sourcePath, const QList<Step> &steps)
+    {
+        Chain chain;
+        auto add = [&chain](const QString &type)
+        {
+            chain.nodes.push_back(std::make_unique<Node>(QImage(), QPoint(), type));
+            return chain.nodes.back().get();
+        };
+
+        chain.source = add("Load Image");
+        chain.source->getProperty("filePath")->setValue(sourcePath);
+        for (const Step &step : steps)
+        {
+            Node *node = add(step.type);
+            for (const auto &setting : step.settings)
+                node->getProperty(setting.first)->setValue(setting.second);
+            chain.source->addChildNode(node);
+            chain.steps.append(node);
+        }
+        chain.output = add("Output");
+        chain.output->addChildNode(chain.source);
+        return chain;
+    }
+
+    // Blur -> Sharpen (Unsharp Mask) -> Brightness
+    Chain referenceChain(const QString &sourcePath)
+    {
+        return buildChain(sourcePath, {{"Blur", {{"radius", 4}}},
+                                       {"Sharpen", {{"mode", "Unsharp Mask"}, {"amount", 80}}},
+                                       {"Brightness", {{"brightness", 15}, {"contrast", 20}}}});
+    }
+
+    QString sourcePath()
+    {
+        static QTemporaryDir dir;
+        static const QString path = dir.filePath("input.png");
+        if (!QFile::exists(path))
+            cv::imwrite(path.toStdString(), input());
+        return path;
+    }
+
+    // The input enlarged to 3000x2250, so every rendition is a real downscale
+    const cv::Mat &renditionSource()
+    {
+        static const cv::Mat image = []() {
+            cv::Mat large;
+            cv::resize(input(), large, cv::Size(3000, 2250), 0, 0, cv::INTER_CUBIC);
+            return large;
+        }();
+        return image;
+    }
+
+    // Renditions written once per run into <dir>/photo_<size>.<ext>; the list repeats
+    // entries, which must be encoded only once
+    const QStringList &renditionPaths()
+    {
+        static QTemporaryDir dir;
+        static const QStringList paths = []() {
+            QList<Renditions::Rendition> renditions = Renditions::parse("2400:JPG, 1200:PNG, 200:PNG", "PNG");
+            renditions.append(renditions.mid(1));
+            return Renditions::write(renditionSource(), renditions, dir.filePath("photo.tif"), 90);
+        }();
+        return paths;
+    }
+
+    // A warm, lifted-shadows look on a 17-point lattice: R G B output (0-1) at lattice
+    // point (r, g, b)
+    const int LookSize = 17;
+    cv::Vec3d lookPoint(int r, int g, int b)
+    {
+        const double last = LookSize - 1;
+        return cv::Vec3d(std::pow(r / last, 0.8), 0.05 + 0.9 * g / last, 0.85 * b / last + 0.1 * r / last);
+    }
+
+    // The look written as a .cube file
+    QString cubePath()
+    {
+        static QTemporaryDir dir;
+        static const QString path = dir.filePath("look.cube");
+        if (!QFile::exists(path))
+        {
+            QFile file(path);
+            if (file.open(QIODevice::WriteOnly | QIODevice::Text))
+            {
+                QByteArray text = "TITLE \"regression look\"\nLUT_3D_SIZE " + QByteArray::number(LookSize) + "\n";
+                for (int b = 0; b < LookSize; ++b)
+                {
+                    for (int g = 0; g < LookSize; ++g)
+                    {
+                        for (int r = 0; r < LookSize; ++r)
+                        {
+                            cv::Vec3d rgb = lookPoint(r, g, b);
+                            text += QByteArray::number(rgb[0], 'f', 6) + " " + QByteArray::number(rgb[1], 'f', 6) + " " +
+                                    QByteArray::number(rgb[2], 'f', 6) + "\n";
+                        }
+                    }
+                }
+                file.write(text);
+            }
+        }
+        return path;
+    }
+
+    // Kernel text of a flat disc, which is not separable
+    QString discKernel(int radius)
+    {
+        QStringList rows;
+        for (int y = -radius; y <= radius; ++y)
+        {
+            QStringList row;
+            for (int x = -radius; x <= radius; ++x)
+                row.append(x * x + y * y <= radius * radius ? "1" : "0");
+            rows.append(row.join(' '));
+        }
+        return rows.join("; ");
+    }
+
+    // The input correlated with a normalised kernel by one of the strategies
+    cv::Mat convolve(const QString &text, Convolution::Strategy strategy, int tileSize = 0)
+    {
+        std::shared_ptr<const Convolution::Kernel> kernel = Convolution::parse(text, true);
+        return kernel ? Convolution::apply(input(), *kernel, 0.0, strategy, tileSize) : cv::Mat();
+    }
+
+    // The input correlated with a kernel by filter2D, with the reflected borders all
+    // strategies must reproduce
+    cv::Mat filter2D(const QString &text, bool normalize)
+    {
+        std::shared_ptr<const Convolution::Kernel> kernel = Convolution::parse(text, normalize);
+        if (!kernel)
+            return cv::Mat();
+        cv::Mat output;
+        cv::filter2D(input(), output, -1, kernel->weights, cv::Point(-1, -1), 0.0, cv::BORDER_REFLECT_101);
+        return output;
+    }
+
+    // The chain run node by node on the full-size input: no optimizer, no pushdown, no
+    // regions, no caches; the reference the executor's planning must agree with
+    cv::Mat naiveChain(const QList<Node *> &steps, cv::Mat image = input())
+    {
+        for (Node *node : steps)
+            image = ImageProcessor::processNode(node, image);
+        return image;
+    }
+
+    // Pixel of an 8-bit image with reflected borders (BORDER_REFLECT_101, OpenCV's default)
+    double at(const cv::Mat &image, int x, int y, int channel)
+    {
+        x = cv::borderInterpolate(x, image.cols, cv::BORDER_REFLECT_101);
+        y = cv::borderInterpolate(y, image.rows, cv::BORDER_REFLECT_101);
+        return image.ptr<uchar>(y)[x * image.channels() + channel];
+    }
+
+    // An 8-bit image of the input's size with outputChannels values per pixel from f,
+    // written straight from the formula the kernel is meant to implement
+    cv::Mat mapPixels(int outputChannels, const std::function<void(int x, int y, double *values)> &f)
+    {
+        cv::Mat output(input().size(), CV_8UC(outputChannels));
+        double values[4];
+        for (int y = 0; y < output.rows; ++y)
+        {
+            uchar *row = output.ptr<uchar>(y);
+            for (int x = 0; x < output.cols; ++x)
+            {
+                f(x, y, values);
+                for (int c = 0; c < outputChannels; ++c)
+                    row[x * outputChannels + c] = cv::saturate_cast<uchar>(values[c]);
+            }
+        }
+        return output;
+    }
+
+    // Counter-clockwise rotation about the centre onto a canvas that fits the corners,
+    // sampled bilinearly by inverse mapping; pixels from outside the input are black
+    cv::Mat rotated(const cv::Mat &image, double angle)
+    {
+        const double radians = angle * CV_PI / 180.0;
+        const double c = std::cos(radians);
+        const double s = std::sin(radians);
+        cv::Size size(qRound(image.cols * std::abs(c) + image.rows * std::abs(s)),
+                      qRound(image.cols * std::abs(s) + image.rows * std::abs(c)));
+        const double inX = (image.cols - 1) / 2.0, inY = (image.rows - 1) / 2.0;
+        const double outX = (size.width - 1) / 2.0, outY = (size.height - 1) / 2.0;
+        auto sample = [&image](int x, int y, int channel)
+        {
+            if (x < 0 || y < 0 || x >= image.cols || y >= image.rows)
+                return 0.0;
+            return double(image.ptr<uchar>(y)[x * image.channels() + channel]);
+        };
+
+        cv::Mat output(size, image.type());
+        for (int y = 0; y < size.height; ++y)
+        {
+            for (int x = 0; x < size.width; ++x)
+            {
+                const double u = c * (x - outX) - s * (y - outY) + inX;
+                const double v = s * (x - outX) + c * (y - outY) + inY;
+                const int x0 = int(std::floor(u)), y0 = int(std::floor(v));
+                const double fx = u - x0, fy = v - y0;
+                for (int ch = 0; ch < image.channels(); ++ch)
+                {
+                    double value = (1 - fx) * (1 - fy) * sample(x0, y0, ch) + fx * (1 - fy) * sample(x0 + 1, y0, ch) +
+                                   (1 - fx) * fy * sample(x0, y0 + 1, ch) + fx * fy * sample(x0 + 1, y0 + 1, ch);
+                    output.ptr<uchar>(y)[x * image.channels() + ch] = cv::saturate_cast<uchar>(value);
+                }
+            }
+        }
+        return output;
+    }
+
+    // Downscale by averaging: each output pixel is the mean of the input area it covers,
+    // with partly covered pixels weighted by the covered fraction
+    cv::Mat areaAverage(const cv::Mat &image, const cv::Size &size)
+    {
+        // For each output index, the input indices it covers and their shares
+        auto weights = [](int inputLength, int outputLength)
+        {
+            const double step = double(inputLength) / outputLength;
+            std::vector<std::vector<std::pair<int, double>>> table(outputLength);
+            for (int o = 0; o < outputLength; ++o)
+            {
+                const double begin = o * step, end = (o + 1) * step;
+                for (int i = int(std::floor(begin)); i < qMin(inputLength, int(std::ceil(end))); ++i)
+                {
+                    double overlap = std::min(i + 1.0, end) - std::max(double(i), begin);
+                    if (overlap > 0.0)
+                        table[o].push_back({i, overlap / step});
+                }
+            }
+            return table;
+        };
+        const auto columns = weights(image.cols, size.width);
+        const auto rows = weights(image.rows, size.height);
+
+        cv::Mat output(size, image.type());
+        for (int y = 0; y < size.height; ++y)
+        {
+            for (int x = 0; x < size.width; ++x)
+            {
+                for (int ch = 0; ch < image.channels(); ++ch)
+                {
+                    double sum = 0.0;
+                    for (const auto &row : rows[y])
+                    {
+                        for (const auto &column : columns[x])
+                            sum += row.second * column.second * image.ptr<uchar>(row.first)[column.first * image.channels() + ch];
+                    }
+                    output.ptr<uchar>(y)[x * image.channels() + ch] = cv::saturate_cast<uchar>(sum);
+                }
+            }
+        }
+        return output;
+    }
+
+    // The input with an opacity ramp from transparent on the left to opaque on the right
+    const cv::Mat &alphaRamp()
+    {
+        static const cv::Mat bgra = []() {
+            cv::Mat opacity(input().size(), CV_8UC1);
+            for (int x = 0; x < opacity.cols; ++x)
+                opacity.col(x).setTo(x * 255 / (opacity.cols - 1));
+            cv::Mat image;
+            cv::merge(std::vector<cv::Mat>{input(), opacity}, image);
+            return image;
+        }();
+        return bgra;
+    }
+
+    const cv::Mat &grayInput()
+    {
+        static const cv::Mat gray = ImageProcessor::applyGrayscale(input(), "Luminosity");
+        return gray;
+    }
+
+    // The look applied pixel by pixel from its lattice points. Trilinear weighs the eight
+    // corners of the cell; tetrahedral walks from the lower corner to the upper one along
+    // the axes in order of decreasing fraction, weighing the four corners it passes.
+    cv::Mat lookReference(bool tetrahedral)
+    {
+        return mapPixels(3, [tetrahedral](int x, int y, double *values) {
+            const double levels[3] = {at(input(), x, y, 2), at(input(), x, y, 1), at(input(), x, y, 0)};
+            int base[3];
+            double fraction[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                const double position = levels[c] / 255.0 * (LookSize - 1);
+                base[c] = std::min(int(position), LookSize - 2);
+                fraction[c] = position - base[c];
+            }
+
+            double rgb[3] = {0.0, 0.0, 0.0};
+            auto add = [&](const int *corner, double weight)
+            {
+                cv::Vec3d point = lookPoint(base[0] + corner[0], base[1] + corner[1], base[2] + corner[2]);
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] += weight * point[c];
+            };
+            if (tetrahedral)
+            {
+                int order[3] = {0, 1, 2};
+                std::sort(order, order + 3, [&fraction](int a, int b) { return fraction[a] > fraction[b]; });
+                int corner[3] = {0, 0, 0};
+                double previous = 1.0;
+                for (int step = 0; step <= 3; ++step)
+                {
+                    const double next = step < 3 ? fraction[order[step]] : 0.0;
+                    add(corner, previous - next);
+                    if (step < 3)
+                        corner[order[step]] = 1;
+                    previous = next;
+                }
+            }
+            else
+            {
+                for (int index = 0; index < 8; ++index)
+                {
+                    const int corner[3] = {index & 1, (index >> 1) & 1, (index >> 2) & 1};
+                    double weight = 1.0;
+                    for (int c = 0; c < 3; ++c)
+                        weight *= corner[c] ? fraction[c] : 1.0 - fraction[c];
+                    add(corner, weight);
+                }
+            }
+            for (int c = 0; c < 3; ++c)
+                values[c] = 255.0 * rgb[2 - c]; // B G R
+        });
+    }
+
+    // Self-guided filter in one pass over the whole image, which the kernel's
+    // overlapping strips must reproduce
+    cv::Mat guidedFilter(const cv::Mat &image, int radius, double smoothing)
+    {
+        const cv::Size box(2 * radius + 1, 2 * radius + 1);
+        cv::Mat guide, mean, meanSquare;
+        image.convertTo(guide, CV_32F);
+        cv::boxFilter(guide, mean, CV_32F, box);
+        cv::boxFilter(guide.mul(guide), meanSquare, CV_32F, box);
+
+        cv::Mat variance = meanSquare - mean.mul(mean);
+        cv::Mat a, b;
+        cv::divide(variance, variance + cv::Scalar::all(smoothing * smoothing), a);
+        b = mean - a.mul(mean);
+        cv::boxFilter(a, a, CV_32F, box);
+        cv::boxFilter(b, b, CV_32F, box);
+
+        cv::Mat output;
+        cv::Mat(a.mul(guide) + b).convertTo(output, image.depth());
+        return output;
+    }
+
+    // Every run gets a fresh executor so cached results never shortcut the timing
+    cv::Mat evaluateGraph(double scale, const cv::Rect &roi = cv::Rect())
+    {
+        Chain chain = referenceChain(sourcePath());
+        GraphExecutor executor(nullptr);
+        return executor.evaluate(chain.output, scale, roi);
+    }
+
+    // Crop -> Blur -> Resize -> Rotate, exercising crop and downscale pushdown
+    Chain geometryChain()
+    {
+        return buildChain(sourcePath(), {{"Crop", {{"x", 64}, {"y", 48}, {"width", 320}, {"height", 240}}},
+                                         {"Blur", {{"radius", 4}}},
+                                         {"Resize", {{"width", 160}}},
+                                         {"Rotate", {{"angle", 90}}}});
+    }
+
+    // Blur -> Brightness (0/0) -> Grayscale -> Brightness -> Brightness, which the graph
+    // optimizer reduces to Grayscale -> Blur -> Brightness
+    Chain wastefulChain()
+    {
+        return buildChain(sourcePath(), {{"Blur", {{"radius", 4}}},
+                                         {"Brightness", {}},
+                                         {"Grayscale", {}},
+                                         {"Brightness", {{"brightness", 10}}},
+                                         {"Brightness", {{"brightness", 5}, {"contrast", 10}}}});
+    }
+
+    // Bilateral -> CLAHE -> Auto Levels -> Histogram Equalize: every step needs the whole
+    // frame, even for a single tile
+    Chain fullFrameChain()
+    {
+        return buildChain(sourcePath(), {{"Bilateral", {}},
+                                         {"CLAHE", {}},
+                                         {"Auto Levels", {}},
+                                         {"Histogram Equalize", {{"amount", 50}}}});
+    }
+
+    // Crop -> Expression, a formula of the pixel position
+    Chain positionChain()
+    {
+        return buildChain(sourcePath(),
+                          {{"Crop", {{"x", 40}, {"y", 30}, {"width", 560}, {"height", 420}}},
+                           {"Expression", {{"expression", "r = r * x / w\ng = g * (1 - y / h)\n"
+                                                          "b = mix(b, 0.5 + 0.5 * sin(x / 9 + y / 13), p1)"}}}});
+    }
+
+    std::vector<TestCase> testCases()
+    {
+        return {
+            {"blur_uniform", []() { return ImageProcessor::applyBlur(input(), 7, "Uniform"); }, 45.0, 0.995, []() {
+                 // Whichever Gaussian the kernel profile picked agrees with OpenCV's
+                 cv::Mat blurred;
+                 cv::GaussianBlur(input(), blurred, cv::Size(15, 15), 0);
+                 return blurred;
+             }},
+            {"blur_directional", []() { return ImageProcessor::applyBlur(input(), 7, "Directional"); }, 45.0, 0.995, []() {
+                 // A horizontal box of 15 pixels
+                 cv::Mat blurred;
+                 cv::blur(input(), blurred, cv::Size(15, 1));
+                 return blurred;
+             }},
+            {"brightness_contrast", []() { return ImageProcessor::applyBrightnessContrast(input(), 30, 40); }, 45.0, 0.995, []() {
+                 return mapPixels(3, [](int x, int y, double *values) {
+                     for (int c = 0; c < 3; ++c)
+                         values[c] = at(input(), x, y, c) * 1.4 + 30.0;
+                 });
+             }},
+            {"grayscale_average", []() { return ImageProcessor::applyGrayscale(input(), "Average"); }, 45.0, 0.995, []() {
+                 // Average has always used the luminosity weights
+                 return mapPixels(1, [](int x, int y, double *values) {
+                     values[0] = 0.114 * at(input(), x, y, 0) + 0.587 * at(input(), x, y, 1) + 0.299 * at(input(), x, y, 2);
+                 });
+             }},
+            {"grayscale_luminosity", []() { return ImageProcessor::applyGrayscale(input(), "Luminosity"); }, 45.0, 0.995, []() {
+                 return mapPixels(1, [](int x, int y, double *values) {
+                     values[0] = 0.114 * at(input(), x, y, 0) + 0.587 * at(input(), x, y, 1) + 0.299 * at(input(), x, y, 2);
+                 });
+             }},
+            {"grayscale_lightness", []() { return ImageProcessor::applyGrayscale(input(), "Lightness"); }, 45.0, 0.995, []() {
+                 return mapPixels(1, [](int x, int y, double *values) {
+                     double b = at(input(), x, y, 0), g = at(input(), x, y, 1), r = at(input(), x, y, 2);
+                     values[0] = (std::max({b, g, r}) + std::min({b, g, r})) / 2.0;
+                 });
+             }},
+            {"sharpen_kernel", []() { return ImageProcessor::applySharpen(input(), 50); }, 45.0, 0.995, []() {
+                 // Amount 50 is the 5-point Laplacian added once
+                 return mapPixels(3, [](int x, int y, double *values) {
+                     for (int c = 0; c < 3; ++c)
+                         values[c] = 5.0 * at(input(), x, y, c) - at(input(), x - 1, y, c) - at(input(), x + 1, y, c) -
+                                     at(input(), x, y - 1, c) - at(input(), x, y + 1, c);
+                 });
+             }},
+            {"sharpen_unsharp_mask", []() {
+                 cv::Mat blurred = ImageProcessor::applyBlur(input(), 3, "Uniform");
+                 return ImageProcessor::applyUnsharpMask(input(), blurred, 80);
+             }, 45.0, 0.995, []() {
+                 // input + 1.6 * (input - blurred)
+                 cv::Mat blurred;
+                 cv::GaussianBlur(input(), blurred, cv::Size(7, 7), 0);
+                 return mapPixels(3, [&blurred](int x, int y, double *values) {
+                     for (int c = 0; c < 3; ++c)
+                         values[c] = 2.6 * at(input(), x, y, c) - 1.6 * at(blurred, x, y, c);
+                 });
+             }},
+            {"channel_split_red_gray", []() { return ImageProcessor::applyChannelSplit(input(), 0, true); }, 45.0, 0.995, []() {
+                 return mapPixels(1, [](int x, int y, double *values) { values[0] = at(input(), x, y, 2); });
+             }},
+            {"channel_split_blue_color", []() { return ImageProcessor::applyChannelSplit(input(), 2, false); }, 45.0, 0.995, []() {
+                 return mapPixels(3, [](int x, int y, double *values) {
+                     values[0] = at(input(), x, y, 0);
+                     values[1] = values[2] = 0.0;
+                 });
+             }},
+            {"bilateral_grid", []() { return ImageProcessor::applyBilateral(input(), 16, 20.0); }, 25.0, 0.8, []() {
+                 // The grid approximates a bilateral filter with spatial sigma of one radius and
+                 // range sigma of one range, on gray rather than colour distances: close, not equal
+                 cv::Mat filtered;
+                 cv::bilateralFilter(input(), filtered, 33, 20.0, 16.0);
+                 return filtered;
+             }},
+            {"guided_filter", []() { return ImageProcessor::applyGuidedFilter(input(), 8, 20.0); }, 50.0, 0.999, []() {
+                 return guidedFilter(input(), 8, 20.0);
+             }},
+            {"median_large_radius", []() { return ImageProcessor::applyMedian(input(), 12); }, 45.0, 0.995, []() {
+                 // Row bands with overlapping halos give exactly the whole-frame median
+                 cv::Mat filtered;
+                 cv::medianBlur(input(), filtered, 25);
+                 return filtered;
+             }},
+            {"morphology_erode", []() { return ImageProcessor::applyMorphology(input(), "Erode", 9); }, 45.0, 0.995, []() {
+                 cv::Mat eroded;
+                 cv::erode(input(), eroded, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(19, 19)));
+                 return eroded;
+             }},
+            {"morphology_dilate", []() { return ImageProcessor::applyMorphology(input(), "Dilate", 9); }, 45.0, 0.995, []() {
+                 cv::Mat dilated;
+                 cv::dilate(input(), dilated, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(19, 19)));
+                 return dilated;
+             }},
+            {"morphology_top_hat", []() { return ImageProcessor::applyMorphology(input(), "Top-hat", 9); }, 45.0, 0.995, []() {
+                 cv::Mat topHat;
+                 cv::morphologyEx(input(), topHat, cv::MORPH_TOPHAT, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(19, 19)));
+                 return topHat;
+             }},
+            {"lut3d_tetrahedral", []() { return ImageProcessor::applyLut3D(input(), cubePath(), "Tetrahedral"); }, 45.0, 0.995, []() {
+                 return lookReference(true);
+             }},
+            {"lut3d_trilinear", []() { return ImageProcessor::applyLut3D(input(), cubePath(), "Trilinear"); }, 45.0, 0.995, []() {
+                 return lookReference(false);
+             }},
+            {"auto_levels", []() { return ImageProcessor::applyAutoLevels(input(), 0.5, true); }, 45.0, 0.995, []() {
+                 // Each channel stretched linearly between its 0.5th and 99.5th percentile
+                 std::vector<cv::Mat> channels;
+                 cv::split(input(), channels);
+                 const size_t clipped = size_t(input().total() * 0.5 / 100.0);
+                 for (cv::Mat &channel : channels)
+                 {
+                     std::vector<uchar> sorted(channel.begin<uchar>(), channel.end<uchar>());
+                     std::sort(sorted.begin(), sorted.end());
+                     const double low = sorted[clipped];
+                     const double high = sorted[sorted.size() - 1 - clipped];
+                     channel.convertTo(channel, CV_8U, 255.0 / (high - low), -low * 255.0 / (high - low));
+                 }
+                 cv::Mat stretched;
+                 cv::merge(channels, stretched);
+                 return stretched;
+             }, []() {
+                 // More than the clipped share of each channel ends up at 0 and at 255
+                 std::vector<cv::Mat> channels;
+                 cv::split(ImageProcessor::applyAutoLevels(input(), 0.5, true), channels);
+                 const int clipped = int(input().total() * 0.5 / 100.0);
+                 for (size_t c = 0; c < channels.size(); ++c)
+                 {
+                     const int black = int(input().total()) - cv::countNonZero(channels[c]);
+                     const int white = cv::countNonZero(channels[c] == 255);
+                     if (black <= clipped || white <= clipped)
+                         return QString("channel %1 has %2 black and %3 white pixels, %4 clipped")
+                             .arg(c).arg(black).arg(white).arg(clipped);
+                 }
+                 return QString();
+             }},
+            {"histogram_equalize", []() { return ImageProcessor::applyEqualize(grayInput(), 100); }, 45.0, 0.995, []() {
+                 cv::Mat equalized;
+                 cv::equalizeHist(grayInput(), equalized);
+                 return equalized;
+             }},
+            {"clahe", []() { return ImageProcessor::applyClahe(grayInput(), 3.0, 8); }, 30.0, 0.95, []() {
+                 // OpenCV pads the image to whole tiles and redistributes clipped counts a
+                 // little differently, so the floor is loose
+                 cv::Mat equalized;
+                 cv::createCLAHE(3.0, cv::Size(8, 8))->apply(grayInput(), equalized);
+                 return equalized;
+             }},
+            {"clahe_color", []() { return ImageProcessor::applyClahe(input(), 3.0, 8); }, 45.0, 0.995, []() {
+                 // Every channel moves by the change CLAHE makes to the pixel's luma
+                 cv::Mat luma(input().size(), CV_8UC1);
+                 for (int y = 0; y < luma.rows; ++y)
+                 {
+                     for (int x = 0; x < luma.cols; ++x)
+                         luma.at<uchar>(y, x) = uchar(Histogram::luma(int(at(input(), x, y, 0)), int(at(input(), x, y, 1)),
+                                                                      int(at(input(), x, y, 2))));
+                 }
+                 cv::Mat mapped = ImageProcessor::applyClahe(luma, 3.0, 8);
+                 return mapPixels(3, [&luma, &mapped](int x, int y, double *values) {
+                     const int delta = mapped.at<uchar>(y, x) - luma.at<uchar>(y, x);
+                     for (int c = 0; c < 3; ++c)
+                         values[c] = at(input(), x, y, c) + delta;
+                 });
+             }},
+            {"expression", []() {
+                 return ImageProcessor::applyExpression(
+                     input(), "r = mix(r, (r + g + b) / 3, p1)\ng = g ^ 1.2\nb = clamp(b + 0.1 * sin(x / 16), 0, 1)", 0.5, 0.0);
+             }, 45.0, 0.995, []() {
+                 return mapPixels(3, [](int x, int y, double *values) {
+                     double b = at(input(), x, y, 0) / 255.0, g = at(input(), x, y, 1) / 255.0, r = at(input(), x, y, 2) / 255.0;
+                     values[2] = 255.0 * (r + ((r + g + b) / 3.0 - r) * 0.5);
+                     values[1] = 255.0 * std::pow(g, 1.2);
+                     values[0] = 255.0 * std::clamp(b + 0.1 * std::sin(x / 16.0), 0.0, 1.0);
+                 });
+             }},
+            {"expression_region", []() {
+                 // A region of a position-dependent formula matches the same pixels of a whole render
+                 Chain chain = positionChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluate(chain.output, 1.0, cv::Rect(200, 150, 160, 120));
+             }, 45.0, 0.995, []() {
+                 Chain chain = positionChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluate(chain.output)(cv::Rect(200, 150, 160, 120)).clone();
+             }},
+            {"convolution_direct", []() {
+                 return ImageProcessor::applyConvolution(input(), "-2 -1 0; -1 1 1; 0 1 2", false, 0.0);
+             }, 45.0, 0.995, []() { return filter2D("-2 -1 0; -1 1 1; 0 1 2", false); }},
+            {"convolution_separable", []() {
+                 return convolve("1 4 6 4 1; 2 8 12 8 2; 1 4 6 4 1", Convolution::Strategy::Separable);
+             }, 50.0, 0.999, []() { return filter2D("1 4 6 4 1; 2 8 12 8 2; 1 4 6 4 1", true); }},
+            {"convolution_fourier", []() {
+                 // Tiled overlap-save against filter2D; tiles smaller than the frame so seams show
+                 return convolve(discKernel(12), Convolution::Strategy::Fourier, 256);
+             }, 50.0, 0.999, []() { return filter2D(discKernel(12), true); }},
+            {"rotate_free_angle", []() { return ImageProcessor::applyRotate(input(), 30.0); }, 35.0, 0.98, []() {
+                 // OpenCV interpolates at 1/32 pixel steps, hence the looser tolerance
+                 return rotated(input(), 30.0);
+             }},
+            {"resize_area", []() { return ImageProcessor::applyResize(input(), cv::Size(200, 150), "Area"); }, 45.0, 0.995, []() {
+                 return areaAverage(input(), cv::Size(200, 150));
+             }},
+            {"graph_chain", []() { return evaluateGraph(1.0); }, 45.0, 0.995, []() {
+                 return naiveChain(referenceChain(sourcePath()).steps);
+             }},
+            {"graph_preview_scale", []() { return evaluateGraph(0.25); }, 30.0, 0.95, []() {
+                 // The preview runs the chain at quarter size with scaled radii, which
+                 // approximates shrinking the full render
+                 cv::Mat full = evaluateGraph(1.0);
+                 cv::Mat shrunk;
+                 cv::resize(full, shrunk, cv::Size(qRound(full.cols * 0.25), qRound(full.rows * 0.25)), 0, 0,
+                            cv::INTER_AREA);
+                 return shrunk;
+             }},
+            {"graph_roi", []() { return evaluateGraph(1.0, cv::Rect(100, 80, 256, 192)); }, 45.0, 0.995, []() {
+                 // With halos, a region render is exactly that region of the whole render
+                 return evaluateGraph(1.0)(cv::Rect(100, 80, 256, 192)).clone();
+             }},
+            {"graph_geometry", []() {
+                 Chain chain = geometryChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluate(chain.output);
+             }, 30.0, 0.95, []() {
+                 // Crop, blur and downscale at full size. The planned render blurs only the
+                 // cropped pixels and at the downscaled size, which approximates this, so the
+                 // tolerance is looser; a misplaced crop or wrong size fails by far
+                 return naiveChain(geometryChain().steps);
+             }},
+            {"graph_optimized", []() {
+                 Chain chain = wastefulChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluate(chain.output);
+             }, 40.0, 0.99, []() {
+                 return naiveChain(wastefulChain().steps);
+             }, []() {
+                 Chain chain = wastefulChain();
+                 GraphExecutor executor(nullptr);
+                 const QStringList expected = {"removed Brightness (no effect)", "merged Brightness and Brightness",
+                                               "moved Grayscale ahead of Blur"};
+                 QStringList rewrites = executor.rewrites(chain.output);
+                 return rewrites == expected ? QString() : "rewrites were: " + rewrites.join("; ");
+             }},
+            {"graph_tiled_full_frame", []() {
+                 // Strips of a chain of whole-frame nodes match the whole render
+                 Chain chain = fullFrameChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluateTiled(chain.output, 128);
+             }, 45.0, 0.995, []() {
+                 Chain chain = fullFrameChain();
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluate(chain.output);
+             }},
+            {"graph_in_memory_source", []() {
+                 Chain chain = referenceChain(QString());
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluateImage(chain.output, input());
+             }, 45.0, 0.995, []() {
+                 return naiveChain(referenceChain(QString()).steps);
+             }},
+            {"graph_premultiplied_alpha", []() {
+                 // BGRA with an opacity ramp, blurred and sharpened as premultiplied colour
+                 Chain chain = referenceChain(QString());
+                 chain.source->getProperty("alpha")->setValue("Premultiplied");
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluateImage(chain.output, alphaRamp());
+             }, 40.0, 0.99, []() {
+                 // Premultiply, run each node, and return straight colour
+                 ImageProcessor::PremultipliedScope premultiplied(true);
+                 cv::Mat image = ImageProcessor::premultiply(alphaRamp());
+                 return ImageProcessor::unpremultiply(naiveChain(referenceChain(QString()).steps, image));
+             }},
+            {"graph_single_channel", []() {
+                 // Gray pixels run through every node without being expanded to BGR
+                 Chain chain = referenceChain(QString());
+                 GraphExecutor executor(nullptr);
+                 return executor.evaluateImage(chain.output, grayInput());
+             }, 45.0, 0.995, []() {
+                 // Any channel of the same chain run on gray BGR
+                 cv::Mat bgr;
+                 cv::merge(std::vector<cv::Mat>(3, grayInput()), bgr);
+                 cv::Mat result = naiveChain(referenceChain(QString()).steps, bgr);
+                 cv::Mat channel;
+                 cv::extractChannel(result, channel, 0);
+                 return channel;
+             }},
+            {"node_properties", []() {
+                 // A copy renders its own values and type, whatever happens to the original
+                 Node original(QImage(), QPoint(), "Brightness");
+                 original.getProperty("brightness")->setValue(30);
+                 original.getProperty("contrast")->setValue(40);
+                 Node copy(original);
+                 original.getProperty("brightness")->setValue(-50);
+                 original.setType("Blur");
+                 return ImageProcessor::processNode(&copy, input());
+             }, 45.0, 0.995, []() {
+                 return mapPixels(3, [](int x, int y, double *values) {
+                     for (int c = 0; c < 3; ++c)
+                         values[c] = at(input(), x, y, c) * 1.4 + 30.0;
+                 });
+             }, []() {
+                 Node node(QImage(), QPoint(), "Brightness");
+                 Node copy(node);
+                 if (copy.getProperty("brightness") == node.getProperty("brightness"))
+                     return QString("a copy shares its properties with the original");
+                 node.getProperty("brightness")->setValue(10);
+                 if (copy.getProperty("brightness")->toInt() != 0)
+                     return QString("editing the original changed its copy");
+
+                 NodeProperty *brightness = node.getProperty("brightness");
+                 brightness->setValue(5);
+                 quint64 version = node.version();
+                 quint64 key = node.contentKey();
+                 brightness->setValue(5);
+                 if (node.version() != version)
+                     return QString("setting an equal value renewed the version stamp");
+                 brightness->setValue(5.0);
+                 if (node.contentKey() != key)
+                     return QString("Int 5 and Double 5.0 have different content keys");
+                 brightness->setValue(6);
+                 if (node.version() == version || node.contentKey() == key)
+                     return QString("a changed value kept the version stamp or content key");
+
+                 node.setType("Crop");
+                 if (node.kind() != Node::Kind::Crop || copy.kind() != Node::Kind::Brightness)
+                     return QString("node kinds do not follow their types");
+                 return QString();
+             }},
+            {"renditions", []() {
+                 // The smallest rendition, read back from its lossless file
+                 const QStringList &paths = renditionPaths();
+                 return paths.size() == 3 ? cv::imread(paths[2].toStdString(), cv::IMREAD_UNCHANGED) : cv::Mat();
+             }, 45.0, 0.995, []() {
+                 // Each size is downscaled from the next larger one
+                 cv::Mat image = renditionSource();
+                 for (cv::Size size : {cv::Size(2400, 1800), cv::Size(1200, 900), cv::Size(200, 150)})
+                 {
+                     cv::Mat resized;
+                     cv::resize(image, resized, size, 0, 0, cv::INTER_AREA);
+                     image = resized;
+                 }
+                 return image;
+             }, []() {
+                 QList<Renditions::Rendition> parsed = Renditions::parse("2400:JPG, 1200:PNG, 200:PNG, 1200:png, 200", "png");
+                 if (parsed.size() != 3)
+                     return QString("parse kept %1 entries instead of 3").arg(parsed.size());
+
+                 const QStringList names = {"photo_2400.jpg", "photo_1200.png", "photo_200.png"};
+                 const QList<QByteArray> formats = {"jpeg", "png", "png"};
+                 const QList<QSize> sizes = {QSize(2400, 1800), QSize(1200, 900), QSize(200, 150)};
+                 const QStringList &paths = renditionPaths();
+                 if (paths.size() != names.size())
+                     return "wrote " + paths.join(", ");
+                 for (int i = 0; i < paths.size(); ++i)
+                 {
+                     QImageReader reader(paths[i]);
+                     if (QFileInfo(paths[i]).fileName() != names[i])
+                         return "unexpected file " + paths[i];
+                     if (reader.format() != formats[i] || reader.size() != sizes[i])
+                         return QString("%1 is %2 %3x%4").arg(names[i], QString(reader.format())).arg(reader.size().width()).arg(reader.size().height());
+                 }
+                 return QString();
+             }},
+        };
+    }
+
+    // Mean structural similarity over all channels (11x11 Gaussian window, sigma 1.5)
+    double ssim(const cv::Mat &a, const cv::Mat &b)
+    {
+        const double C1 = 6.5025;  // (0.01 * 255)^2
+        const double C2 = 58.5225; // (0.03 * 255)^2
+
+        cv::Mat x, y;
+        a.convertTo(x, CV_32F);
+        b.convertTo(y, CV_32F);
+
+        auto window = [](const cv::Mat &m)
+        {
+            cv::Mat out;
+            cv::GaussianBlur(m, out, cv::Size(11, 11), 1.5);
+            return out;
+        };
+
+        cv::Mat muX = window(x);
+        cv::Mat muY = window(y);
+        cv::Mat muX2 = muX.mul(muX);
+        cv::Mat muY2 = muY.mul(muY);
+        cv::Mat muXY = muX.mul(muY);
+        cv::Mat sigmaX2 = window(x.mul(x)) - muX2;
+        cv::Mat sigmaY2 = window(y.mul(y)) - muY2;
+        cv::Mat sigmaXY = window(x.mul(y)) - muXY;
+
+        cv::Mat numerator = (2 * muXY + C1).mul(2 * sigmaXY + C2);
+        cv::Mat denominator = (muX2 + muY2 + C1).mul(sigmaX2 + sigmaY2 + C2);
+        cv::Mat map;
+        cv::divide(numerator, denominator, map);
+
+        cv::Scalar perChannel = cv::mean(map);
+        double sum = 0.0;
+        for (int c = 0; c < map.channels(); ++c)
+            sum += perChannel[c];
+        return sum / map.channels();
+    }
+
+    bool readBudget(const QString &path, double &ms)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        bool ok = false;
+        ms = QString::fromUtf8(file.readAll()).trimmed().toDouble(&ok);
+        return ok && ms > 0.0;
+    }
+
+    bool writeBudget(const QString &path, double ms)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return false;
+        file.write(QByteArray::number(ms, 'f', 3) + "\n");
+        return true;
+    }
+
+    // 0 if result matches expected within the case's PSNR/SSIM tolerances; otherwise 1,
+    // with the result written to outputDir
+    int compare(const TestCase &testCase, const cv::Mat &result, const cv::Mat &expected, const char *label,
+                const QString &outputDir)
+    {
+        if (expected.size() != result.size() || expected.type() != result.type())
+        {
+            std::printf("%s: FAIL, result is %dx%d type %d, %s is %dx%d type %d\n", testCase.name, result.cols,
+                        result.rows, result.type(), label, expected.cols, expected.rows, expected.type());
+            return 1;
+        }
+
+        double psnr = cv::PSNR(result, expected);
+        double similarity = ssim(result, expected);
+        std::printf("%s: PSNR %.2f dB (min %.1f), SSIM %.5f (min %.3f) against %s\n", testCase.name, psnr,
+                    testCase.minPsnr, similarity, testCase.minSsim, label);
+        if (psnr >= testCase.minPsnr && similarity >= testCase.minSsim)
+            return 0;
+
+        const QString actualPath = outputDir + "/" + testCase.name + ".actual.png";
+        cv::imwrite(actualPath.toStdString(), result);
+        std::printf("%s: FAIL, output differs from %s (written to %s)\n", testCase.name, label,
+                    qPrintable(actualPath));
+        return 1;
+    }
+
+    int runCase(const TestCase &testCase, const QString &dataDir, const QString &outputDir, double margin, bool update)
+    {
+        // Warm up caches and lazy initialisation, then take the median of several runs
+        cv::Mat result = testCase.run();
+        if (result.empty())
+        {
+            std::printf("%s: FAIL, produced no image\n", testCase.name);
+            return 1;
+        }
+
+        std::vector<double> times;
+        for (int i = 0; i < Repetitions; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            result = testCase.run();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            times.push_back(elapsed.count());
+        }
+        std::sort(times.begin(), times.end());
+        const double medianMs = times[times.size() / 2];
+
+        int failures = 0;
+        const QString goldenPath = dataDir + "/" + testCase.name + ".png";
+        const QString budgetPath = dataDir + "/" + testCase.name + ".budget";
+
+        if (testCase.reference)
+        {
+            failures += compare(testCase, result, testCase.reference(), "reference", outputDir);
+        }
+        else if (!update && !QFile::exists(goldenPath))
+        {
+            const QString actualPath = outputDir + "/" + testCase.name + ".actual.png";
+            cv::imwrite(actualPath.toStdString(), result);
+            std::printf("%s: FAIL, no golden %s (output written to %s; record with --update)\n", testCase.name,
+                        qPrintable(goldenPath), qPrintable(actualPath));
+            ++failures;
+        }
+        else if (update)
+        {
+            if (!cv::imwrite(goldenPath.toStdString(), result))
+            {
+                std::printf("%s: FAIL, cannot write golden %s\n", testCase.name, qPrintable(goldenPath));
+                return 1;
+            }
+            std::printf("%s: recorded golden %s\n", testCase.name, qPrintable(goldenPath));
+        }
+        else
+        {
+            cv::Mat golden = cv::imread(goldenPath.toStdString(), cv::IMREAD_UNCHANGED);
+            failures += compare(testCase, result, golden, "golden", outputDir);
+        }
+
+        if (testCase.check)
+        {
+            QString failure = testCase.check();
+            if (!failure.isEmpty())
+            {
+                std::printf("%s: FAIL, %s\n", testCase.name, qPrintable(failure));
+                ++failures;
+            }
+        }
+
+        double budgetMs = 0.0;
+        if (update)
+        {
+            if (writeBudget(budgetPath, medianMs))
+                std::printf("%s: recorded budget %.3f ms\n", testCase.name, medianMs);
+        }
+        else if (margin < 0.0)
+        {
+            std::printf("%s: %.3f ms (budgets disabled)\n", testCase.name, medianMs);
+        }
+        else if (!readBudget(budgetPath, budgetMs))
+        {
+            std::printf("%s: FAIL, no budget %s (record with --update)\n", testCase.name, qPrintable(budgetPath));
+            ++failures;
+        }
+        else
+        {
+            const double limitMs = budgetMs * (1.0 + margin);
+            std::printf("%s: %.3f ms (budget %.3f ms, limit %.3f ms)\n", testCase.name, medianMs, budgetMs, limitMs);
+            if (medianMs > limitMs)
+            {
+                std::printf("%s: FAIL, slower than budget\n", testCase.name);
+                ++failures;
+            }
+        }
+
+        return failures ? 1 : 0;
+    }
+}
+
+// Usage: regression_tests <case>|--all [--data <dir>] [--output <dir>] [--margin <fraction>]
+//                         [--update] [--list]
+// A negative margin (the default) skips the time budgets, which only hold on the machine
+// that recorded them.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+
+    QString dataDir = QDir::currentPath();
+    QString outputDir = QDir::currentPath();
+    double margin = -1.0;
+    bool update = qEnvironmentVariableIntValue("NIE_UPDATE_GOLDENS") != 0;
+    QStringList selected;
+
+    for (int i = 0; i < args.size(); ++i)
+    {
+        if (args[i] == "--data" && i + 1 < args.size())
+            dataDir = args[++i];
+        else if (args[i] == "--output" && i + 1 < args.size())
+            outputDir = args[++i];
+        else if (args[i] == "--margin" && i + 1 < args.size())
+            margin = args[++i].toDouble();
+        else if (args[i] == "--update")
+            update = true;
+        else if (args[i] == "--list")
+        {
+            for (const TestCase &testCase : testCases())
+                std::printf("%s\n", testCase.name);
+            return 0;
+        }
+        else
+            selected.append(args[i]);
+    }
+
+    QDir().mkpath(dataDir);
+    QDir().mkpath(outputDir);
+    cv::setRNGSeed(0x5EED);
+
+    int failures = 0;
+    int ran = 0;
+    for (const TestCase &testCase : testCases())
+    {
+        if (!selected.contains("--all") && !selected.contains(testCase.name))
+            continue;
+        failures += runCase(testCase, dataDir, outputDir, margin, update);
+        ++ran;
+    }
+
+    if (ran == 0)
+    {
+        std::printf("No test case matches %s\n", qPrintable(selected.join(' ')));
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
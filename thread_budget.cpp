@@ -0,0 +1,231 @@
+// thread_budget.cpp
+#include "thread_budget.h"
+#include <opencv2/core.hpp>
+#include <QDebug>
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if __has_include(<opencv2/core/parallel/parallel_backend.hpp>)
+#include <opencv2/core/parallel/parallel_backend.hpp>
+#define NIE_HAVE_PARALLEL_BACKEND 1
+#endif
+
+namespace
+{
+    struct BudgetState
+    {
+        std::mutex mutex;
+        std::condition_variable slotFreed;
+        bool installed = false;
+        int total = 1;
+        int free = 1;
+
+        // Helper threads that run OpenCV loop stripes on borrowed slots
+        std::condition_variable workReady;
+        std::deque<std::function<void()>> work;
+        std::vector<std::thread> helpers;
+    };
+
+    BudgetState &state()
+    {
+        // Never destroyed: helper threads may still be parked on it at exit
+        static BudgetState *instance = new BudgetState;
+        return *instance;
+    }
+
+    thread_local int helperIndex = 0; // 0 for threads that are not helpers
+    thread_local int slotsHeld = 0;
+
+    void helperLoop(int index)
+    {
+        helperIndex = index;
+        BudgetState &s = state();
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(s.mutex);
+                s.workReady.wait(lock, [&s]() { return !s.work.empty(); });
+                task = std::move(s.work.front());
+                s.work.pop_front();
+            }
+            task();
+        }
+    }
+
+#ifdef NIE_HAVE_PARALLEL_BACKEND
+    // OpenCV parallel_for backend that only uses slots nobody else is using
+    class BudgetBackend : public cv::parallel::ParallelForAPI
+    {
+    public:
+        void parallel_for(int tasks, FN_parallel_for_body_cb_t body, void *data) override
+        {
+            if (tasks <= 0)
+                return;
+
+            int helpers = tasks > 1 ? ThreadBudget::tryAcquire(tasks - 1) : 0;
+            if (helpers == 0)
+            {
+                // The machine is busy: run the whole range on the calling thread
+                body(0, tasks, data);
+                return;
+            }
+
+            struct Loop
+            {
+                FN_parallel_for_body_cb_t body;
+                void *data;
+                int tasks;
+                std::atomic<int> next{0};
+                std::atomic<int> done{0};
+                std::mutex mutex;
+                std::condition_variable finished;
+
+                void work()
+                {
+                    for (;;)
+                    {
+                        int stripe = next.fetch_add(1);
+                        if (stripe >= tasks)
+                            return;
+                        body(stripe, stripe + 1, data);
+                        if (done.fetch_add(1) + 1 == tasks)
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            finished.notify_all();
+                        }
+                    }
+                }
+            };
+
+            auto loop = std::make_shared<Loop>();
+            loop->body = body;
+            loop->data = data;
+            loop->tasks = tasks;
+
+            BudgetState &s = state();
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                for (int i = 0; i < helpers; ++i)
+                    s.work.emplace_back([loop]() { loop->work(); });
+            }
+            s.workReady.notify_all();
+
+            // The caller takes stripes too, so the loop finishes even if helpers start late
+            loop->work();
+            {
+                std::unique_lock<std::mutex> lock(loop->mutex);
+                loop->finished.wait(lock, [&loop]() { return loop->done.load() == loop->tasks; });
+            }
+            ThreadBudget::release(helpers);
+        }
+
+        int getThreadNum() const override { return helperIndex; }
+        int getNumThreads() const override { return ThreadBudget::total(); }
+        int setNumThreads(int) override { return ThreadBudget::total(); } // The budget decides
+        const char *getName() const override { return "thread-budget"; }
+    };
+#endif
+}
+
+void ThreadBudget::install(int threads)
+{
+    if (threads <= 0)
+        threads = qMax(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    BudgetState &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.installed)
+            return;
+        s.installed = true;
+        s.total = threads;
+        s.free = threads;
+    }
+
+#ifdef NIE_HAVE_PARALLEL_BACKEND
+    for (int i = 1; i < threads; ++i)
+    {
+        s.helpers.emplace_back(helperLoop, i);
+        s.helpers.back().detach();
+    }
+    cv::parallel::setParallelForBackend(std::make_shared<BudgetBackend>(), false);
+#else
+    // Older OpenCV cannot share our threads; at least cap its own pool to the budget
+    cv::setNumThreads(threads);
+    qDebug() << "OpenCV has no pluggable parallel backend; capping it at" << threads << "threads";
+#endif
+}
+
+int ThreadBudget::total()
+{
+    BudgetState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.total;
+}
+
+bool ThreadBudget::routesOpenCv()
+{
+#ifdef NIE_HAVE_PARALLEL_BACKEND
+    BudgetState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.installed;
+#else
+    return false;
+#endif
+}
+
+int ThreadBudget::tryAcquire(int count)
+{
+    BudgetState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    int taken = std::min(count, s.free);
+    s.free -= taken;
+    return taken;
+}
+
+void ThreadBudget::acquire(int count)
+{
+    BudgetState &s = state();
+    std::unique_lock<std::mutex> lock(s.mutex);
+    for (int i = 0; i < count; ++i)
+    {
+        s.slotFreed.wait(lock, [&s]() { return s.free > 0; });
+        --s.free;
+    }
+}
+
+void ThreadBudget::release(int count)
+{
+    BudgetState &s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.free += count;
+    }
+    s.slotFreed.notify_all();
+}
+
+int ThreadBudget::heldByCurrentThread()
+{
+    return slotsHeld;
+}
+
+ThreadBudget::Slot::Slot()
+{
+    ThreadBudget::acquire(1);
+    ++slotsHeld;
+}
+
+ThreadBudget::Slot::~Slot()
+{
+    --slotsHeld;
+    ThreadBudget::release(1);
+}
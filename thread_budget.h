@@ -0,0 +1,43 @@
+// thread_budget.h
+#ifndef THREAD_BUDGET_H
+#define THREAD_BUDGET_H
+
+// One process-wide budget of busy threads, shared by our own render workers and
+// OpenCV's internal parallel loops. A worker holds a slot while it renders, and
+// OpenCV only fans a loop out onto slots that are free at that moment. With as
+// many concurrent renders as cores, kernels therefore run single-threaded instead
+// of each render starting another core's worth of OpenCV threads.
+class ThreadBudget
+{
+public:
+    // Size the budget and route OpenCV's parallel_for through it. Call once at
+    // startup, before any rendering; threads <= 0 uses one per core.
+    static void install(int threads = 0);
+
+    static int total();
+
+    // True if OpenCV's loops run on the budget's threads (OpenCV with a pluggable
+    // parallel backend); otherwise they only run on a pool capped at its size
+    static bool routesOpenCv();
+
+    // Take up to count free slots without waiting; returns how many were taken
+    static int tryAcquire(int count);
+    // Take count slots, waiting until they are free
+    static void acquire(int count);
+    static void release(int count);
+
+    // Slots held through Slot objects on the calling thread
+    static int heldByCurrentThread();
+
+    // Holds one slot for its lifetime, waiting until one is free
+    class Slot
+    {
+    public:
+        Slot();
+        ~Slot();
+        Slot(const Slot &) = delete;
+        Slot &operator=(const Slot &) = delete;
+    };
+};
+
+#endif // THREAD_BUDGET_H
@@ -0,0 +1,329 @@
+// watch_daemon.cpp
+#include "watch_daemon.h"
+#include "graph_executor.h"
+#include "image_processor.h"
+#include "metrics.h"
+#include "node_graph.h"
+#include "renditions.h"
+#include "thread_budget.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    const int SettleIntervalMs = 250;    // A file is picked up once its size is stable this long
+    const int StatsIntervalMs = 10000;
+    const size_t LatencyWindow = 1024;   // Percentiles cover this many recent files
+    const qint64 RateWindowMs = 10000;   // Files per second is averaged over this window
+
+    qint64 nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    qint64 percentile(const std::vector<qint64> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+}
+
+WatchDaemon::WatchDaemon(const Options &options, QObject *parent)
+    : QObject(parent), m_options(options)
+{
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &WatchDaemon::scanDirectory);
+
+    m_settleTimer.setInterval(SettleIntervalMs);
+    connect(&m_settleTimer, &QTimer::timeout, this, &WatchDaemon::checkCandidates);
+
+    m_statsTimer.setInterval(StatsIntervalMs);
+    connect(&m_statsTimer, &QTimer::timeout, this, &WatchDaemon::reportStats);
+}
+
+WatchDaemon::~WatchDaemon()
+{
+    for (int id : m_gaugeIds)
+        Metrics::removeGauge(id);
+
+    // Finish the files in flight but leave the rest of the queue for the next run
+    m_stopping = true;
+    m_queue.close();
+    for (std::thread &worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+bool WatchDaemon::start(QString *error)
+{
+    // Check the graph once up front; every worker loads its own copy
+    NodeGraph graph;
+    if (!graph.load(m_options.graphPath, error))
+        return false;
+
+    Node *outputNode = graph.findFirst("Output");
+    if (!outputNode || outputNode->getChildren().isEmpty() ||
+        outputNode->getChildren().first()->getType() != "Load Image")
+    {
+        if (error)
+            *error = "Graph needs an Output node connected to a Load Image node";
+        return false;
+    }
+
+    if (m_options.watchDirs.isEmpty() || m_options.outputDir.isEmpty())
+    {
+        if (error)
+            *error = "At least one watch folder and an output folder are required";
+        return false;
+    }
+    QDir().mkpath(m_options.outputDir);
+
+    // With several watch folders each gets its own output subfolder, so same-named
+    // files from different folders don't overwrite each other's results
+    for (const QString &dir : m_options.watchDirs)
+    {
+        QString watchDir = QDir(dir).absolutePath();
+        QString outputDir = QDir(m_options.outputDir).absolutePath();
+        if (m_options.watchDirs.size() > 1)
+        {
+            QString name = QDir(watchDir).dirName();
+            outputDir = QDir(outputDir).filePath(name);
+            if (m_outputDirs.values().contains(outputDir))
+            {
+                if (error)
+                    *error = "Watch folders must have different names: " + name;
+                m_outputDirs.clear();
+                return false;
+            }
+            QDir().mkpath(outputDir);
+        }
+        m_outputDirs.insert(watchDir, outputDir);
+    }
+
+    int workers = m_options.workers;
+    if (workers <= 0)
+        workers = ThreadBudget::total();
+    for (int i = 0; i < workers; ++i)
+    {
+        m_workers.emplace_back(&WatchDaemon::workerLoop, this);
+    }
+
+    for (const QString &dir : m_options.watchDirs)
+    {
+        if (!m_watcher.addPath(dir))
+            qWarning() << "Cannot watch folder:" << dir;
+        // Files that arrived while we weren't running
+        scanDirectory(dir);
+    }
+
+    m_gaugeIds.append(Metrics::addGauge("nie_watch_queue_depth", "Settled files waiting for a worker.",
+                                        [this]() { return double(m_queue.size()); }));
+    m_gaugeIds.append(Metrics::addGauge("nie_watch_in_flight", "Files being rendered.",
+                                        [this]() { return double(m_inFlight.load()); }));
+
+    m_statsTimer.start();
+    qInfo() << "Watching" << m_options.watchDirs << "with" << workers << "workers";
+    return true;
+}
+
+void WatchDaemon::scanDirectory(const QString &dir)
+{
+    static const QStringList filters = {"*.png", "*.jpg", "*.jpeg", "*.bmp", "*.tif", "*.tiff", "*.webp"};
+    const QString outputDir = QDir(m_options.outputDir).absolutePath();
+
+    QDir directory(dir);
+    for (const QFileInfo &info : directory.entryInfoList(filters, QDir::Files))
+    {
+        QString path = info.absoluteFilePath();
+        if (info.absolutePath() == outputDir || m_seen.contains(path) || m_candidates.contains(path))
+            continue;
+
+        Candidate candidate;
+        candidate.firstSeenMs = nowMs();
+        m_candidates.insert(path, candidate);
+    }
+
+    if (!m_candidates.isEmpty() && !m_settleTimer.isActive())
+        m_settleTimer.start();
+}
+
+void WatchDaemon::checkCandidates()
+{
+    // Ingest may still be writing a file; queue it once its size stops changing
+    for (auto it = m_candidates.begin(); it != m_candidates.end();)
+    {
+        QFileInfo info(it.key());
+        if (!info.exists())
+        {
+            it = m_candidates.erase(it);
+            continue;
+        }
+
+        if (info.size() > 0 && info.size() == it->size)
+        {
+            // Never block the event loop on a full queue; the file stays a candidate
+            // and is offered again on the next tick
+            Job job{it.key(), m_outputDirs.value(info.absolutePath(), m_options.outputDir), it->firstSeenMs};
+            if (m_queue.tryPush(job))
+            {
+                m_seen.insert(it.key());
+                it = m_candidates.erase(it);
+                continue;
+            }
+        }
+
+        it->size = info.size();
+        ++it;
+    }
+
+    if (m_candidates.isEmpty())
+        m_settleTimer.stop();
+}
+
+void WatchDaemon::workerLoop()
+{
+    // The graph and executor stay loaded for the daemon's lifetime
+    NodeGraph graph;
+    graph.load(m_options.graphPath);
+    Node *outputNode = graph.findFirst("Output");
+    Node *sourceNode = outputNode->getChildren().first();
+
+    // Every file is new, so intermediate results are neither kept nor persisted
+    GraphExecutor executor(nullptr, 0);
+
+    QString format = outputNode->getProperty("outputFormat")->toString();
+    int quality = outputNode->getProperty("quality")->toInt();
+    QList<Renditions::Rendition> renditions =
+        Renditions::parse(outputNode->getProperty("renditions")->toString(), format);
+
+    Job job;
+    while (!m_stopping && m_queue.pop(job))
+    {
+        ThreadBudget::Slot slot; // Released at the end of this file
+        ++m_inFlight;
+        sourceNode->getProperty("filePath")->setValue(job.path);
+
+        bool ok = false;
+        try
+        {
+            cv::Mat result = executor.evaluate(outputNode);
+            if (!result.empty())
+            {
+                // Written atomically, so consumers never see a partial result
+                QString outputPath = QDir(job.outputDir)
+                                         .filePath(QFileInfo(job.path).completeBaseName() + "." + format.toLower());
+                if (renditions.isEmpty())
+                    ok = ImageProcessor::writeImage(result, outputPath, format, quality);
+                else
+                    ok = Renditions::write(result, renditions, outputPath, quality).size() == renditions.size();
+                if (!ok)
+                    qWarning() << "Failed to write result:" << outputPath;
+            }
+            else
+            {
+                qWarning() << "Failed to process:" << job.path;
+            }
+        }
+        catch (const cv::Exception &e)
+        {
+            qWarning() << "Failed to process:" << job.path << e.what();
+        }
+
+        --m_inFlight;
+        recordResult(nowMs() - job.detectedMs, ok);
+    }
+}
+
+void WatchDaemon::recordResult(qint64 latencyMs, bool ok)
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    if (!ok)
+    {
+        ++m_failed;
+        return;
+    }
+
+    ++m_processed;
+    m_latencies.push_back(latencyMs);
+    if (m_latencies.size() > LatencyWindow)
+        m_latencies.pop_front();
+
+    qint64 now = nowMs();
+    m_completions.push_back(now);
+    while (!m_completions.empty() && m_completions.front() < now - RateWindowMs)
+        m_completions.pop_front();
+}
+
+void WatchDaemon::reportStats()
+{
+    std::vector<qint64> latencies;
+    quint64 processed, failed;
+    double filesPerSecond;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        latencies.assign(m_latencies.begin(), m_latencies.end());
+        processed = m_processed;
+        failed = m_failed;
+
+        qint64 now = nowMs();
+        while (!m_completions.empty() && m_completions.front() < now - RateWindowMs)
+            m_completions.pop_front();
+        filesPerSecond = m_completions.size() * 1000.0 / RateWindowMs;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const size_t queued = m_queue.size();
+    QString report;
+    QTextStream out(&report);
+    out << "queue_depth " << queued << "\n"
+        << "settling " << m_candidates.size() << "\n"
+        << "in_flight " << m_inFlight.load() << "\n"
+        << "processed_total " << processed << "\n"
+        << "failed_total " << failed << "\n"
+        << "latency_ms_p50 " << percentile(latencies, 0.50) << "\n"
+        << "latency_ms_p95 " << percentile(latencies, 0.95) << "\n"
+        << "latency_ms_p99 " << percentile(latencies, 0.99) << "\n"
+        << "files_per_second " << filesPerSecond << "\n";
+    out.flush();
+
+    qInfo().noquote() << QString("queue %1, in flight %2, done %3 (%4 failed), p50 %5 ms, p95 %6 ms, p99 %7 ms, %8 files/s")
+                             .arg(queued)
+                             .arg(m_inFlight.load())
+                             .arg(processed)
+                             .arg(failed)
+                             .arg(percentile(latencies, 0.50))
+                             .arg(percentile(latencies, 0.95))
+                             .arg(percentile(latencies, 0.99))
+                             .arg(filesPerSecond, 0, 'f', 2);
+
+    if (!m_options.statsPath.isEmpty())
+    {
+        QSaveFile file(m_options.statsPath);
+        if (file.open(QIODevice::WriteOnly))
+        {
+            file.write(report.toUtf8());
+            file.commit();
+        }
+    }
+
+    if (!m_options.metricsPath.isEmpty() && !Metrics::writeFile(m_options.metricsPath))
+        qWarning() << "Cannot write metrics file:" << m_options.metricsPath;
+
+    // Forget files that have since been removed from the spool
+    for (auto it = m_seen.begin(); it != m_seen.end();)
+    {
+        if (QFileInfo::exists(*it))
+            ++it;
+        else
+            it = m_seen.erase(it);
+    }
+}
@@ -0,0 +1,86 @@
+// watch_daemon.h
+#ifndef WATCH_DAEMON_H
+#define WATCH_DAEMON_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+
+// Headless mode that runs every image dropped into the watched folders through a
+// fixed graph. Folders are watched with QFileSystemWatcher (inotify on Linux);
+// worker threads keep their loaded graph and executor between files, and results
+// are written atomically. Queue depth, latency percentiles and throughput are
+// logged and optionally written to a stats file, alongside the engine's Prometheus metrics.
+class WatchDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    struct Options
+    {
+        QString graphPath;       // Graph saved from the editor; its first Output node is rendered
+        QStringList watchDirs;
+        QString outputDir;
+        QString statsPath;       // Optional file rewritten with the current metrics
+        QString metricsPath;     // Optional file rewritten with engine metrics in Prometheus format
+        int workers = 0;         // <= 0 uses the thread budget
+    };
+
+    explicit WatchDaemon(const Options &options, QObject *parent = nullptr);
+    ~WatchDaemon();
+
+    // Validate the graph, start the workers and queue files already waiting
+    bool start(QString *error = nullptr);
+
+private slots:
+    void scanDirectory(const QString &dir);
+    void checkCandidates();
+    void reportStats();
+
+private:
+    struct Job
+    {
+        QString path;
+        QString outputDir;
+        qint64 detectedMs = 0;
+    };
+
+    struct Candidate
+    {
+        qint64 size = -1;
+        qint64 firstSeenMs = 0;
+    };
+
+    void workerLoop();
+    void recordResult(qint64 latencyMs, bool ok);
+
+    Options m_options;
+    QFileSystemWatcher m_watcher;
+    QTimer m_settleTimer;
+    QTimer m_statsTimer;
+    QHash<QString, Candidate> m_candidates; // New files, held back until they stop growing
+    QSet<QString> m_seen;
+    QHash<QString, QString> m_outputDirs; // Watch folder -> where its results are written
+
+    BoundedQueue<Job> m_queue{65536};
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_statsMutex;
+    std::deque<qint64> m_latencies;    // Most recent latencies in ms
+    std::deque<qint64> m_completions;  // Completion times in ms, for files per second
+    quint64 m_processed = 0;
+    quint64 m_failed = 0;
+    std::atomic<int> m_inFlight{0};
+    std::atomic<bool> m_stopping{false};
+    QList<int> m_gaugeIds;
+};
+
+#endif // WATCH_DAEMON_H